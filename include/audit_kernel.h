@@ -0,0 +1,352 @@
+#ifndef LAPOR_AUDIT_KERNEL_H
+#define LAPOR_AUDIT_KERNEL_H
+
+/* Row dot-product kernels for the server audit.
+ *
+ * Each kernel computes the dot product, mod P57, of a range of columns of
+ * one packed matrix row against the challenge vector. A packed row stores
+ * n chunks of BYTES_UNDER_P bytes each, so every 8 columns occupy exactly
+ * 7 uint64_t words (56 bytes); column ranges must start and end on such
+ * 8-column groups.
+ *
+ * The vector kernels unpack four (AVX2) or eight (AVX-512) chunks per
+ * instruction with a byte shuffle, then split each chunk and each challenge
+ * entry into 28-bit limbs so the products fit the 32x32->64 bit vector
+ * multiplier. The limbs are split on the fly rather than stored, since for
+ * wide matrices the extra challenge traffic costs more than the two
+ * instructions. The kernel is picked at runtime with cpuid, so the same
+ * binary runs on machines without AVX-512.
+ */
+
+#include "integrity.h"
+#include "p57.h"
+#include "field.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define AUDIT_KERNEL_X86 (1)
+#include <immintrin.h>
+#endif
+
+#define LIMB_BITS (28)
+#define LIMB_MASK ((UINT64_C(1) << LIMB_BITS) - 1)
+
+// number of limb products each 64-bit vector lane may hold before flushing;
+// the largest per-lane term is d0*c1 + d1*c0 < 2^57 + 2^56 < 2^58
+#define LANE_FLUSH_TERMS (64)
+
+typedef struct {
+	uint64_t n;
+	const uint64_t *chal; // challenge vector itself, entries < P57
+} audit_chal_t;
+
+typedef uint64_t (*row_dot_fn)(const uint64_t *raw_row, const audit_chal_t *ch,
+		size_t col, size_t ncols);
+
+typedef struct {
+	const char *name;
+	row_dot_fn fn;
+} audit_kernel_t;
+
+static inline void audit_chal_init(audit_chal_t *ch, const uint64_t *chal, uint64_t n) {
+	ch->n = n;
+	ch->chal = chal;
+}
+
+static inline void audit_chal_clear(audit_chal_t *ch) {
+	ch->chal = NULL;
+}
+
+// the original scalar loop, kept as the reference for self-check mode; it
+// still reduces with % on a counter, but unpacks the chunks as field.h does,
+// so it follows BYTES_UNDER_P
+static uint64_t row_dot_reference(const uint64_t *raw_row, const audit_chal_t *ch,
+		size_t col, size_t ncols)
+{
+	const uint64_t *challenge1 = ch->chal + col;
+	raw_row += col / 8 * BYTES_UNDER_P;
+
+	// dot product accross the row, 8 chunks (BYTES_UNDER_P words) at a time
+	uint128_t row_val = 0;
+	size_t accum_count = 0;
+	for (size_t raw_ind = 0, full_ind = 0; full_ind < ncols; raw_ind += BYTES_UNDER_P, full_ind += 8) {
+		// avoid overflow using mod when needed
+		if ((accum_count += 8) > MAX_ACCUM_P) {
+			row_val %= P57;
+			accum_count = 8;
+		}
+		for (unsigned t = 0; t < 8; ++t) {
+			row_val += (uint128_t)field_chunk(raw_row + raw_ind, BYTES_UNDER_P, t) * challenge1[full_ind + t];
+		}
+	}
+
+	return row_val % P57;
+}
+
+// scalar loop with lazy P57 folding once per block instead of a counter,
+// specialized for 7-byte chunks by field.h
+static uint64_t row_dot_scalar(const uint64_t *raw_row, const audit_chal_t *ch,
+		size_t col, size_t ncols)
+{
+	return field_p57_dot(raw_row, ch->chal, col, ncols);
+}
+
+// recombines the three limb-product sums, each already reduced, into one
+// value mod P57
+static inline uint64_t limb_combine(uint64_t lo, uint64_t mid, uint64_t hi) {
+	uint128_t total = (uint128_t)lo
+		+ ((uint128_t)mid << LIMB_BITS)
+		+ ((uint128_t)hi << (2 * LIMB_BITS));
+	return p57_reduce(total);
+}
+
+#ifdef AUDIT_KERNEL_X86
+
+// sums four lanes of residues mod P57
+__attribute__((target("avx2")))
+static inline uint64_t hsum_avx2(__m256i v) {
+	uint64_t sum = (uint64_t)_mm256_extract_epi64(v, 0)
+		+ (uint64_t)_mm256_extract_epi64(v, 1)
+		+ (uint64_t)_mm256_extract_epi64(v, 2)
+		+ (uint64_t)_mm256_extract_epi64(v, 3);
+	return p57_reduce64(sum);
+}
+
+__attribute__((target("avx2")))
+static uint64_t row_dot_avx2(const uint64_t *raw_row, const audit_chal_t *ch,
+		size_t col, size_t ncols)
+{
+	assert (BYTES_UNDER_P == 7);
+	// each 128-bit half holds two 7-byte chunks, zero-extended to 8 bytes
+	const __m256i shuf = _mm256_setr_epi8(
+			0, 1, 2, 3, 4, 5, 6, -1, 7, 8, 9, 10, 11, 12, 13, -1,
+			0, 1, 2, 3, 4, 5, 6, -1, 7, 8, 9, 10, 11, 12, 13, -1);
+	const __m256i mask = _mm256_set1_epi64x(LIMB_MASK);
+	const uint8_t *bytes = (const uint8_t*)(raw_row + col / 8 * 7);
+	const uint64_t *cv = ch->chal + col;
+	size_t ngroups = ncols / 8;
+	// lane-wise residues mod P57 of each limb-product sum
+	__m256i rlo = _mm256_setzero_si256();
+	__m256i rmid = _mm256_setzero_si256();
+	__m256i rhi = _mm256_setzero_si256();
+
+	// the loads for one group reach 2 bytes past its end, so the final
+	// group is left for the scalar kernel
+	size_t g = 0;
+	while (g + 1 < ngroups) {
+		size_t stop = g + LANE_FLUSH_TERMS / 2;
+		if (stop > ngroups - 1) stop = ngroups - 1;
+		__m256i alo = _mm256_setzero_si256();
+		__m256i amid = _mm256_setzero_si256();
+		__m256i ahi = _mm256_setzero_si256();
+		for (; g < stop; ++g) {
+			const uint8_t *p = bytes + 56 * g;
+			for (int h = 0; h < 2; ++h) {
+				__m256i d = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 28*h))),
+						_mm_loadu_si128((const __m128i*)(p + 28*h + 14)), 1);
+				d = _mm256_shuffle_epi8(d, shuf);
+				__m256i d0 = _mm256_and_si256(d, mask);
+				__m256i d1 = _mm256_srli_epi64(d, LIMB_BITS);
+				__m256i c = _mm256_loadu_si256((const __m256i*)(cv + 8*g + 4*h));
+				__m256i c0 = _mm256_and_si256(c, mask);
+				__m256i c1 = _mm256_srli_epi64(c, LIMB_BITS);
+				alo = _mm256_add_epi64(alo, _mm256_mul_epu32(d0, c0));
+				amid = _mm256_add_epi64(amid, _mm256_add_epi64(
+							_mm256_mul_epu32(d0, c1), _mm256_mul_epu32(d1, c0)));
+				ahi = _mm256_add_epi64(ahi, _mm256_mul_epu32(d1, c1));
+			}
+		}
+		rlo = p57_add_epi64_avx2(rlo, p57_reduce_epi64_avx2(alo));
+		rmid = p57_add_epi64_avx2(rmid, p57_reduce_epi64_avx2(amid));
+		rhi = p57_add_epi64_avx2(rhi, p57_reduce_epi64_avx2(ahi));
+	}
+
+	uint64_t lo = hsum_avx2(rlo);
+	if (ngroups) {
+		lo = p57_add(lo, row_dot_scalar(raw_row, ch, col + 8 * (ngroups - 1), 8));
+	}
+	return limb_combine(lo, hsum_avx2(rmid), hsum_avx2(rhi));
+}
+
+// sums eight lanes of residues mod P57
+__attribute__((target("avx512f")))
+static inline uint64_t hsum_avx512(__m512i v) {
+	return p57_reduce64(_mm512_reduce_add_epi64(v));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t row_dot_avx512(const uint64_t *raw_row, const audit_chal_t *ch,
+		size_t col, size_t ncols)
+{
+	assert (BYTES_UNDER_P == 7);
+	// each 128-bit lane holds two 7-byte chunks, zero-extended to 8 bytes
+	const __m512i shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(
+			0, 1, 2, 3, 4, 5, 6, -1, 7, 8, 9, 10, 11, 12, 13, -1));
+	const __m512i mask = _mm512_set1_epi64(LIMB_MASK);
+	const uint8_t *bytes = (const uint8_t*)(raw_row + col / 8 * 7);
+	const uint64_t *cv = ch->chal + col;
+	size_t ngroups = ncols / 8;
+	// lane-wise residues mod P57 of each limb-product sum
+	__m512i rlo = _mm512_setzero_si512();
+	__m512i rmid = _mm512_setzero_si512();
+	__m512i rhi = _mm512_setzero_si512();
+
+	// the loads for one group reach 2 bytes past its end, so the final
+	// group is left for the scalar kernel
+	size_t g = 0;
+	while (g + 1 < ngroups) {
+		size_t stop = g + LANE_FLUSH_TERMS;
+		if (stop > ngroups - 1) stop = ngroups - 1;
+		__m512i alo = _mm512_setzero_si512();
+		__m512i amid = _mm512_setzero_si512();
+		__m512i ahi = _mm512_setzero_si512();
+		for (; g < stop; ++g) {
+			const uint8_t *p = bytes + 56 * g;
+			__m512i d = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*)p));
+			d = _mm512_inserti32x4(d, _mm_loadu_si128((const __m128i*)(p + 14)), 1);
+			d = _mm512_inserti32x4(d, _mm_loadu_si128((const __m128i*)(p + 28)), 2);
+			d = _mm512_inserti32x4(d, _mm_loadu_si128((const __m128i*)(p + 42)), 3);
+			d = _mm512_shuffle_epi8(d, shuf);
+			__m512i d0 = _mm512_and_si512(d, mask);
+			__m512i d1 = _mm512_srli_epi64(d, LIMB_BITS);
+			__m512i c = _mm512_loadu_si512((const void*)(cv + 8*g));
+			__m512i c0 = _mm512_and_si512(c, mask);
+			__m512i c1 = _mm512_srli_epi64(c, LIMB_BITS);
+			alo = _mm512_add_epi64(alo, _mm512_mul_epu32(d0, c0));
+			amid = _mm512_add_epi64(amid, _mm512_add_epi64(
+						_mm512_mul_epu32(d0, c1), _mm512_mul_epu32(d1, c0)));
+			ahi = _mm512_add_epi64(ahi, _mm512_mul_epu32(d1, c1));
+		}
+		rlo = p57_add_epi64_avx512(rlo, p57_reduce_epi64_avx512(alo));
+		rmid = p57_add_epi64_avx512(rmid, p57_reduce_epi64_avx512(amid));
+		rhi = p57_add_epi64_avx512(rhi, p57_reduce_epi64_avx512(ahi));
+	}
+
+	uint64_t lo = hsum_avx512(rlo);
+	if (ngroups) {
+		lo = p57_add(lo, row_dot_scalar(raw_row, ch, col + 8 * (ngroups - 1), 8));
+	}
+	return limb_combine(lo, hsum_avx512(rmid), hsum_avx512(rhi));
+}
+
+#endif // AUDIT_KERNEL_X86
+
+// columns of a row that stay in L1 while every challenge passes over them
+#define MULTI_BLOCK_COLS (2048)
+
+/* Dot products of one row with each of nchal challenges. The row is walked
+ * in blocks so each block is loaded from memory once and then reused from
+ * cache by all the challenges.
+ */
+static inline void row_dot_multi(row_dot_fn fn, const uint64_t *raw_row,
+		const audit_chal_t *chals, uint32_t nchal, size_t ncols, uint64_t *out)
+{
+	if (nchal == 1) {
+		out[0] = fn(raw_row, chals, 0, ncols);
+		return;
+	}
+	for (uint32_t j = 0; j < nchal; ++j) {
+		out[j] = 0;
+	}
+	for (size_t col = 0; col < ncols; col += MULTI_BLOCK_COLS) {
+		size_t len = (ncols - col < MULTI_BLOCK_COLS) ? ncols - col : MULTI_BLOCK_COLS;
+		for (uint32_t j = 0; j < nchal; ++j) {
+			out[j] = p57_add(out[j], fn(raw_row, &chals[j], col, len));
+		}
+	}
+}
+
+/* Adds the dot products of columns [col, col+ncols) of one row with each
+ * of nchal challenges to out, blocked as in row_dot_multi. */
+static inline void row_dot_multi_add(row_dot_fn fn, const uint64_t *raw_row,
+		const audit_chal_t *chals, uint32_t nchal, size_t col, size_t ncols, uint64_t *out)
+{
+	for (size_t c = col; c < col + ncols; c += MULTI_BLOCK_COLS) {
+		size_t len = (col + ncols - c < MULTI_BLOCK_COLS) ? col + ncols - c : MULTI_BLOCK_COLS;
+		for (uint32_t j = 0; j < nchal; ++j) {
+			out[j] = p57_add(out[j], fn(raw_row, &chals[j], c, len));
+		}
+	}
+}
+
+// fallback when the cache sizes cannot be read
+#define TILE_DEFAULT_L2 (256 * 1024)
+// most bytes of rows a thread holds for one band
+#define TILE_MAX_BAND_BYTES (8 << 20)
+#define TILE_MAX_ROWS (16)
+
+/* Rows per band: as many as fit in TILE_MAX_BAND_BYTES, up to TILE_MAX_ROWS.
+ * Each challenge tile is brought into cache once per band rather than once
+ * per row. */
+static inline size_t audit_tile_rows(size_t row_bytes) {
+	size_t rows = TILE_MAX_BAND_BYTES / row_bytes;
+	if (rows > TILE_MAX_ROWS) rows = TILE_MAX_ROWS;
+	return rows ? rows : 1;
+}
+
+/* Columns per tile so that the tiles of every challenge, together with the
+ * same columns of every row in the band, fill about half of the L2 cache. */
+static inline size_t audit_tile_cols(uint32_t nchal, size_t tile_rows) {
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2 <= 0) l2 = TILE_DEFAULT_L2;
+	size_t cols = (size_t)l2 / 2 / (nchal * sizeof(uint64_t) + tile_rows * BYTES_UNDER_P);
+	cols = cols / CHUNK_ALIGN * CHUNK_ALIGN;
+	return cols ? cols : CHUNK_ALIGN;
+}
+
+/* Dot products of nrows rows with each of nchal challenges, a column tile
+ * at a time: every row of the band is run against one tile of the
+ * challenges while it is still in L2, before moving on to the next tile.
+ * out holds the nchal products of rows[0], then those of rows[1], and so
+ * on; the nrows*nchal partial sums stay in L1.
+ */
+static inline void row_dot_tiled(row_dot_fn fn, const uint64_t *const *rows, size_t nrows,
+		const audit_chal_t *chals, uint32_t nchal, size_t ncols, size_t tile_cols, uint64_t *out)
+{
+	for (size_t k = 0; k < nrows * nchal; ++k) {
+		out[k] = 0;
+	}
+	for (size_t col = 0; col < ncols; col += tile_cols) {
+		size_t len = (ncols - col < tile_cols) ? ncols - col : tile_cols;
+		for (size_t r = 0; r < nrows; ++r) {
+			for (uint32_t j = 0; j < nchal; ++j) {
+				out[r * nchal + j] = p57_add(out[r * nchal + j], fn(rows[r], &chals[j], col, len));
+			}
+		}
+	}
+}
+
+static const audit_kernel_t AUDIT_KERNELS[] = {
+#ifdef AUDIT_KERNEL_X86
+	{"avx512", row_dot_avx512},
+	{"avx2", row_dot_avx2},
+#endif
+	{"scalar", row_dot_scalar},
+	{NULL, NULL}
+};
+
+static inline bool audit_kernel_supported(const char *name) {
+#ifdef AUDIT_KERNEL_X86
+	__builtin_cpu_init();
+	if (strcmp(name, "avx512") == 0)
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return strcmp(name, "scalar") == 0;
+}
+
+/* Picks the kernel by name, or the fastest one this cpu supports when
+ * name is NULL or "auto". Returns NULL if the named kernel is unknown or
+ * unsupported.
+ */
+static inline const audit_kernel_t* select_audit_kernel(const char *name) {
+	bool pick_best = (name == NULL || strcmp(name, "auto") == 0);
+	for (const audit_kernel_t *k = AUDIT_KERNELS; k->name; ++k) {
+		if ((pick_best || strcmp(name, k->name) == 0) && audit_kernel_supported(k->name))
+			return k;
+	}
+	return NULL;
+}
+
+#endif // LAPOR_AUDIT_KERNEL_H
@@ -0,0 +1,86 @@
+#ifndef LAPOR_AUDIT_PROTO_H
+#define LAPOR_AUDIT_PROTO_H
+
+/* Wire format of audit requests, shared by client and server.
+ *
+ * 'A' (original): the client sends n challenge words, the server ACKs
+ *     with '1' and replies with m response words.
+ * 'X' (extended): the client sends an audit_req_t followed by nchal
+ *     challenge vectors of n words each. The server ACKs with '1', scans
+ *     the matrix once, and replies with m*nchal words in row order (the
+ *     nchal responses for row 0 come first).
+ * 'X' with AUDIT_FLAG_SEEDED: instead of the challenge vectors the client
+ *     sends an audit_seeds_t followed by nchal 64-bit seeds, and both
+ *     sides expand them as in challenge_prg.h. There is no ACK; the
+ *     server replies with the responses as soon as they are computed.
+ * 'X' with AUDIT_FLAG_STREAM: instead of one block of m*nchal words, the
+ *     server sends the responses in segments as row ranges finish, each an
+ *     audit_seg_t followed by count*nchal words (none if the status is not
+ *     AUDIT_SEG_OK). Segments come in any order and never overlap; the last
+ *     one has status AUDIT_SEG_END and count zero.
+ * 'X' with AUDIT_FLAG_RANGES: right after the audit_req_t the client sends
+ *     an audit_ranges_t and that many audit_range_t, and the server scans
+ *     only those rows (see bands.h). Ranges are sorted, non-empty and do
+ *     not overlap. The responses cover only those rows, range by range;
+ *     streamed segments still carry absolute row numbers.
+ *
+ * In all cases the client finishes by sending its one-way comm time as
+ * a double. All integers are sent in host byte order.
+ */
+
+#include <stdint.h>
+
+#define AUDIT_OP ('A')
+#define AUDIT_EXT_OP ('X')
+
+// most challenge vectors a single extended audit may carry
+#define AUDIT_MAX_CHAL (64)
+
+// challenges are sent as seeds rather than in full
+#define AUDIT_FLAG_SEEDED (UINT32_C(1) << 0)
+
+// responses are streamed in segments
+#define AUDIT_FLAG_STREAM (UINT32_C(1) << 1)
+
+// only some row ranges are audited
+#define AUDIT_FLAG_RANGES (UINT32_C(1) << 2)
+
+// every flag this version understands; others must be zero
+#define AUDIT_KNOWN_FLAGS (AUDIT_FLAG_SEEDED | AUDIT_FLAG_STREAM | AUDIT_FLAG_RANGES)
+
+// most row ranges a single audit may name
+#define AUDIT_MAX_RANGES (1024)
+
+typedef struct {
+	uint32_t nchal;  // number of challenge vectors
+	uint32_t flags;  // AUDIT_FLAG_* bits
+} audit_req_t;
+
+typedef struct {
+	uint32_t prg;       // CHAL_PRG_* identifier
+	uint32_t reserved;  // must be zero
+} audit_seeds_t;
+
+typedef struct {
+	uint32_t nranges;   // number of audit_range_t that follow
+	uint32_t reserved;  // must be zero
+} audit_ranges_t;
+
+typedef struct {
+	uint64_t start;  // first row
+	uint64_t count;  // number of rows
+} audit_range_t;
+
+// status of a streamed segment
+#define AUDIT_SEG_OK (0)      // count*nchal responses follow
+#define AUDIT_SEG_FAILED (1)  // the server could not compute these rows
+#define AUDIT_SEG_END (2)     // no more segments
+
+typedef struct {
+	uint64_t start;     // first row
+	uint64_t count;     // number of rows
+	uint32_t status;    // AUDIT_SEG_*
+	uint32_t reserved;  // zero
+} audit_seg_t;
+
+#endif // LAPOR_AUDIT_PROTO_H
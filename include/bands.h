@@ -0,0 +1,49 @@
+#ifndef LAPOR_BANDS_H
+#define LAPOR_BANDS_H
+
+/* Per-band secret vectors, for audits of part of the matrix.
+ *
+ * The m rows are cut into nbands contiguous bands, band b holding rows
+ * [band_start(m, nbands, b), band_start(m, nbands, b+1)). Its secret is
+ * r^T M over those rows only, so the full secret is the sum of the band
+ * secrets, and an audit of a set of bands checks r.y over their rows
+ * against the sum of their secrets dotted with the challenge.
+ *
+ * dual_init -b appends them to the client config, after secret1:
+ *   BAND_CONFIG_TAG, nbands, then nbands secrets of n words each.
+ * Configs without the trailer still work for whole-matrix audits.
+ */
+
+#include "integrity.h"
+
+// "LAPORBND", marks the band trailer in the client config
+#define BAND_CONFIG_TAG (UINT64_C(0x444e42524f50414c))
+
+/* First row of band b; band_start(m, nbands, nbands) is m. */
+static inline uint64_t band_start(uint64_t m, uint64_t nbands, uint64_t b) {
+	return (uint128_t)m * b / nbands;
+}
+
+/* The band row i belongs to. */
+static inline uint64_t band_of_row(uint64_t m, uint64_t nbands, uint64_t i) {
+	return ((uint128_t)(i + 1) * nbands - 1) / m;
+}
+
+/* Byte offset of the secret of band b in a client config. */
+static inline long band_secret_offset(uint64_t n, uint64_t m, uint64_t b) {
+	return (2 + m + n + 2 + b * n) * sizeof(uint64_t);
+}
+
+/* Reads the band trailer header from a client config. Returns nbands, with
+ * f positioned at the first band secret, or 0 if the config has no bands. */
+static inline uint64_t band_config_load(FILE *f, uint64_t n, uint64_t m) {
+	uint64_t hdr[2];
+	if (fseek(f, (2 + m + n) * sizeof(uint64_t), SEEK_SET)
+			|| fread(hdr, sizeof *hdr, 2, f) != 2
+			|| hdr[0] != BAND_CONFIG_TAG) {
+		return 0;
+	}
+	return hdr[1];
+}
+
+#endif // LAPOR_BANDS_H
@@ -0,0 +1,53 @@
+#ifndef LAPOR_CHALLENGE_PRG_H
+#define LAPOR_CHALLENGE_PRG_H
+
+/* Expansion of a short seed into a challenge vector mod P57.
+ *
+ * Client and server must agree bit for bit on the expansion, so every PRG
+ * gets a fixed identifier that goes over the wire with the seed. The
+ * vector is cut into blocks of CHAL_PRG_BLOCK entries, and each block is
+ * generated from its own generator keyed with (seed, block index), so the
+ * blocks can be filled in parallel.
+ */
+
+#include "integrity.h"
+
+// TinyMT64 keyed by init_by_array({seed, block}), rejection sampled like rand_mod_p
+#define CHAL_PRG_TINYMT64 (1)
+
+// challenge entries generated from each keyed generator
+#define CHAL_PRG_BLOCK (4096)
+
+static inline bool chal_prg_supported(uint32_t prg) {
+	return prg == CHAL_PRG_TINYMT64;
+}
+
+/* Fills vec[start, stop) of the challenge for `seed`; start must be a
+ * multiple of CHAL_PRG_BLOCK and stop at most one block further. */
+static inline void chal_prg_block(uint64_t seed, uint64_t *vec, uint64_t start, uint64_t stop) {
+	uint64_t key[2] = {seed, start / CHAL_PRG_BLOCK};
+	tinymt64_t state = {0};
+	tinymt64_init_by_array(&state, key, 2);
+	for (uint64_t i = start; i < stop; ++i) {
+		vec[i] = rand_mod_p(&state);
+	}
+}
+
+/* Expands nchal seeds into nchal challenge vectors of n words each, stored
+ * one after the other in out. Blocks are spread over the OpenMP threads. */
+static inline void expand_challenges(uint32_t prg, const uint64_t *seeds,
+		uint32_t nchal, uint64_t n, uint64_t *out)
+{
+	assert (chal_prg_supported(prg));
+	uint64_t nblocks = 1 + (n - 1) / CHAL_PRG_BLOCK;
+
+#pragma omp parallel for schedule(static)
+	for (uint64_t t = 0; t < nchal * nblocks; ++t) {
+		uint64_t j = t / nblocks;
+		uint64_t start = (t % nblocks) * CHAL_PRG_BLOCK;
+		uint64_t stop = (n - start < CHAL_PRG_BLOCK) ? n : start + CHAL_PRG_BLOCK;
+		chal_prg_block(seeds[j], out + j * n, start, stop);
+	}
+}
+
+#endif // LAPOR_CHALLENGE_PRG_H
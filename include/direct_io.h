@@ -0,0 +1,74 @@
+#ifndef LAPOR_DIRECT_IO_H
+#define LAPOR_DIRECT_IO_H
+
+/* Row reads through O_DIRECT, which bypass the page cache so that a full
+ * scan of the data file does not evict everything else on the host.
+ *
+ * O_DIRECT needs the file offset, length and buffer all aligned, but rows
+ * are 7n bytes long. So each row is read as the smallest aligned span that
+ * covers it, and the row is returned as a pointer into that span. Since n
+ * is a multiple of CHUNK_ALIGN, row offsets are multiples of 8 and the row
+ * pointer stays word aligned.
+ */
+
+#include "integrity.h"
+#include <fcntl.h>
+
+// safe for every block device and filesystem we run on
+#define DIRECT_ALIGN (4096)
+
+static inline uint64_t direct_span_start(uint64_t offset) {
+	return offset & ~(uint64_t)(DIRECT_ALIGN - 1);
+}
+
+static inline uint64_t direct_span_stop(uint64_t offset, size_t len) {
+	return (offset + len + DIRECT_ALIGN - 1) & ~(uint64_t)(DIRECT_ALIGN - 1);
+}
+
+/* Buffer size needed to read any len-byte row at any offset. */
+static inline size_t direct_buf_bytes(size_t len) {
+	return (len + 2 * DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+}
+
+/* Allocates a buffer suitable for direct_pread_row. */
+static inline void* direct_buf_alloc(size_t len) {
+	void *buf;
+	if (posix_memalign(&buf, DIRECT_ALIGN, direct_buf_bytes(len))) {
+		return NULL;
+	}
+	return buf;
+}
+
+/* Opens path for O_DIRECT reads, or returns -1 if the filesystem does not
+ * support it. */
+static inline int direct_open(const char *path) {
+	return open(path, O_RDONLY | O_DIRECT);
+}
+
+/* Reads len bytes at offset from an O_DIRECT fd into buf (from
+ * direct_buf_alloc), and returns where the row starts in buf. Anything past
+ * the end of the file comes back as zeros, as with my_pread. */
+static inline uint64_t* direct_pread_row(int fd, void *buf, size_t len, uint64_t offset) {
+	uint64_t start = direct_span_start(offset);
+	uint64_t stop = direct_span_stop(offset, len);
+	size_t got = 0;
+	while (start + got < stop) {
+		ssize_t res = pread(fd, (char*)buf + got, stop - start - got, start + got);
+		if (res < 0) {
+			perror("pread in direct_pread_row");
+			exit(10);
+		}
+		got += res;
+		// only the read that hits the end of the file comes back short
+		if (res == 0 || got % DIRECT_ALIGN) break;
+	}
+
+	char *row = (char*)buf + (offset - start);
+	size_t valid = (start + got > offset) ? start + got - offset : 0;
+	if (valid < len) {
+		memset(row + valid, 0, len - valid);
+	}
+	return (uint64_t*)row;
+}
+
+#endif // LAPOR_DIRECT_IO_H
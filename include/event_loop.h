@@ -0,0 +1,448 @@
+#ifndef LAPOR_EVENT_LOOP_H
+#define LAPOR_EVENT_LOOP_H
+
+/* A non-blocking, epoll driven front end for the server.
+ *
+ * One process holds every client connection, however many there are, and
+ * waits on all of them with epoll; an idle or slow client costs it a few
+ * hundred bytes and a descriptor rather than a process. Requests are
+ * parsed as their bytes arrive:
+ *
+ *   - retrievals ('R') are served right there. Their Merkle hashes go out
+ *     as the client asks for them, and their blocks are sent with sendfile
+ *     (or, for a compressed store, read and sent a window at a time)
+ *     whenever the socket can take more;
+ *   - so are proof retrievals ('P'), whose hashes are all copied out of
+ *     the mapped tree and queued at once, ahead of the blocks;
+ *   - audits, updates and framed connections ('A', 'X', 'U', 'F') need
+ *     the compute pool, so once their op byte is in, the connection is
+ *     handed to a worker over a SOCK_SEQPACKET socketpair (handoff_send/
+ *     handoff_recv), and the worker serves the rest of it with the usual
+ *     blocking code.
+ *
+ * Whichever worker is waiting in handoff_recv gets the next connection;
+ * when all are busy the handoffs queue in the socketpair, and beyond that
+ * in the front end, which then also waits for the socketpair to have room.
+ */
+
+#include "integrity.h"
+#include "audit_proto.h"
+#include "frame.h"
+#include "proof.h"
+#include "zero_copy.h"
+#include "zframes.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+// block bytes read ahead and sent at a time for a retrieval that cannot
+// use sendfile
+#define EVENT_OUT_BYTES (1 << 16)
+// events taken from epoll at a time
+#define EVENT_BATCH (64)
+
+/* Sends fd, and the op byte already read from it, to a worker. Returns 1
+ * if it went, 0 if the socketpair is full, and -1 on error. */
+static inline int handoff_send(int sock, int fd, char op) {
+	char ctl[CMSG_SPACE(sizeof fd)];
+	memset(ctl, 0, sizeof ctl);
+	struct iovec iov = {.iov_base = &op, .iov_len = 1};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl, .msg_controllen = sizeof ctl};
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof fd);
+	memcpy(CMSG_DATA(cm), &fd, sizeof fd);
+	if (sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == 1) return 1;
+	return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+}
+
+/* Waits for a connection from the front end. Returns its descriptor, made
+ * blocking again, and sets op to its op byte; returns -1 on error. */
+static inline int handoff_recv(int sock, char *op) {
+	int fd;
+	char ctl[CMSG_SPACE(sizeof fd)];
+	struct iovec iov = {.iov_base = op, .iov_len = 1};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl, .msg_controllen = sizeof ctl};
+	ssize_t got;
+	do {
+		got = recvmsg(sock, &msg, 0);
+	} while (got < 0 && errno == EINTR);
+	struct cmsghdr *cm = (got == 1) ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (!cm || cm->cmsg_type != SCM_RIGHTS) return -1;
+	memcpy(&fd, CMSG_DATA(cm), sizeof fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	return fd;
+}
+
+typedef enum {
+	CONN_OP,        // waiting for the op byte
+	CONN_NHASH,     // retrieval: the number of hashes
+	CONN_INDEX,     // retrieval: the index of the next hash
+	CONN_BLOCKS,    // retrieval: block count, offset and last block size
+	CONN_RANGE,     // proof retrieval: byte offset and count
+	CONN_SEND,      // sending what is left, then closing
+	CONN_HANDOFF,   // waiting for room to hand off to a worker
+} conn_state_t;
+
+typedef struct conn {
+	int fd;
+	conn_state_t state;
+	char op;
+	unsigned char in[20];   // the field being read
+	size_t have, need;
+	uint32_t nhash;         // hashes the client has yet to ask for
+	char *out;              // bytes to send
+	size_t out_len, out_sent, out_cap;
+	uint64_t data_pos;      // next block byte to read
+	uint64_t data_left;     // block bytes still to read and send
+	bool want_out;          // waiting for EPOLLOUT
+	struct conn *next_wait; // in the queue of handoffs
+} conn_t;
+
+typedef struct {
+	int epoll_fd;
+	int listener;
+	int handoff;
+	int data_fd;            // the data file, or -1 for a compressed store
+#ifdef POR_ZLIB
+	zframes_stream_t *zdata;    // the logical bytes of a compressed store
+#endif
+	const proof_tree_t *tree;   // the tree file, mapped
+	const store_info_t *info;
+	conn_t *wait_head, *wait_tail;
+	bool handoff_out;       // waiting for room in the socketpair
+	uint64_t open_conns;
+} event_loop_t;
+
+static inline void conn_expect(conn_t *c, conn_state_t state, size_t need) {
+	c->state = state;
+	c->have = 0;
+	c->need = need;
+}
+
+static inline void conn_queue(conn_t *c, const void *bytes, size_t len) {
+	if (c->out_len + len > c->out_cap) {
+		c->out_cap = (c->out_len + len > 2 * c->out_cap) ? c->out_len + len : 2 * c->out_cap;
+		c->out = realloc(c->out, c->out_cap);
+		assert (c->out);
+	}
+	memcpy(c->out + c->out_len, bytes, len);
+	c->out_len += len;
+}
+
+static inline void conn_close(event_loop_t *ev, conn_t *c) {
+	// a worker handed the connection shares its open file, which keeps it
+	// in the epoll set after close, so take it out first
+	epoll_ctl(ev->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->out);
+	free(c);
+	--ev->open_conns;
+}
+
+/* Hands c to a worker, or queues it until one can take it. Either way the
+ * event loop no longer waits on it. */
+static inline void conn_handoff(event_loop_t *ev, conn_t *c) {
+	int sent = handoff_send(ev->handoff, c->fd, c->op);
+	if (sent == 0) {
+		// the rest of the request waits in the socket for a free worker
+		epoll_ctl(ev->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+		c->next_wait = NULL;
+		if (ev->wait_tail) ev->wait_tail->next_wait = c;
+		else ev->wait_head = c;
+		ev->wait_tail = c;
+		return;
+	}
+	if (sent < 0) perror("handing off a connection");
+	conn_close(ev, c);
+}
+
+/* Acts on a field of a request once all of it is in. Returns false if the
+ * request is not valid. */
+static inline bool conn_field(event_loop_t *ev, conn_t *c) {
+	const store_info_t *info = ev->info;
+	switch (c->state) {
+		case CONN_OP:
+			c->op = c->in[0];
+			if (c->op == 'R') {
+				conn_expect(c, CONN_NHASH, sizeof(uint32_t));
+				return true;
+			}
+			if (c->op == PROOF_READ_OP) {
+				conn_expect(c, CONN_RANGE, 2 * sizeof(uint64_t));
+				return true;
+			}
+			if (c->op == AUDIT_OP || c->op == AUDIT_EXT_OP || c->op == 'U' || c->op == FRAME_PROTO_OP) {
+				c->state = CONN_HANDOFF;
+				return true;
+			}
+			conn_queue(c, "ERROR: Invalid mode given\n", 27);
+			conn_expect(c, CONN_SEND, 0);
+			return true;
+
+		case CONN_NHASH:
+			memcpy(&c->nhash, c->in, sizeof c->nhash);
+			if (c->nhash) conn_expect(c, CONN_INDEX, sizeof(uint64_t));
+			else conn_expect(c, CONN_BLOCKS, 2 * sizeof(uint64_t) + sizeof(uint32_t));
+			return true;
+
+		case CONN_INDEX: {
+			uint64_t index;
+			memcpy(&index, c->in, sizeof index);
+			// the tree has 2 nblocks - 1 nodes, after the metadata block
+			uint64_t at = (index + 1) * info->hash_size;
+			if (index >= 2 * info->nblocks - 1) {
+				fprintf(stderr, "ERROR: index "_CHUNK_SPECIFIER" out of bounds for merkle file\n", index);
+				return false;
+			}
+			if (at + info->hash_size > ev->tree->bytes) {
+				fprintf(stderr, "ERROR reading from merkle file index "_CHUNK_SPECIFIER"\n", index);
+				return false;
+			}
+			conn_queue(c, ev->tree->map + at, info->hash_size);
+			if (--c->nhash) conn_expect(c, CONN_INDEX, sizeof(uint64_t));
+			else conn_expect(c, CONN_BLOCKS, 2 * sizeof(uint64_t) + sizeof(uint32_t));
+			return true;
+		}
+
+		case CONN_BLOCKS: {
+			uint64_t count, offset;
+			uint32_t lbsize;
+			memcpy(&count, c->in, sizeof count);
+			memcpy(&offset, c->in + sizeof count, sizeof offset);
+			memcpy(&lbsize, c->in + 2 * sizeof count, sizeof lbsize);
+			if (count && (lbsize > info->block_size || offset > info->nblocks || count > info->nblocks - offset)) {
+				fprintf(stderr, "ERROR: blocks "_CHUNK_SPECIFIER"--"_CHUNK_SPECIFIER" are not in the data\n",
+						offset, offset + count - 1);
+				return false;
+			}
+			c->data_pos = offset * info->block_size;
+			c->data_left = count ? (count - 1) * info->block_size + lbsize : 0;
+			conn_expect(c, CONN_SEND, 0);
+			return true;
+		}
+
+		case CONN_RANGE: {
+			uint64_t offset, count;
+			memcpy(&offset, c->in, sizeof offset);
+			memcpy(&count, c->in + sizeof offset, sizeof count);
+			proof_plan_t plan;
+			struct iovec iov[PROOF_MAX_HASHES];
+			proof_reply_t reply = {.status = PROOF_OK, .nhash = 0};
+			if (!proof_plan(&plan, offset, count, info) || !proof_gather(&plan, ev->tree, info->hash_size, iov)) {
+				fprintf(stderr, "ERROR: bytes "_CHUNK_SPECIFIER"+"_CHUNK_SPECIFIER" are not in the data\n",
+						offset, count);
+				reply.status = PROOF_INVALID;
+				conn_queue(c, &reply, sizeof reply);
+				conn_expect(c, CONN_SEND, 0);
+				return true;
+			}
+			reply.nhash = plan.nhash;
+			conn_queue(c, &reply, sizeof reply);
+			for (uint32_t i = 0; i < plan.nhash; ++i) conn_queue(c, iov[i].iov_base, iov[i].iov_len);
+			c->data_pos = plan.block_offset * info->block_size;
+			c->data_left = proof_bytes(0, plan.block_count, plan.lbsize, info);
+			conn_expect(c, CONN_SEND, 0);
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+/* Sends what it can. Returns -1 on error, 0 if the socket is full and 1
+ * once everything queued, and any block bytes left, has gone. */
+static inline int conn_flush(event_loop_t *ev, conn_t *c) {
+	while (true) {
+		if (c->out_sent == c->out_len) {
+			c->out_sent = c->out_len = 0;
+			if (!c->data_left) return 1;
+			if (ev->data_fd >= 0) {
+				// straight from the page cache, as much as the socket takes
+				int64_t sent = sendfile_some(c->fd, ev->data_fd, c->data_pos, c->data_left);
+				if (sent < 0) {
+					fprintf(stderr, "ERROR: sending blocks from data file\n");
+					return -1;
+				}
+				c->data_pos += sent;
+				c->data_left -= sent;
+				if (c->data_left) return 0;
+				continue;
+			}
+			// the next window of blocks, decompressed
+			size_t len = (c->data_left < EVENT_OUT_BYTES) ? c->data_left : EVENT_OUT_BYTES;
+			if (c->out_cap < len) {
+				c->out_cap = len;
+				c->out = realloc(c->out, c->out_cap);
+				assert (c->out);
+			}
+			ssize_t got = -1;
+#ifdef POR_ZLIB
+			got = zframes_stream_pread(ev->zdata, c->out, len, c->data_pos);
+#endif
+			if (got != (ssize_t)len) {
+				fprintf(stderr, "ERROR: reading blocks from data file\n");
+				return -1;
+			}
+			c->out_len = len;
+			c->data_pos += len;
+			c->data_left -= len;
+		}
+		ssize_t sent = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		c->out_sent += sent;
+	}
+}
+
+/* Handles readiness on c. Returns false when it has been closed or handed
+ * off. */
+static inline bool conn_event(event_loop_t *ev, conn_t *c) {
+	// requests go in lock step with their replies, so read only once the
+	// last reply is out
+	int flushed = conn_flush(ev, c);
+	while (flushed == 1 && c->state != CONN_SEND) {
+		ssize_t got = recv(c->fd, c->in + c->have, c->need - c->have, 0);
+		if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			conn_close(ev, c);
+			return false;
+		}
+		if (got < 0) break;
+		c->have += got;
+		if (c->have < c->need) continue;
+		if (!conn_field(ev, c)) {
+			conn_close(ev, c);
+			return false;
+		}
+		if (c->state == CONN_HANDOFF) {
+			conn_handoff(ev, c);
+			return false;
+		}
+		flushed = conn_flush(ev, c);
+	}
+	if (flushed < 0 || (flushed == 1 && c->state == CONN_SEND)) {
+		conn_close(ev, c);
+		return false;
+	}
+
+	// wait for room to send only while there is something to send
+	bool want_out = flushed == 0;
+	if (want_out != c->want_out) {
+		struct epoll_event e = {.events = EPOLLIN | (want_out ? EPOLLOUT : 0), .data.ptr = c};
+		epoll_ctl(ev->epoll_fd, EPOLL_CTL_MOD, c->fd, &e);
+		c->want_out = want_out;
+	}
+	return true;
+}
+
+static inline void event_loop_accept(event_loop_t *ev) {
+	while (true) {
+		int fd = accept4(ev->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EMFILE || errno == ENFILE) {
+				fprintf(stderr, "ERROR: out of descriptors with %"PRIu64" connections open\n", ev->open_conns);
+			}
+			return;
+		}
+		conn_t *c = calloc(1, sizeof *c);
+		assert (c);
+		c->fd = fd;
+		conn_expect(c, CONN_OP, 1);
+		struct epoll_event e = {.events = EPOLLIN, .data.ptr = c};
+		if (epoll_ctl(ev->epoll_fd, EPOLL_CTL_ADD, fd, &e) != 0) {
+			close(fd);
+			free(c);
+			continue;
+		}
+		++ev->open_conns;
+	}
+}
+
+/* Serves the clients on listener, with blocks of the data file at
+ * data_path and hashes of the mapped tree, until the process is killed. */
+static inline void event_loop_run(int listener, int handoff, const char *data_path,
+		const proof_tree_t *tree, const store_info_t *info)
+{
+	// every idle client is a descriptor, so take all the kernel allows
+	struct rlimit lim;
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+	// sendfile has no MSG_NOSIGNAL; a client that goes away mid-retrieval
+	// must not take every other connection with it
+	signal(SIGPIPE, SIG_IGN);
+
+	event_loop_t ev = {.listener = listener, .handoff = handoff, .tree = tree, .info = info};
+	ev.data_fd = open(data_path, O_RDONLY);
+	if (ev.data_fd < 0) {
+		fprintf(stderr, "ERROR: event loop could not open <%s>\n", data_path);
+		exit(1);
+	}
+	if (zframes_probe(ev.data_fd)) {
+		// sendfile would send the packed frames, so blocks go out through
+		// a stream of the logical bytes instead
+		close(ev.data_fd);
+		ev.data_fd = -1;
+#ifdef POR_ZLIB
+		ev.zdata = zframes_stream_open(data_path);
+		if (!ev.zdata) {
+			fprintf(stderr, "ERROR: event loop could not open the compressed store <%s>\n", data_path);
+			exit(1);
+		}
+#endif
+	}
+	ev.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ev.epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+	struct epoll_event e = {.events = EPOLLIN, .data.ptr = NULL};
+	epoll_ctl(ev.epoll_fd, EPOLL_CTL_ADD, listener, &e);
+	// the socketpair is only waited on, for room, while handoffs are queued
+	struct epoll_event h = {.events = 0, .data.ptr = &ev};
+	epoll_ctl(ev.epoll_fd, EPOLL_CTL_ADD, handoff, &h);
+	fprintf(stderr, "event loop %d serving retrievals, up to %llu connections\n",
+			(int)getpid(), (unsigned long long)lim.rlim_cur);
+
+	struct epoll_event events[EVENT_BATCH];
+	while (true) {
+		int ready = epoll_wait(ev.epoll_fd, events, EVENT_BATCH, -1);
+		if (ready < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			exit(1);
+		}
+		for (int k = 0; k < ready; ++k) {
+			if (events[k].data.ptr == &ev) continue;  // room to hand off, below
+			if (events[k].data.ptr) conn_event(&ev, events[k].data.ptr);
+			else event_loop_accept(&ev);
+		}
+
+		// hand off the queued connections, in order, while workers take them
+		while (ev.wait_head) {
+			conn_t *c = ev.wait_head;
+			int sent = handoff_send(handoff, c->fd, c->op);
+			if (sent == 0) break;
+			ev.wait_head = c->next_wait;
+			if (!ev.wait_head) ev.wait_tail = NULL;
+			if (sent < 0) perror("handing off a connection");
+			conn_close(&ev, c);
+		}
+		bool want_out = ev.wait_head != NULL;
+		if (want_out != ev.handoff_out) {
+			h.events = want_out ? EPOLLOUT : 0;
+			epoll_ctl(ev.epoll_fd, EPOLL_CTL_MOD, handoff, &h);
+			ev.handoff_out = want_out;
+		}
+	}
+}
+
+#endif // LAPOR_EVENT_LOOP_H
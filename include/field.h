@@ -0,0 +1,178 @@
+#ifndef LAPOR_FIELD_H
+#define LAPOR_FIELD_H
+
+/* Row kernels specialized at compile time on the chunk width and the prime.
+ *
+ * A field is a pseudo-Mersenne prime p = 2^k - c together with the number
+ * of bytes b in each data chunk (8b < k, so every chunk is below p). Eight
+ * chunks of b bytes take exactly b words, so a packed row is walked in
+ * groups of 8 chunks, and with b and k known at compile time the masks,
+ * shifts and word offsets of each chunk in a group are all constants.
+ *
+ * The bodies below are written once, generically, and forced inline;
+ * FIELD_DEFINE then instantiates them with constant parameters so each
+ * field gets its own fully unrolled code:
+ *   <name>_dot(raw_row, chal, col, ncols)   dot product of a column range
+ *   <name>_accum(raw_row, coeff, partials, col, ncols)
+ *                                           partials[j] += chunk j * coeff
+ *
+ * Fields whose products fit comfortably in 64 bits (such as 3-byte chunks
+ * with 2^31-1) accumulate in eight uint64_t lanes, which the compiler can
+ * keep in vector registers; the others use a uint128_t accumulator.
+ *
+ * The data files, configs and protocol still use FIELD_P57 throughout,
+ * and a dataset does not record its field. So the other fields are only
+ * built where FIELD_ALTERNATES is defined before this header is included
+ * (p57_bench), to be measured before a dataset is committed to one; the
+ * server and tools see p57 alone.
+ */
+
+#include "integrity.h"
+
+#define FIELD_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// products below 2^FIELD_NARROW_MAX_BITS are summed in uint64_t lanes
+#define FIELD_NARROW_MAX_BITS (56)
+
+// folds x once: 2^k = c (mod p), so hi*2^k + lo = lo + c*hi
+FIELD_ALWAYS_INLINE uint128_t field_fold(uint128_t x, unsigned k, uint64_t c) {
+	return (x & ((UINT64_C(1) << k) - 1)) + (x >> k) * c;
+}
+
+FIELD_ALWAYS_INLINE uint64_t field_reduce(uint128_t x, unsigned k, uint64_t c) {
+	while (x >> k) x = field_fold(x, k, c);
+	// now x < 2^k = p + c
+	uint64_t p = (UINT64_C(1) << k) - c;
+	return (uint64_t)x - ((uint64_t)x >= p ? p : 0);
+}
+
+/* Chunk t (0 to 7) of the group of eight b-byte chunks starting at w. */
+FIELD_ALWAYS_INLINE uint64_t field_chunk(const uint64_t *w, unsigned b, unsigned t) {
+	const uint64_t mask = (UINT64_C(1) << (8 * b)) - 1;
+	unsigned bit = 8 * b * t;
+	unsigned idx = bit / 64, sh = bit % 64;
+	// only mask where bits above the chunk can be left over
+	if (sh + 8 * b < 64) return (w[idx] >> sh) & mask;
+	if (sh + 8 * b == 64) return w[idx] >> sh;
+	return (w[idx] >> sh) | ((w[idx + 1] << (64 - sh)) & mask);
+}
+
+/* Groups of 8 products of at most pbits bits an accumulator of acc_bits
+ * can take after a fold, at most 2^20. */
+FIELD_ALWAYS_INLINE size_t field_lazy_groups(unsigned acc_bits, unsigned pbits) {
+	unsigned spare = acc_bits - 1 - pbits - 3;
+	return (spare >= 20) ? (size_t)1 << 20 : (size_t)1 << spare;
+}
+
+FIELD_ALWAYS_INLINE uint64_t field_dot(const uint64_t *raw_row, const uint64_t *chal,
+		size_t col, size_t ncols, unsigned b, unsigned k, uint64_t c)
+{
+	const unsigned pbits = 8 * b + k;
+	raw_row += col / 8 * b;
+	chal += col;
+
+	if (pbits <= FIELD_NARROW_MAX_BITS) {
+		// each lane is below 2^k + 2^(64-k) c after a fold
+		const size_t lazy = field_lazy_groups(64, pbits);
+		uint64_t lane[8] = {0};
+		for (size_t start = 0; start < ncols; start += 8 * lazy) {
+			size_t stop = (ncols - start < 8 * lazy) ? ncols : start + 8 * lazy;
+			for (size_t raw_ind = start / 8 * b, g = start; g < stop; raw_ind += b, g += 8) {
+#pragma GCC unroll 8
+				for (unsigned t = 0; t < 8; ++t) {
+					lane[t] += field_chunk(raw_row + raw_ind, b, t) * chal[g + t];
+				}
+			}
+#pragma GCC unroll 8
+			for (unsigned t = 0; t < 8; ++t) {
+				lane[t] = (uint64_t)field_fold(lane[t], k, c);
+			}
+		}
+		uint128_t acc = 0;
+		for (unsigned t = 0; t < 8; ++t) acc += lane[t];
+		return field_reduce(acc, k, c);
+	}
+
+	const size_t lazy = field_lazy_groups(128, pbits);
+	uint128_t acc = 0;
+	for (size_t start = 0; start < ncols; start += 8 * lazy) {
+		size_t stop = (ncols - start < 8 * lazy) ? ncols : start + 8 * lazy;
+		for (size_t raw_ind = start / 8 * b, g = start; g < stop; raw_ind += b, g += 8) {
+#pragma GCC unroll 8
+			for (unsigned t = 0; t < 8; ++t) {
+				acc += (uint128_t)field_chunk(raw_row + raw_ind, b, t) * chal[g + t];
+			}
+		}
+		acc = field_fold(acc, k, c);
+	}
+	return field_reduce(acc, k, c);
+}
+
+/* partials[j] += chunk j * coeff for columns [col, col+ncols); the caller
+ * folds partials before they can overflow. */
+FIELD_ALWAYS_INLINE void field_accum(const uint64_t *raw_row, uint64_t coeff,
+		uint128_t *partials, size_t col, size_t ncols, unsigned b)
+{
+	raw_row += col / 8 * b;
+	partials += col;
+	for (size_t raw_ind = 0, g = 0; g < ncols; raw_ind += b, g += 8) {
+#pragma GCC unroll 8
+		for (unsigned t = 0; t < 8; ++t) {
+			partials[g + t] += (uint128_t)field_chunk(raw_row + raw_ind, b, t) * coeff;
+		}
+	}
+}
+
+#define FIELD_DEFINE(name, B, K, C) \
+	static inline uint64_t name##_dot(const uint64_t *raw_row, const uint64_t *chal, \
+			size_t col, size_t ncols) { \
+		return field_dot(raw_row, chal, col, ncols, (B), (K), (C)); \
+	} \
+	static inline void name##_accum(const uint64_t *raw_row, uint64_t coeff, \
+			uint128_t *partials, size_t col, size_t ncols) { \
+		field_accum(raw_row, coeff, partials, col, ncols, (B)); \
+	}
+
+FIELD_DEFINE(field_p57, 7, 57, 13)  // 7-byte chunks, 2^57 - 13; what datasets use
+#ifdef FIELD_ALTERNATES
+FIELD_DEFINE(field_m61, 7, 61, 1)   // 7-byte chunks, 2^61 - 1
+FIELD_DEFINE(field_p31, 3, 31, 1)   // 3-byte chunks, 2^31 - 1
+#endif
+
+typedef enum {
+	FIELD_P57 = 0,
+#ifdef FIELD_ALTERNATES
+	FIELD_M61,
+	FIELD_P31,
+#endif
+	FIELD_COUNT
+} field_id_t;
+
+typedef struct {
+	const char *name;
+	unsigned chunk_bytes;
+	unsigned prime_bits;   // k, for p = 2^k - c
+	uint64_t prime;
+	uint64_t (*dot)(const uint64_t *raw_row, const uint64_t *chal, size_t col, size_t ncols);
+	void (*accum)(const uint64_t *raw_row, uint64_t coeff, uint128_t *partials, size_t col, size_t ncols);
+} field_t;
+
+static const field_t FIELDS[FIELD_COUNT] = {
+	{"p57", 7, 57, (UINT64_C(1) << 57) - 13, field_p57_dot, field_p57_accum},
+#ifdef FIELD_ALTERNATES
+	{"m61", 7, 61, (UINT64_C(1) << 61) - 1, field_m61_dot, field_m61_accum},
+	{"p31", 3, 31, (UINT64_C(1) << 31) - 1, field_p31_dot, field_p31_accum},
+#endif
+};
+
+/* A uniformly random value mod the field's prime, by rejection. */
+static inline uint64_t field_rand(const field_t *f, tinymt64_t *state) {
+	uint64_t mask = (UINT64_C(1) << f->prime_bits) - 1;
+	uint64_t val;
+	do {
+		val = tinymt64_generate_uint64(state) & mask;
+	} while (val >= f->prime);
+	return val;
+}
+
+#endif // LAPOR_FIELD_H
@@ -0,0 +1,128 @@
+#ifndef LAPOR_FRAME_H
+#define LAPOR_FRAME_H
+
+/* Framed wire format, shared by client and server.
+ *
+ * The other ops take one request per connection, and a retrieval costs a
+ * round trip for each Merkle hash. A client that opens with the op byte
+ * FRAME_PROTO_OP ('F') instead sends any number of requests on the one
+ * connection, each a frame_hdr_t and then length bytes of payload. It need
+ * not wait for one response before sending the next request. Every
+ * response is a frame too, with the id of the request it answers.
+ * Responses may come in any order: the server answers retrievals and
+ * updates as they come in, while audits go on in the background.
+ *
+ * Request payloads, by op:
+ *   FRAME_AUDIT   an audit_req_t (AUDIT_FLAG_SEEDED and AUDIT_FLAG_RANGES
+ *                 only); then for ranges an audit_ranges_t and that many
+ *                 audit_range_t; then either an audit_seeds_t and nchal
+ *                 seeds, or nchal challenge vectors of n words each, all as
+ *                 in audit_proto.h. The response holds the nchal words of
+ *                 each audited row in row order, as for 'X'.
+ *   FRAME_READ    a frame_read_t. The server works out the proof, and
+ *                 the response holds its hashes, then the bytes of the
+ *                 blocks, as for 'P' (proof.h).
+ *   FRAME_UPDATE  a frame_update_t followed by count new bytes. The
+ *                 response holds the matrix entries those bytes fall in,
+ *                 as they were before the write, each of BYTES_UNDER_P
+ *                 bytes sent as a 64-bit word, so the client can fix up
+ *                 its secrets. The server waits for the audits asked for
+ *                 before an update, so they all see the data as it was.
+ *
+ * A response whose status is not FRAME_OK has no payload. A request the
+ * server cannot parse, or of an unknown version, ends the connection
+ * after its error response; the client closes its side when it is done.
+ * All integers are sent in host byte order.
+ */
+
+#include "integrity.h"
+#include "audit_proto.h"
+#include "proof.h"
+
+#define FRAME_PROTO_OP ('F')
+// 2: a FRAME_READ names just its bytes, and the server works out the proof
+#define FRAME_VERSION (2)
+
+// request ops
+#define FRAME_AUDIT ('A')
+#define FRAME_READ ('R')
+#define FRAME_UPDATE ('U')
+
+// response status
+#define FRAME_OK (0)
+#define FRAME_INVALID (1)   // the request is malformed or out of range
+#define FRAME_FAILED (2)    // the server could not carry it out
+#define FRAME_BAD_VERSION (3)
+#define FRAME_BAD_OP (4)
+
+// audit flags that make sense within a frame; responses come whole
+#define FRAME_AUDIT_FLAGS (AUDIT_FLAG_SEEDED | AUDIT_FLAG_RANGES)
+
+typedef struct {
+	uint64_t length;    // payload bytes that follow
+	uint64_t id;        // the client's, echoed in the response
+	uint16_t version;   // FRAME_VERSION
+	uint8_t op;         // FRAME_AUDIT, FRAME_READ or FRAME_UPDATE
+	uint8_t status;     // FRAME_OK or an error in responses; zero in requests
+	uint32_t reserved;  // zero
+} frame_hdr_t;
+
+typedef struct {
+	uint64_t offset;    // byte offset in the data file
+	uint64_t count;     // bytes wanted
+} frame_read_t;
+
+typedef struct {
+	uint64_t first;     // byte offset in the data file
+	uint64_t count;     // new bytes that follow
+} frame_update_t;
+
+/* Sends a frame. The payload may be NULL to have the caller write the
+ * length bytes itself. */
+static inline bool frame_send(FILE *out, uint64_t id, uint8_t op, uint8_t status,
+		uint64_t length, const void *payload)
+{
+	frame_hdr_t hdr = {.length = length, .id = id, .version = FRAME_VERSION,
+		.op = op, .status = status, .reserved = 0};
+	if (fwrite(&hdr, sizeof hdr, 1, out) != 1) return false;
+	return !payload || fwrite(payload, 1, length, out) == length;
+}
+
+/* Reads the next frame header. Returns 1 if there was one, 0 at a clean
+ * end of the stream and -1 if it ended part way. */
+static inline int frame_recv_hdr(FILE *in, frame_hdr_t *hdr) {
+	size_t got = fread(hdr, 1, sizeof *hdr, in);
+	if (got == sizeof *hdr) return 1;
+	return got ? -1 : 0;
+}
+
+/* Takes bytes from the front of a payload being decoded. */
+static inline bool frame_take(const char **pos, uint64_t *left, void *dest, uint64_t bytes) {
+	if (*left < bytes) return false;
+	memcpy(dest, *pos, bytes);
+	*pos += bytes;
+	*left -= bytes;
+	return true;
+}
+
+/* Payload bytes of an audit request with these parameters. */
+static inline uint64_t frame_audit_bytes(const audit_req_t *areq, uint32_t nranges, uint64_t n) {
+	uint64_t bytes = sizeof *areq;
+	if (areq->flags & AUDIT_FLAG_RANGES) {
+		bytes += sizeof(audit_ranges_t) + (uint64_t)nranges * sizeof(audit_range_t);
+	}
+	if (areq->flags & AUDIT_FLAG_SEEDED) {
+		bytes += sizeof(audit_seeds_t) + (uint64_t)areq->nchal * sizeof(uint64_t);
+	}
+	else {
+		bytes += (uint64_t)areq->nchal * n * sizeof(uint64_t);
+	}
+	return bytes;
+}
+
+/* The matrix entries that an update of count bytes at first touches. */
+static inline uint64_t frame_update_chunks(uint64_t first, uint64_t count) {
+	return (first + count - 1) / BYTES_UNDER_P - first / BYTES_UNDER_P + 1;
+}
+
+#endif // LAPOR_FRAME_H
@@ -0,0 +1,98 @@
+#ifndef LAPOR_NUMA_TOPO_H
+#define LAPOR_NUMA_TOPO_H
+
+/* NUMA node layout read from sysfs, so that audit threads can be pinned
+ * to a node and work on node-local memory without depending on libnuma.
+ * Memory placement relies on the kernel's default first-touch policy: a
+ * buffer allocated and first written by a thread pinned to a node lives on
+ * that node.
+ *
+ * Needs _GNU_SOURCE, for cpu_set_t and sched_setaffinity.
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define NUMA_MAX_NODES (64)
+
+typedef struct {
+	int nnodes;
+	int id[NUMA_MAX_NODES];        // sysfs node number
+	int ncpus[NUMA_MAX_NODES];
+	cpu_set_t cpus[NUMA_MAX_NODES];
+} numa_topo_t;
+
+/* Parses a sysfs cpulist such as "0-3,8-11" into set; returns the count. */
+static inline int numa_parse_cpulist(const char *list, cpu_set_t *set) {
+	CPU_ZERO(set);
+	int count = 0;
+	while (*list && *list != '\n') {
+		char *end;
+		long lo = strtol(list, &end, 10);
+		long hi = lo;
+		if (end == list) break;
+		if (*end == '-') hi = strtol(end + 1, &end, 10);
+		for (long c = lo; c <= hi && c < CPU_SETSIZE; ++c) {
+			CPU_SET(c, set);
+			++count;
+		}
+		list = (*end == ',') ? end + 1 : end;
+	}
+	return count;
+}
+
+/* Loads the nodes that have CPUs this process may run on. Without sysfs
+ * everything is one node holding the current affinity mask. */
+static inline void numa_topo_load(numa_topo_t *topo) {
+	cpu_set_t allowed;
+	sched_getaffinity(0, sizeof allowed, &allowed);
+	topo->nnodes = 0;
+
+	for (int node = 0; topo->nnodes < NUMA_MAX_NODES && node < 1024; ++node) {
+		char path[64], list[4096];
+		snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen(path, "r");
+		if (!f) {
+			if (node > 0 && topo->nnodes > 0) break;
+			continue;
+		}
+		bool got = fgets(list, sizeof list, f) != NULL;
+		fclose(f);
+		if (!got) continue;
+
+		cpu_set_t set;
+		numa_parse_cpulist(list, &set);
+		CPU_AND(&set, &set, &allowed);
+		int ncpus = CPU_COUNT(&set);
+		if (!ncpus) continue;   // memory-only node, or none of ours
+
+		topo->id[topo->nnodes] = node;
+		topo->ncpus[topo->nnodes] = ncpus;
+		topo->cpus[topo->nnodes] = set;
+		++topo->nnodes;
+	}
+
+	if (topo->nnodes == 0) {
+		topo->nnodes = 1;
+		topo->id[0] = 0;
+		topo->ncpus[0] = CPU_COUNT(&allowed);
+		topo->cpus[0] = allowed;
+	}
+}
+
+/* The node thread tid of nthreads belongs to; threads are handed out to
+ * nodes in contiguous groups, in proportion to each node's CPU count. */
+static inline int numa_thread_node(const numa_topo_t *topo, int tid, int nthreads) {
+	int total = 0;
+	for (int g = 0; g < topo->nnodes; ++g) total += topo->ncpus[g];
+	int before = 0;
+	for (int g = 0; g < topo->nnodes; ++g) {
+		before += topo->ncpus[g];
+		if ((long)tid * total < (long)before * nthreads) return g;
+	}
+	return topo->nnodes - 1;
+}
+
+#endif // LAPOR_NUMA_TOPO_H
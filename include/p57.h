@@ -0,0 +1,137 @@
+#ifndef LAPOR_P57_H
+#define LAPOR_P57_H
+
+/* Arithmetic modulo the pseudo-Mersenne prime P57 = 2^57 - 13.
+ *
+ * Since 2^57 = 13 (mod P57), any value x = hi*2^57 + lo is congruent to
+ * lo + 13*hi. Folding like this replaces the __umodti3 library call that
+ * a uint128_t % P57 compiles to with a shift, a mask and a small multiply.
+ *
+ * Accumulators are kept lazily reduced: after p57_fold a uint128_t is below
+ * 2^P57_FOLDED_BOUND_BITS, so it can absorb P57_LAZY_TERMS(bits) more products of
+ * at most `bits` bits each before it must be folded again.
+ */
+
+#include "integrity.h"
+
+#define P57_C (13)
+#define P57_MASK ((UINT64_C(1) << P_BITS) - 1)
+
+// a folded uint128_t is always below this (2^71 * 13 + 2^57 < 2^75)
+#define P57_FOLDED_BOUND_BITS (75)
+
+// how many products of at most `bits` bits each can be added to a folded
+// accumulator with no chance of overflowing 128 bits
+#define P57_LAZY_TERMS(bits) (UINT64_C(1) << (127 - (bits)))
+
+// product of a 56-bit data chunk and a value mod P57
+#define P57_DATA_PRODUCT_BITS (113)
+// product of two values mod P57
+#define P57_FULL_PRODUCT_BITS (114)
+
+/* One folding step: returns a value congruent to x and below 2^75. */
+static inline uint128_t p57_fold(uint128_t x) {
+	return (x & P57_MASK) + (x >> P_BITS) * P57_C;
+}
+
+/* Fully reduces a 64-bit value into [0, P57). Branch-free, so loops of it
+ * auto-vectorize. */
+static inline uint64_t p57_reduce64(uint64_t x) {
+	// x < 2^64, so the high part is at most 127 and this is below 2^58
+	x = (x & P57_MASK) + (x >> P_BITS) * P57_C;
+	// one more fold leaves at most P57 + 12
+	x = (x & P57_MASK) + (x >> P_BITS) * P57_C;
+	return x - (x >= P57 ? P57 : 0);
+}
+
+/* Fully reduces a 128-bit value into [0, P57). */
+static inline uint64_t p57_reduce(uint128_t x) {
+	// after two folds the value is below 2^57 + 2^23
+	x = p57_fold(p57_fold(x));
+	return p57_reduce64((uint64_t)x);
+}
+
+static inline uint64_t p57_add(uint64_t a, uint64_t b) {
+	uint64_t s = a + b;
+	return s - (s >= P57 ? P57 : 0);
+}
+
+static inline uint64_t p57_sub(uint64_t a, uint64_t b) {
+	return a >= b ? a - b : a + P57 - b;
+}
+
+static inline uint64_t p57_mul(uint64_t a, uint64_t b) {
+	return p57_reduce((uint128_t)a * b);
+}
+
+/* Dot product of two vectors of values mod P57, folding once per block of
+ * P57_LAZY_TERMS products instead of checking a counter on every term. */
+static inline uint64_t p57_dot(const uint64_t *a, const uint64_t *b, size_t len) {
+	const size_t block = P57_LAZY_TERMS(P57_FULL_PRODUCT_BITS);
+	uint128_t acc = 0;
+	for (size_t start = 0; start < len; start += block) {
+		size_t stop = (len - start < block) ? len : start + block;
+		for (size_t i = start; i < stop; ++i) {
+			acc += (uint128_t)a[i] * b[i];
+		}
+		acc = p57_fold(acc);
+	}
+	return p57_reduce(acc);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* Lane-wise p57_reduce64 for four 64-bit lanes. */
+__attribute__((target("avx2")))
+static inline __m256i p57_reduce_epi64_avx2(__m256i x) {
+	const __m256i mask = _mm256_set1_epi64x(P57_MASK);
+	const __m256i c = _mm256_set1_epi64x(P57_C);
+	const __m256i p_minus_1 = _mm256_set1_epi64x(P57 - 1);
+	const __m256i p = _mm256_set1_epi64x(P57);
+	// high parts are at most 127, so the 32-bit multiply is exact
+	x = _mm256_add_epi64(_mm256_and_si256(x, mask),
+			_mm256_mul_epu32(_mm256_srli_epi64(x, P_BITS), c));
+	x = _mm256_add_epi64(_mm256_and_si256(x, mask),
+			_mm256_mul_epu32(_mm256_srli_epi64(x, P_BITS), c));
+	// everything is now below 2^57 + 13, so the signed compare is safe
+	__m256i ge = _mm256_cmpgt_epi64(x, p_minus_1);
+	return _mm256_sub_epi64(x, _mm256_and_si256(ge, p));
+}
+
+/* Lane-wise p57_add for four lanes already in [0, P57). */
+__attribute__((target("avx2")))
+static inline __m256i p57_add_epi64_avx2(__m256i a, __m256i b) {
+	const __m256i p_minus_1 = _mm256_set1_epi64x(P57 - 1);
+	const __m256i p = _mm256_set1_epi64x(P57);
+	__m256i s = _mm256_add_epi64(a, b);
+	__m256i ge = _mm256_cmpgt_epi64(s, p_minus_1);
+	return _mm256_sub_epi64(s, _mm256_and_si256(ge, p));
+}
+
+/* Lane-wise p57_reduce64 for eight 64-bit lanes. */
+__attribute__((target("avx512f")))
+static inline __m512i p57_reduce_epi64_avx512(__m512i x) {
+	const __m512i mask = _mm512_set1_epi64(P57_MASK);
+	const __m512i c = _mm512_set1_epi64(P57_C);
+	const __m512i p = _mm512_set1_epi64(P57);
+	x = _mm512_add_epi64(_mm512_and_si512(x, mask),
+			_mm512_mul_epu32(_mm512_srli_epi64(x, P_BITS), c));
+	x = _mm512_add_epi64(_mm512_and_si512(x, mask),
+			_mm512_mul_epu32(_mm512_srli_epi64(x, P_BITS), c));
+	__mmask8 ge = _mm512_cmpge_epu64_mask(x, p);
+	return _mm512_mask_sub_epi64(x, ge, x, p);
+}
+
+/* Lane-wise p57_add for eight lanes already in [0, P57). */
+__attribute__((target("avx512f")))
+static inline __m512i p57_add_epi64_avx512(__m512i a, __m512i b) {
+	const __m512i p = _mm512_set1_epi64(P57);
+	__m512i s = _mm512_add_epi64(a, b);
+	__mmask8 ge = _mm512_cmpge_epu64_mask(s, p);
+	return _mm512_mask_sub_epi64(s, ge, s, p);
+}
+
+#endif // x86_64
+
+#endif // LAPOR_P57_H
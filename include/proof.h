@@ -0,0 +1,118 @@
+#ifndef LAPOR_PROOF_H
+#define LAPOR_PROOF_H
+
+/* Verified reads whose Merkle proof the server works out.
+ *
+ * With 'R' the client names each hash it needs and waits for it before
+ * naming the next, so a read costs a round trip per level of the tree.
+ * But which hashes a read needs follows from its offset and count alone,
+ * and the server can work that out just as well (hash_indices_for_range).
+ * With 'P' the client sends just those two:
+ *
+ *   'P', then the offset and count as 64-bit integers
+ *
+ * and gets everything back in one response:
+ *
+ *   a proof_reply_t, then if its status is PROOF_OK the nhash hashes, in
+ *   the order post_read takes them, then the bytes of the blocks, as 'R'
+ *   sends them
+ *
+ * and the server closes the connection. The client runs pre_read on the
+ * same offset and count to know what is coming, and checks it with
+ * post_read as before. Framed reads (frame.h) work the same way.
+ *
+ * The server maps the tree file, so gathering a proof reads no file at
+ * all; the hashes go out in one writev straight from the mapping.
+ * All integers are sent in host byte order.
+ */
+
+#include "integrity.h"
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#define PROOF_READ_OP ('P')
+
+#define PROOF_OK (0)
+#define PROOF_INVALID (1)   // the range is not within the data
+
+// most hashes any proof needs, as merkle.c sizes its work space
+#define PROOF_MAX_HASHES (3 * 64 + 2)
+
+typedef struct {
+	uint32_t status;    // PROOF_OK or PROOF_INVALID
+	uint32_t nhash;     // hashes that follow
+} proof_reply_t;
+
+/* What a read of count bytes at offset needs, as pre_read works it out. */
+typedef struct {
+	uint64_t block_offset;
+	uint64_t block_count;
+	uint32_t lbsize;        // bytes sent of the last block
+	uint32_t nhash;
+	uint64_t ind[PROOF_MAX_HASHES];
+} proof_plan_t;
+
+/* The tree file, mapped. */
+typedef struct {
+	const unsigned char *map;
+	size_t bytes;
+} proof_tree_t;
+
+/* Plans a read of count bytes at offset; false if it is not within the
+ * data. */
+static inline bool proof_plan(proof_plan_t *p, uint64_t offset, uint64_t count, const store_info_t *info) {
+	if (offset > info->size || count > info->size - offset) return false;
+	p->block_offset = offset / info->block_size;
+	p->block_count = 0;
+	p->lbsize = 0;
+	p->nhash = 0;
+	if (count == 0) return true;
+
+	p->block_count = (offset + count - 1) / info->block_size + 1 - p->block_offset;
+	if (p->block_offset + p->block_count >= info->nblocks && info->size % info->block_size) {
+		p->lbsize = info->size % info->block_size;
+	}
+	else {
+		p->lbsize = info->block_size;
+	}
+	p->nhash = hash_indices_for_range(info->nblocks, p->block_offset, p->block_count, 0, p->ind, 0);
+	return true;
+}
+
+/* Bytes of the hashes and blocks a reply carries after its proof_reply_t. */
+static inline uint64_t proof_bytes(uint32_t nhash, uint64_t block_count, uint32_t lbsize,
+		const store_info_t *info) {
+	uint64_t bytes = (uint64_t)nhash * info->hash_size;
+	if (block_count) bytes += (block_count - 1) * info->block_size + lbsize;
+	return bytes;
+}
+
+static inline bool proof_tree_open(proof_tree_t *t, int fd) {
+	struct stat s;
+	if (fstat(fd, &s) != 0 || s.st_size == 0) return false;
+	void *map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) return false;
+	t->map = map;
+	t->bytes = s.st_size;
+	return true;
+}
+
+static inline void proof_tree_close(proof_tree_t *t) {
+	if (t->map) munmap((void*)t->map, t->bytes);
+	t->map = NULL;
+}
+
+/* Points iov at the hashes of the plan in the mapped tree, where hash k
+ * comes after the metadata block; false if the tree is too short. */
+static inline bool proof_gather(const proof_plan_t *p, const proof_tree_t *t, uint32_t hash_size,
+		struct iovec *iov) {
+	for (uint32_t i = 0; i < p->nhash; ++i) {
+		uint64_t at = (p->ind[i] + 1) * hash_size;
+		if (at + hash_size > t->bytes) return false;
+		iov[i].iov_base = (void*)(t->map + at);
+		iov[i].iov_len = hash_size;
+	}
+	return true;
+}
+
+#endif // LAPOR_PROOF_H
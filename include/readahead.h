@@ -0,0 +1,101 @@
+#ifndef LAPOR_READAHEAD_H
+#define LAPOR_READAHEAD_H
+
+/* Readahead hints for a thread scanning its own contiguous block of rows.
+ *
+ * The kernel's own readahead only looks a little past the last read, and a
+ * thread reading row i and then computing on it leaves the device idle for
+ * the whole computation. So a window of rows ahead of the scan is handed to
+ * posix_fadvise(WILLNEED), which starts reading them into the page cache in
+ * the background while the current row is computed; by the time the thread
+ * preads them they are already there. The window never reaches past the
+ * thread's own block, so threads do not fetch each other's rows.
+ *
+ * With drop_behind set, rows the scan has finished with are dropped from the
+ * page cache again, so a full scan does not evict everything else.
+ */
+
+#include "integrity.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// bytes dropped at a time when there is no window to go by
+#define READAHEAD_DROP_BATCH (UINT64_C(1) << 20)
+
+typedef struct {
+	int fd;
+	void *map;          // mapping of the whole file, or NULL
+	uint64_t stop;      // end of this thread's block, in bytes
+	uint64_t window;    // bytes to keep advised ahead of the scan
+	uint64_t advised;   // everything below this has been advised
+	uint64_t dropped;   // everything below this has been dropped
+	bool drop_behind;
+} readahead_t;
+
+static inline uint64_t readahead_page_down(uint64_t x) {
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	return x / page * page;
+}
+
+/* Starts hints for the byte range [start, stop) of fd. A window of zero
+ * bytes turns WILLNEED off; drop_behind works either way. An empty range,
+ * as a thread gets when there are more threads than rows, hints nothing. */
+static inline void readahead_init(readahead_t *ra, int fd, void *map,
+		uint64_t start, uint64_t stop, uint64_t window, bool drop_behind)
+{
+	if (stop <= start) {
+		*ra = (readahead_t){.fd = -1, .stop = start, .advised = start, .dropped = start};
+		return;
+	}
+	ra->fd = fd;
+	ra->map = map;
+	ra->stop = stop;
+	ra->window = (window < stop - start) ? window : stop - start;
+	ra->advised = start;
+	ra->dropped = readahead_page_down(start);
+	ra->drop_behind = drop_behind;
+	if (ra->window) {
+		posix_fadvise(fd, start, stop - start, POSIX_FADV_SEQUENTIAL);
+	}
+}
+
+/* Called with the scan position before reading from it. Advises the next
+ * window once the previous one is half used up, and drops what is behind. */
+static inline void readahead_advance(readahead_t *ra, uint64_t pos) {
+	if (ra->window && ra->advised < ra->stop && ra->advised <= pos + ra->window / 2) {
+		uint64_t from = (ra->advised > pos) ? ra->advised : pos;
+		uint64_t to = (ra->stop - from < ra->window) ? ra->stop : from + ra->window;
+		posix_fadvise(ra->fd, from, to - from, POSIX_FADV_WILLNEED);
+		ra->advised = to;
+	}
+	// drop in batches rather than a syscall per row
+	uint64_t batch = ra->window ? ra->window : READAHEAD_DROP_BATCH;
+	uint64_t upto = readahead_page_down(pos);
+	if (ra->drop_behind && upto > ra->dropped && upto - ra->dropped >= batch) {
+		if (ra->map) {
+			// mapped pages cannot be evicted while they are still mapped
+			madvise(ra->map + ra->dropped, upto - ra->dropped, MADV_DONTNEED);
+		}
+		posix_fadvise(ra->fd, ra->dropped, upto - ra->dropped, POSIX_FADV_DONTNEED);
+		ra->dropped = upto;
+	}
+}
+
+/* Cuts the block short at byte stop, when the rest of it went to another
+ * thread, so that finishing does not drop rows still being read. */
+static inline void readahead_truncate(readahead_t *ra, uint64_t stop) {
+	if (stop < ra->stop) ra->stop = stop;
+}
+
+/* Drops the rest of the block, if asked to, once the scan is done. */
+static inline void readahead_finish(readahead_t *ra) {
+	if (ra->drop_behind && ra->stop > ra->dropped) {
+		if (ra->map) {
+			madvise(ra->map + ra->dropped, ra->stop - ra->dropped, MADV_DONTNEED);
+		}
+		posix_fadvise(ra->fd, ra->dropped, ra->stop - ra->dropped, POSIX_FADV_DONTNEED);
+		ra->dropped = ra->stop;
+	}
+}
+
+#endif // LAPOR_READAHEAD_H
@@ -0,0 +1,198 @@
+#ifndef LAPOR_RESIDENCY_H
+#define LAPOR_RESIDENCY_H
+
+/* Orders the rows of a scan by whether they are already in the page cache.
+ *
+ * Each row's product with the challenges is independent of the others, so
+ * an audit can take its rows in any order. On a partly warm dataset, doing
+ * the cached rows first lets the compute threads start at memory speed,
+ * while the threads that reach the uncached rows read them from the device.
+ *
+ * Residency is probed with mincore over a read-only mapping of the file, a
+ * window at a time so the page vector stays small; mapping the file faults
+ * nothing in. A row counts as cached only if all of its pages are. The rows
+ * are then cut into runs: the cached runs come first and the uncached ones
+ * after, each group in file order, so the device still sees long
+ * sequential reads.
+ *
+ * A row_order_t maps positions in that order back to rows. Schedulers hand
+ * out ranges of positions, and row_order_map splits such a range at run
+ * boundaries into ranges of consecutive rows. Orders of consecutive ranges
+ * of rows can be put one after the other with row_order_concat, so that
+ * the cached rows go first within each range but rows do not move from
+ * one range's share of the positions to another's.
+ */
+
+#include "integrity.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// bytes of the file probed with each mincore call
+#define RESIDENCY_PROBE_BYTES (UINT64_C(1) << 30)
+
+typedef struct {
+	uint64_t pos;    // position of the run's first row in the order
+	uint64_t start;  // first row
+	uint64_t count;  // number of rows
+} row_run_t;
+
+typedef struct {
+	size_t nruns;
+	row_run_t *runs;          // in order of pos
+	uint64_t resident_rows;   // rows in the leading cached runs
+} row_order_t;
+
+/* Rows [first, stop) in file order. */
+static inline void row_order_identity(row_order_t *o, uint64_t first, uint64_t stop) {
+	o->nruns = 1;
+	o->runs = malloc(sizeof *o->runs);
+	assert (o->runs);
+	o->runs[0] = (row_run_t){.pos = 0, .start = first, .count = stop - first};
+	o->resident_rows = 0;
+}
+
+static inline void row_order_clear(row_order_t *o) {
+	free(o->runs);
+	o->runs = NULL;
+	o->nruns = 0;
+}
+
+static inline void row_order_push(row_run_t **runs, size_t *nruns, size_t *cap,
+		uint64_t start, uint64_t count)
+{
+	if (*nruns && (*runs)[*nruns - 1].start + (*runs)[*nruns - 1].count == start) {
+		(*runs)[*nruns - 1].count += count;
+		return;
+	}
+	if (*nruns == *cap) {
+		*cap = *cap ? 2 * *cap : 16;
+		*runs = realloc(*runs, *cap * sizeof **runs);
+		assert (*runs);
+	}
+	(*runs)[(*nruns)++] = (row_run_t){.pos = 0, .start = start, .count = count};
+}
+
+/* Rows [first, stop) of the file at path, of row_bytes rows, cached runs
+ * first. map may be an existing mapping of the whole file, or NULL to map
+ * it here. Returns false, leaving o untouched, if residency could not be
+ * probed. */
+static inline bool row_order_residency(row_order_t *o, const char *path, void *map,
+		uint64_t file_size, size_t row_bytes, uint64_t first, uint64_t stop)
+{
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	void *probe = map;
+	if (file_size && !probe) {
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) return false;
+		probe = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (probe == MAP_FAILED) return false;
+	}
+
+	row_run_t *warm = NULL, *cold = NULL;
+	size_t nwarm = 0, ncold = 0, warm_cap = 0, cold_cap = 0;
+	uint64_t resident_rows = 0;
+	unsigned char *vec = malloc(RESIDENCY_PROBE_BYTES / page + 1);
+	assert (vec);
+	uint64_t win_start = 0, win_stop = 0;  // pages of the file in vec
+	bool ok = true;
+
+	for (uint64_t i = first; i < stop && ok; ++i) {
+		uint64_t lo = i * row_bytes, hi = lo + row_bytes;
+		if (hi > file_size) hi = file_size;
+		bool resident = true;
+		// rows past the end of the file are all padding and cost nothing
+		for (uint64_t pg = lo / page; lo < hi && pg <= (hi - 1) / page; ++pg) {
+			if (pg >= win_stop) {
+				win_start = pg;
+				uint64_t bytes = file_size - win_start * page;
+				if (bytes > RESIDENCY_PROBE_BYTES) bytes = RESIDENCY_PROBE_BYTES;
+				win_stop = win_start + (bytes + page - 1) / page;
+				if (mincore((char*)probe + win_start * page, bytes, vec) != 0) {
+					ok = false;
+					break;
+				}
+			}
+			if (!(vec[pg - win_start] & 1)) {
+				resident = false;
+				break;
+			}
+		}
+		if (resident) {
+			row_order_push(&warm, &nwarm, &warm_cap, i, 1);
+			++resident_rows;
+		}
+		else {
+			row_order_push(&cold, &ncold, &cold_cap, i, 1);
+		}
+	}
+
+	free(vec);
+	if (probe != map) munmap(probe, file_size);
+	if (!ok) {
+		free(warm);
+		free(cold);
+		return false;
+	}
+
+	o->nruns = nwarm + ncold;
+	o->runs = malloc((o->nruns ? o->nruns : 1) * sizeof *o->runs);
+	assert (o->runs);
+	memcpy(o->runs, warm, nwarm * sizeof *warm);
+	memcpy(o->runs + nwarm, cold, ncold * sizeof *cold);
+	free(warm);
+	free(cold);
+	uint64_t pos = 0;
+	for (size_t r = 0; r < o->nruns; ++r) {
+		o->runs[r].pos = pos;
+		pos += o->runs[r].count;
+	}
+	o->resident_rows = resident_rows;
+	return true;
+}
+
+/* Puts the orders of nparts consecutive ranges of rows one after the other,
+ * taking over their runs. Positions [p, p + rows of part k) of the result,
+ * where p counts the rows of the parts before it, are the rows of part k. */
+static inline void row_order_concat(row_order_t *o, row_order_t *parts, size_t nparts) {
+	size_t nruns = 0;
+	for (size_t k = 0; k < nparts; ++k) nruns += parts[k].nruns;
+	o->nruns = 0;
+	o->runs = malloc((nruns ? nruns : 1) * sizeof *o->runs);
+	assert (o->runs);
+	o->resident_rows = 0;
+	uint64_t pos = 0;
+	for (size_t k = 0; k < nparts; ++k) {
+		for (size_t r = 0; r < parts[k].nruns; ++r) {
+			o->runs[o->nruns] = parts[k].runs[r];
+			o->runs[o->nruns++].pos = pos;
+			pos += parts[k].runs[r].count;
+		}
+		o->resident_rows += parts[k].resident_rows;
+		row_order_clear(&parts[k]);
+	}
+}
+
+/* Splits off the start of positions [pos, pos_stop): sets [lo, hi) to the
+ * consecutive rows the first of them cover, and run_stop to the end of
+ * their run. Returns the number of positions used. */
+static inline uint64_t row_order_map(const row_order_t *o, uint64_t pos, uint64_t pos_stop,
+		uint64_t *lo, uint64_t *hi, uint64_t *run_stop)
+{
+	size_t a = 0, b = o->nruns;
+	while (b - a > 1) {
+		size_t mid = (a + b) / 2;
+		if (o->runs[mid].pos <= pos) a = mid;
+		else b = mid;
+	}
+	const row_run_t *run = &o->runs[a];
+	uint64_t offset = pos - run->pos;
+	uint64_t count = run->count - offset;
+	if (count > pos_stop - pos) count = pos_stop - pos;
+	*lo = run->start + offset;
+	*hi = *lo + count;
+	*run_stop = run->start + run->count;
+	return count;
+}
+
+#endif // LAPOR_RESIDENCY_H
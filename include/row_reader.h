@@ -0,0 +1,335 @@
+#ifndef LAPOR_ROW_READER_H
+#define LAPOR_ROW_READER_H
+
+/* Row-by-row access to a data file, with the way rows are read chosen at
+ * run time rather than with -DPOR_MMAP, so backends can be compared on the
+ * same build and picked per dataset.
+ *
+ * A row_source_t is opened once per scan and shared by all threads; each
+ * thread then reads through its own row_reader_t. row_reader_get returns a
+ * pointer to the whole row, zero padded past the end of the file, which
+ * stays valid until the next call on the same reader. A reader set up with
+ * row_reader_init_band can also hand out a band of consecutive rows at
+ * once, read with a single call for the reading backends.
+ *
+ * Backends:
+ *   pread          pread into a per-thread buffer
+ *   mmap           one shared read-only mapping of the file
+ *   mmap-populate  mapping prefaulted with MAP_POPULATE and advised for
+ *                  sequential access and transparent huge pages
+ *   pinned         pread into a per-thread buffer locked in memory
+ *   direct         O_DIRECT reads of the aligned span around each row
+ *   zframes        a compressed store (see zframes.h), decompressed a frame
+ *                  at a time per reader; used whenever the file is one
+ *
+ * This header is also included from the C++ code in publicverif.
+ */
+
+#include "integrity.h"
+#include "direct_io.h"
+#include "zframes.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+
+typedef enum {
+	ROW_READER_PREAD = 0,
+	ROW_READER_MMAP,
+	ROW_READER_MMAP_POPULATE,
+	ROW_READER_PINNED,
+	ROW_READER_DIRECT,
+	ROW_READER_ZFRAMES,
+	ROW_READER_COUNT
+} row_backend_t;
+
+static const char *const ROW_READER_NAMES[ROW_READER_COUNT] = {
+	"pread", "mmap", "mmap-populate", "pinned", "direct", "zframes"
+};
+
+/* The backend a build used before it became a run time choice. */
+static inline row_backend_t row_reader_default(void) {
+#ifdef POR_MMAP
+	return ROW_READER_MMAP;
+#else
+	return ROW_READER_PREAD;
+#endif
+}
+
+/* Looks a backend up by name; returns -1 if there is none. */
+static inline int row_reader_lookup(const char *name) {
+	for (int b = 0; b < ROW_READER_COUNT; ++b) {
+		if (strcmp(name, ROW_READER_NAMES[b]) == 0) return b;
+	}
+	return -1;
+}
+
+static inline bool row_reader_mapped(row_backend_t backend) {
+	return backend == ROW_READER_MMAP || backend == ROW_READER_MMAP_POPULATE;
+}
+
+typedef struct {
+	row_backend_t backend;
+	const char *path;
+	uint64_t file_size;
+	uint64_t disk_size;   // size of the file when opened, compressed or not
+	size_t row_bytes;
+	uint64_t nrows;       // rows, counting a partial last row
+	char *map;            // whole file, for the mmap backends
+	uint64_t *tail;       // zero padded copy of a partial last row, or NULL
+	zframes_t *frames;    // frame index of a compressed store, or NULL
+} row_source_t;
+
+typedef struct {
+	const row_source_t *src;
+	int fd;               // open even for the mmap backends, for readahead hints
+	void *buf;            // row buffer for the reading backends
+	size_t buf_bytes;
+	size_t band_rows;     // most rows row_reader_get_band may ask for
+	uint64_t frame;       // frame decompressed in buf, for zframes
+	void *packed;         // compressed frame, for zframes
+} row_reader_t;
+
+/* Opens path for reading rows of row_bytes bytes. A direct source falls
+ * back to pread if the filesystem does not support O_DIRECT, and a
+ * compressed store is always read as zframes, with file_size its logical
+ * size. Returns false if the file cannot be opened or mapped. */
+static inline bool row_source_open(row_source_t *src, const char *path,
+		size_t row_bytes, row_backend_t backend)
+{
+	struct stat s;
+	if (stat(path, &s)) return false;
+	src->backend = backend;
+	src->path = path;
+	src->file_size = s.st_size;
+	src->disk_size = s.st_size;
+	src->row_bytes = row_bytes;
+	src->map = NULL;
+	src->tail = NULL;
+	src->frames = NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	bool compressed = zframes_probe(fd);
+	if (compressed) {
+#ifdef POR_ZLIB
+		src->frames = (zframes_t*)malloc(sizeof *src->frames);
+		assert (src->frames);
+		if (!zframes_open(src->frames, fd) || src->frames->hdr.row_bytes != row_bytes) {
+			fprintf(stderr, "ERROR: <%s> is not a compressed store of %zu-byte rows\n", path, row_bytes);
+			free(src->frames);
+			src->frames = NULL;
+			close(fd);
+			return false;
+		}
+		src->backend = ROW_READER_ZFRAMES;
+		src->file_size = src->frames->hdr.logical_size;
+#else
+		fprintf(stderr, "ERROR: <%s> is a compressed store, and this build has no zlib\n", path);
+		close(fd);
+		return false;
+#endif
+	}
+	close(fd);
+	if (!compressed && backend == ROW_READER_ZFRAMES) {
+		fprintf(stderr, "ERROR: <%s> is not a compressed store\n", path);
+		return false;
+	}
+	src->nrows = (src->file_size + row_bytes - 1) / row_bytes;
+
+	if (backend == ROW_READER_DIRECT) {
+		int fd = direct_open(path);
+		if (fd < 0) {
+			fprintf(stderr, "WARNING: <%s> does not support O_DIRECT, using pread\n", path);
+			src->backend = ROW_READER_PREAD;
+		}
+		else {
+			close(fd);
+		}
+	}
+
+	if (row_reader_mapped(src->backend) && src->file_size) {
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) return false;
+		// shared, so that the mapping is sure to see later writes to the
+		// file, as a source kept across updates needs
+		int flags = MAP_SHARED;
+		if (src->backend == ROW_READER_MMAP_POPULATE) flags |= MAP_POPULATE;
+		void *map = mmap(NULL, src->file_size, PROT_READ, flags, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) return false;
+		src->map = (char*)map;
+		if (src->backend == ROW_READER_MMAP_POPULATE) {
+			madvise(map, src->file_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+			madvise(map, src->file_size, MADV_HUGEPAGE);
+#endif
+		}
+
+		// the last row is copied once here, rather than by whichever thread reads it
+		uint64_t tail_bytes = src->file_size % row_bytes;
+		if (tail_bytes) {
+			src->tail = (uint64_t*)calloc(row_bytes, 1);
+			assert (src->tail);
+			memcpy(src->tail, src->map + (src->file_size - tail_bytes), tail_bytes);
+		}
+	}
+	return true;
+}
+
+/* Whether the file is no longer the size it was opened at, so that the
+ * row count and any mapping are out of date. */
+static inline bool row_source_resized(const row_source_t *src) {
+	struct stat s;
+	return stat(src->path, &s) || (uint64_t)s.st_size != src->disk_size;
+}
+
+/* Copies the partial last row out of the mapping again, after writes to
+ * the file; the shared mapping itself sees them. */
+static inline void row_source_refresh_tail(row_source_t *src) {
+	if (!src->tail) return;
+	uint64_t tail_bytes = src->file_size % src->row_bytes;
+	memcpy(src->tail, src->map + (src->file_size - tail_bytes), tail_bytes);
+}
+
+static inline void row_source_close(row_source_t *src) {
+	if (src->map) munmap(src->map, src->file_size);
+	if (src->frames) zframes_close(src->frames);
+	free(src->frames);
+	src->frames = NULL;
+	free(src->tail);
+	src->map = NULL;
+	src->tail = NULL;
+}
+
+/* Sets up a reader for bands of up to band_rows rows at a time. */
+static inline void row_reader_init_band(row_reader_t *rr, const row_source_t *src, size_t band_rows) {
+	rr->src = src;
+	rr->fd = -1;
+	rr->buf = NULL;
+	rr->buf_bytes = 0;
+	rr->band_rows = band_rows;
+	rr->frame = UINT64_MAX;
+	rr->packed = NULL;
+
+	if (row_reader_mapped(src->backend)) {
+		rr->fd = open(src->path, O_RDONLY);
+	}
+	else if (src->backend == ROW_READER_ZFRAMES) {
+		// a frame, then room to copy a band that crosses frames, then a zero row
+		rr->fd = open(src->path, O_RDONLY);
+		rr->buf_bytes = zframes_frame_bytes(src->frames) + (band_rows + 1) * src->row_bytes;
+		rr->buf = calloc(rr->buf_bytes, 1);
+		rr->packed = malloc(src->frames->max_packed ? src->frames->max_packed : 1);
+		assert (rr->packed);
+	}
+	else if (src->backend == ROW_READER_DIRECT) {
+		rr->fd = direct_open(src->path);
+		rr->buf_bytes = direct_buf_bytes(src->row_bytes * band_rows);
+		rr->buf = direct_buf_alloc(src->row_bytes * band_rows);
+	}
+	else {
+		rr->fd = open(src->path, O_RDONLY);
+		rr->buf_bytes = src->row_bytes * band_rows;
+		// page aligned so that pinning locks no more than it has to
+		if (posix_memalign(&rr->buf, sysconf(_SC_PAGESIZE), rr->buf_bytes)) rr->buf = NULL;
+		if (rr->buf && src->backend == ROW_READER_PINNED && mlock(rr->buf, rr->buf_bytes)) {
+			perror("mlock of row buffer");
+		}
+	}
+	assert (rr->fd >= 0 && (rr->buf || row_reader_mapped(src->backend)));
+}
+
+static inline void row_reader_init(row_reader_t *rr, const row_source_t *src) {
+	row_reader_init_band(rr, src, 1);
+}
+
+/* Returns row i; the pointer is good until the next call with this reader. */
+static inline const uint64_t* row_reader_get(row_reader_t *rr, uint64_t i) {
+	const row_source_t *src = rr->src;
+	uint64_t offset = src->row_bytes * i;
+	switch (src->backend) {
+		case ROW_READER_MMAP:
+		case ROW_READER_MMAP_POPULATE:
+			if (src->tail && i == src->nrows - 1) return src->tail;
+			return (const uint64_t*)(src->map + offset);
+
+		case ROW_READER_DIRECT:
+			return direct_pread_row(rr->fd, rr->buf, src->row_bytes, offset);
+
+#ifdef POR_ZLIB
+		case ROW_READER_ZFRAMES: {
+			const zframes_t *z = src->frames;
+			uint64_t f = i / z->hdr.frame_rows;
+			if (f >= z->hdr.nframes) {
+				return (const uint64_t*)((char*)rr->buf + rr->buf_bytes - src->row_bytes);
+			}
+			if (f != rr->frame) {
+				if (!zframes_read_frame(z, rr->fd, f, rr->packed, rr->buf)) {
+					fprintf(stderr, "ERROR: could not decompress frame %" PRIu64 " of <%s>\n", f, src->path);
+					exit(10);
+				}
+				rr->frame = f;
+			}
+			return (const uint64_t*)((char*)rr->buf + (i - f * z->hdr.frame_rows) * src->row_bytes);
+		}
+#endif
+
+		default:
+			my_pread(rr->fd, rr->buf, src->row_bytes, offset);
+			return (const uint64_t*)rr->buf;
+	}
+}
+
+/* Points rows[0..count) at rows i to i+count-1, count being at most the
+ * reader's band_rows; the pointers are good until the next call with this
+ * reader. */
+static inline void row_reader_get_band(row_reader_t *rr, uint64_t i, size_t count,
+		const uint64_t **rows)
+{
+	const row_source_t *src = rr->src;
+	assert (count <= rr->band_rows);
+	uint64_t frame_rows = src->frames ? src->frames->hdr.frame_rows : 0;
+	if (frame_rows && i / frame_rows != (i + count - 1) / frame_rows) {
+		// the rows are in two frames, and only one is kept, so copy them out
+		char *band = (char*)rr->buf + zframes_frame_bytes(src->frames);
+		for (size_t r = 0; r < count; ++r) {
+			memcpy(band + r * src->row_bytes, row_reader_get(rr, i + r), src->row_bytes);
+			rows[r] = (const uint64_t*)(band + r * src->row_bytes);
+		}
+		return;
+	}
+	if (row_reader_mapped(src->backend) || frame_rows || count == 1) {
+		for (size_t r = 0; r < count; ++r) {
+			rows[r] = row_reader_get(rr, i + r);
+		}
+		return;
+	}
+
+	// the rows are consecutive in the file, so read them in one go
+	size_t words = src->row_bytes / sizeof(uint64_t);
+	const uint64_t *band;
+	if (src->backend == ROW_READER_DIRECT) {
+		band = direct_pread_row(rr->fd, rr->buf, src->row_bytes * count, src->row_bytes * i);
+	}
+	else {
+		my_pread(rr->fd, rr->buf, src->row_bytes * count, src->row_bytes * i);
+		band = (const uint64_t*)rr->buf;
+	}
+	for (size_t r = 0; r < count; ++r) {
+		rows[r] = band + r * words;
+	}
+}
+
+static inline void row_reader_clear(row_reader_t *rr) {
+	if (rr->buf) {
+		if (rr->src->backend == ROW_READER_PINNED) munlock(rr->buf, rr->buf_bytes);
+		free(rr->buf);
+	}
+	free(rr->packed);
+	rr->packed = NULL;
+	if (rr->fd >= 0) close(rr->fd);
+	rr->buf = NULL;
+	rr->fd = -1;
+}
+
+#endif // LAPOR_ROW_READER_H
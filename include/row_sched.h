@@ -0,0 +1,184 @@
+#ifndef LAPOR_ROW_SCHED_H
+#define LAPOR_ROW_SCHED_H
+
+/* Work-stealing scheduler for scans of a range of rows.
+ *
+ * Each thread starts out owning the same contiguous block of rows that
+ * schedule(static) would give it, and takes chunks off the front of it in
+ * order, so its reads stay sequential. Chunks are guided: a quarter of
+ * what the thread has left, so they start large and shrink towards the
+ * end, but never below min_chunk rows.
+ *
+ * A thread whose block runs out steals the back half of the unclaimed rows
+ * of the thread with the most left (preferring threads in its own group,
+ * such as its NUMA node) and carries on from there. A block is packed into
+ * one 64-bit word, front and back, so taking a chunk and stealing are both
+ * a single compare-and-swap.
+ *
+ * With stealing off, each thread takes its whole block as one chunk, which
+ * is exactly the old static partition; the busy and idle times are kept
+ * either way, so the two can be compared.
+ */
+
+#include "integrity.h"
+#include <inttypes.h>
+#include <omp.h>
+
+// the owner takes this fraction of what it has left per chunk
+#define ROW_SCHED_GUIDE (4)
+
+typedef struct {
+	uint64_t range;          // front << 32 | back, relative to first
+	int group;               // victims in the same group are tried first
+	uint64_t last_hi;        // end of the previous chunk, to spot new runs
+	double start, busy_since, busy, finish;
+	uint64_t rows, chunks, steals;
+} __attribute__((aligned(64))) row_sched_worker_t;
+
+typedef struct {
+	uint64_t first, stop;
+	size_t min_chunk;
+	bool steal;
+	int nworkers;
+	row_sched_worker_t *w;
+} row_sched_t;
+
+typedef struct {
+	uint64_t lo, hi;         // rows of this chunk
+	uint64_t run_stop;       // the thread's block ended here when the chunk was taken
+	bool new_run;            // the chunk does not carry on from the previous one
+} row_chunk_t;
+
+static inline uint64_t row_sched_pack(uint64_t front, uint64_t back) {
+	return front << 32 | back;
+}
+
+/* Splits rows [first, stop) among nworkers; groups may be NULL. */
+static inline void row_sched_init(row_sched_t *s, uint64_t first, uint64_t stop,
+		int nworkers, size_t min_chunk, bool steal, const int *groups)
+{
+	assert (stop - first < (UINT64_C(1) << 32));
+	s->first = first;
+	s->stop = stop;
+	s->min_chunk = min_chunk ? min_chunk : 1;
+	s->steal = steal;
+	s->nworkers = nworkers;
+	s->w = calloc(nworkers, sizeof *s->w);
+	assert (s->w);
+	double now = omp_get_wtime();
+	uint64_t rows = stop - first;
+	for (int t = 0; t < nworkers; ++t) {
+		s->w[t].range = row_sched_pack(rows * t / nworkers, rows * (t + 1) / nworkers);
+		s->w[t].group = groups ? groups[t] : 0;
+		s->w[t].last_hi = UINT64_MAX;
+		s->w[t].start = now;
+	}
+}
+
+static inline void row_sched_clear(row_sched_t *s) {
+	free(s->w);
+	s->w = NULL;
+}
+
+/* Takes a chunk off the front of worker t's own block. */
+static inline bool row_sched_take(row_sched_t *s, int t, row_chunk_t *c) {
+	row_sched_worker_t *w = &s->w[t];
+	uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+	while (true) {
+		uint64_t front = r >> 32, back = r & UINT32_MAX;
+		if (front >= back) return false;
+		uint64_t size = back - front;
+		if (s->steal) {
+			uint64_t guided = size / ROW_SCHED_GUIDE;
+			size = (guided > s->min_chunk) ? guided : s->min_chunk;
+			if (size > back - front) size = back - front;
+		}
+		if (__atomic_compare_exchange_n(&w->range, &r, row_sched_pack(front + size, back),
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			c->lo = s->first + front;
+			c->hi = s->first + front + size;
+			c->run_stop = s->first + back;
+			return true;
+		}
+	}
+}
+
+/* Moves the back half of the fullest other block into worker t's own,
+ * which must be empty. Returns false if there was nothing to steal. */
+static inline bool row_sched_steal(row_sched_t *s, int t) {
+	while (true) {
+		int victim = -1;
+		uint64_t best = 0, best_r = 0;
+		bool best_local = false;
+		for (int v = 0; v < s->nworkers; ++v) {
+			if (v == t) continue;
+			uint64_t r = __atomic_load_n(&s->w[v].range, __ATOMIC_ACQUIRE);
+			uint64_t left = (r >> 32 < (r & UINT32_MAX)) ? (r & UINT32_MAX) - (r >> 32) : 0;
+			bool local = s->w[v].group == s->w[t].group;
+			if (!left) continue;
+			if ((local && !best_local) || (local == best_local && left > best)) {
+				victim = v;
+				best = left;
+				best_r = r;
+				best_local = local;
+			}
+		}
+		if (victim < 0) return false;
+
+		uint64_t front = best_r >> 32, back = best_r & UINT32_MAX;
+		uint64_t take = (best > 1) ? best / 2 : 1;
+		uint64_t mid = back - take;
+		if (__atomic_compare_exchange_n(&s->w[victim].range, &best_r, row_sched_pack(front, mid),
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			// nobody else touches an empty block, so a plain store will do
+			__atomic_store_n(&s->w[t].range, row_sched_pack(mid, back), __ATOMIC_RELEASE);
+			++s->w[t].steals;
+			return true;
+		}
+	}
+}
+
+/* Gets worker t's next chunk, stealing if its own block is used up.
+ * Returns false once there are no rows left anywhere. */
+static inline bool row_sched_next(row_sched_t *s, int t, row_chunk_t *c) {
+	row_sched_worker_t *w = &s->w[t];
+	double now = omp_get_wtime();
+	if (w->chunks) w->busy += now - w->busy_since;
+
+	bool got = row_sched_take(s, t, c);
+	while (!got && s->steal && row_sched_steal(s, t)) {
+		got = row_sched_take(s, t, c);
+	}
+	if (!got) {
+		w->finish = omp_get_wtime();
+		return false;
+	}
+
+	c->new_run = (c->lo != w->last_hi);
+	w->last_hi = c->hi;
+	w->rows += c->hi - c->lo;
+	++w->chunks;
+	w->busy_since = omp_get_wtime();
+	return true;
+}
+
+/* Prints each worker's rows, steals, and busy and idle time, idle being
+ * the rest of the time until the last worker finished. */
+static inline void row_sched_report(const row_sched_t *s, FILE *out) {
+	double start = s->w[0].start, end = start, total_busy = 0;
+	for (int t = 0; t < s->nworkers; ++t) {
+		if (s->w[t].finish > end) end = s->w[t].finish;
+		total_busy += s->w[t].busy;
+	}
+	for (int t = 0; t < s->nworkers; ++t) {
+		const row_sched_worker_t *w = &s->w[t];
+		fprintf(out, "thread %d: %"PRIu64" rows in %"PRIu64" chunks, %"PRIu64" steals, busy %f s, idle %f s\n",
+				t, w->rows, w->chunks, w->steals, w->busy, end - start - w->busy);
+	}
+	double total = (end - start) * s->nworkers;
+	fprintf(out, "%s scheduling: %f s, threads idle %.1f%% of the time\n",
+			s->steal ? "work-stealing" : "static", end - start,
+			(total > 0) ? 100 * (total - total_busy) / total : 0.0);
+}
+
+#endif // LAPOR_ROW_SCHED_H
@@ -0,0 +1,200 @@
+#ifndef LAPOR_SCAN_SHARE_H
+#define LAPOR_SCAN_SHARE_H
+
+/* State shared between the forked children so that concurrent audits of the
+ * same data file ride along on one scan. Each challenge vector occupies a
+ * slot; the scan goes round the file in chunks, and a slot that joins
+ * mid-scan keeps going past the end of the file until it has seen all m rows.
+ * Whichever waiting child finds no scan in flight becomes the leader and
+ * runs it until its own slots are done.
+ *
+ * Every slot records the process waiting on it. A process that dies while
+ * waiting (a client that went away, a killed worker) leaves its slots
+ * taken, so whenever no chunk is in flight, the slots of processes that
+ * are gone are freed again; otherwise enough such deaths would fill the
+ * table for good. Processes are gone once they are reaped, so the forking
+ * server must not leave its children as zombies.
+ */
+
+#include "integrity.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+enum { SLOT_FREE = 0, SLOT_ACTIVE, SLOT_DONE };
+
+typedef struct {
+	int state;
+	pid_t owner;        // process waiting on the slot
+	uint64_t remaining; // rows this challenge still has to see
+} scan_slot_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pid_t leader;       // 0 when no scan is in flight
+	uint64_t cursor;    // next row the scan will read
+	uint32_t nslots;
+	uint64_t n, m;
+	scan_slot_t slots[];
+	// followed by nslots * (n + m) words of challenge and response data
+} scan_share_t;
+
+/* Maps the scan coordination state where every forked child can see it. */
+static inline scan_share_t* scan_share_create(uint32_t nslots, uint64_t n, uint64_t m) {
+	size_t bytes = sizeof(scan_share_t) + nslots * sizeof(scan_slot_t)
+		+ nslots * (n + m) * sizeof(uint64_t);
+	scan_share_t *sh = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sh == MAP_FAILED) {
+		perror("mmap for shared scans");
+		exit(5);
+	}
+
+	pthread_mutexattr_t mattr;
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&sh->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_t cattr;
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sh->cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	sh->leader = 0;
+	sh->cursor = 0;
+	sh->nslots = nslots;
+	sh->n = n;
+	sh->m = m;
+	return sh;
+}
+
+static inline void scan_share_destroy(scan_share_t *sh) {
+	munmap(sh, sizeof(scan_share_t) + sh->nslots * sizeof(scan_slot_t)
+			+ sh->nslots * (sh->n + sh->m) * sizeof(uint64_t));
+}
+
+static inline uint64_t* slot_challenge(scan_share_t *sh, uint32_t slot) {
+	return (uint64_t*)(sh->slots + sh->nslots) + slot * (sh->n + sh->m);
+}
+
+static inline uint64_t* slot_response(scan_share_t *sh, uint32_t slot) {
+	return slot_challenge(sh, slot) + sh->n;
+}
+
+static inline bool scan_pid_gone(pid_t pid) {
+	return kill(pid, 0) && errno == ESRCH;
+}
+
+static inline void scan_lock(scan_share_t *sh) {
+	if (pthread_mutex_lock(&sh->lock) == EOWNERDEAD) {
+		// a child died holding the lock; whatever it was doing is lost
+		fprintf(stderr, "WARNING: recovering shared scan state from a dead process\n");
+		pthread_mutex_consistent(&sh->lock);
+	}
+}
+
+// a leader killed mid-scan leaves the scan stranded; let someone take over
+static inline void scan_check_leader(scan_share_t *sh) {
+	if (sh->leader && scan_pid_gone(sh->leader)) {
+		fprintf(stderr, "WARNING: shared scan leader %d is gone, taking over\n", (int)sh->leader);
+		sh->leader = 0;
+	}
+}
+
+/* Frees the slots of processes that are gone. Only safe with the lock held
+ * and no chunk in flight: the leader's snapshot of the slots must not change
+ * under it. Returns how many were freed. */
+static inline uint32_t scan_reclaim_slots(scan_share_t *sh) {
+	uint32_t freed = 0;
+	for (uint32_t k = 0; k < sh->nslots; ++k) {
+		scan_slot_t *slot = &sh->slots[k];
+		if (slot->state != SLOT_FREE && scan_pid_gone(slot->owner)) {
+			slot->state = SLOT_FREE;
+			++freed;
+		}
+	}
+	if (freed) fprintf(stderr, "WARNING: freed %"PRIu32" shared scan slots of processes that are gone\n", freed);
+	return freed;
+}
+
+/* Takes nchal free slots for this process into mine, counting the slots of
+ * other challenges in flight into others. Returns false, taking none, if
+ * there are not that many free. Called with the lock held. */
+static inline bool scan_claim_slots(scan_share_t *sh, uint32_t nchal, uint32_t *mine, uint32_t *others) {
+	uint32_t nmine = 0;
+	*others = 0;
+	for (uint32_t k = 0; k < sh->nslots; ++k) {
+		if (sh->slots[k].state == SLOT_FREE && nmine < nchal) mine[nmine++] = k;
+		else if (sh->slots[k].state == SLOT_ACTIVE) ++*others;
+	}
+	if (nmine < nchal) return false;
+	for (uint32_t j = 0; j < nchal; ++j) {
+		scan_slot_t *slot = &sh->slots[mine[j]];
+		slot->owner = getpid();
+		slot->remaining = sh->m;
+		slot->state = SLOT_ACTIVE;
+	}
+	return true;
+}
+
+static inline bool slots_done(scan_share_t *sh, const uint32_t *mine, uint32_t nmine) {
+	for (uint32_t j = 0; j < nmine; ++j) {
+		if (sh->slots[mine[j]].state != SLOT_DONE) return false;
+	}
+	return true;
+}
+
+/* Plans the scan's next chunk, rows [*start, *start + *len), which stops at
+ * the end of the file and wraps round on the next call. Snapshots the
+ * active slots into order, longest remaining first, with rows[a] the rows
+ * of the chunk that slot order[a] still wants, so that the slots wanting
+ * row t of the chunk are always a prefix. Returns how many are active.
+ * Called with the lock held. */
+static inline uint32_t scan_plan_chunk(const scan_share_t *sh, uint64_t chunk_rows,
+		uint32_t *order, uint64_t *rows, uint64_t *start, uint64_t *len)
+{
+	*start = sh->cursor;
+	*len = (sh->m - *start < chunk_rows) ? sh->m - *start : chunk_rows;
+	uint32_t nactive = 0;
+	for (uint32_t k = 0; k < sh->nslots; ++k) {
+		if (sh->slots[k].state != SLOT_ACTIVE) continue;
+		uint32_t pos = nactive++;
+		uint64_t want = (sh->slots[k].remaining < *len) ? sh->slots[k].remaining : *len;
+		while (pos > 0 && rows[pos-1] < want) {
+			order[pos] = order[pos-1];
+			rows[pos] = rows[pos-1];
+			--pos;
+		}
+		order[pos] = k;
+		rows[pos] = want;
+	}
+	return nactive;
+}
+
+/* How many of the planned slots want row t of the chunk. */
+static inline uint32_t scan_chunk_wanting(const uint64_t *rows, uint32_t nactive, uint64_t t) {
+	uint32_t count = 0;
+	while (count < nactive && rows[count] > t) ++count;
+	return count;
+}
+
+/* Counts a computed chunk against its slots, marking those that have now
+ * seen every row done, and moves the scan on. Called with the lock held. */
+static inline void scan_finish_chunk(scan_share_t *sh, const uint32_t *order,
+		const uint64_t *rows, uint32_t nactive, uint64_t start, uint64_t len)
+{
+	for (uint32_t a = 0; a < nactive; ++a) {
+		scan_slot_t *slot = &sh->slots[order[a]];
+		slot->remaining -= rows[a];
+		if (slot->remaining == 0) slot->state = SLOT_DONE;
+	}
+	sh->cursor = (start + len) % sh->m;
+}
+
+#endif // LAPOR_SCAN_SHARE_H
@@ -0,0 +1,282 @@
+#ifndef LAPOR_SCRUB_H
+#define LAPOR_SCRUB_H
+
+/* Checks the data against the leaf hashes of the stored Merkle tree while
+ * an audit scans it.
+ *
+ * A full audit reads every byte anyway, so the rows each thread has just
+ * multiplied are also fed into the hash of the Merkle block they belong
+ * to. Whenever a block is complete, its hash is compared with the leaf in
+ * the tree file, so a corrupt block is found, and pinned to its bytes, in
+ * the same pass.
+ *
+ * Hashing is many times slower than the audit kernel, so it is not done on
+ * the audit threads: each one copies its rows into a bounded queue, and a
+ * hashing thread of its own feeds them in, in the same order, while the
+ * audit thread goes on to the next rows.
+ *
+ * A thread can only hash a block it sees all of, in order. Blocks that
+ * straddle the edge of a thread's run of rows are noted instead, and after
+ * the scan those few are read again and hashed whole.
+ */
+
+#include "integrity.h"
+#include <pthread.h>
+#include <sys/mman.h>
+
+// bytes of rows each audit thread can have waiting to be hashed
+#define SCRUB_QUEUE_BYTES (UINT64_C(8) << 20)
+
+typedef struct {
+	store_info_t info;
+	const unsigned char *hashes;  // the tree file, mapped
+	size_t tree_bytes;
+} scrub_tree_t;
+
+typedef struct {
+	const scrub_tree_t *tree;
+	EVP_MD_CTX *ctx;
+	bool open;                    // a block is being hashed
+	uint64_t block;               // which one
+	uint64_t pos;                 // the next byte it needs
+	uint64_t checked;             // blocks hashed and compared
+	uint64_t *edges;              // blocks only partly seen
+	size_t nedges, edge_cap;
+	uint64_t *corrupt;            // blocks whose hash differs from the tree
+	size_t ncorrupt, corrupt_cap;
+} scrub_thread_t;
+
+/* Maps the tree file open on fd, as described by info. */
+static inline bool scrub_tree_open(scrub_tree_t *t, int fd, const store_info_t *info) {
+	struct stat s;
+	if (fstat(fd, &s) != 0 || (uint64_t)s.st_size < (2 * info->nblocks) * info->hash_size) {
+		return false;
+	}
+	void *map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) return false;
+	t->info = *info;
+	t->hashes = map;
+	t->tree_bytes = s.st_size;
+	return true;
+}
+
+static inline void scrub_tree_close(scrub_tree_t *t) {
+	if (t->hashes) munmap((void*)t->hashes, t->tree_bytes);
+	t->hashes = NULL;
+}
+
+/* The stored leaf hash of block b; the metadata block comes first. */
+static inline const unsigned char* scrub_leaf(const scrub_tree_t *t, uint64_t b) {
+	return t->hashes + (leaf_hash_index(t->info.nblocks, b) + 1) * t->info.hash_size;
+}
+
+static inline uint64_t scrub_block_stop(const scrub_tree_t *t, uint64_t b) {
+	uint64_t stop = (b + 1) * t->info.block_size;
+	return (stop < t->info.size) ? stop : t->info.size;
+}
+
+static inline void scrub_push(uint64_t **list, size_t *count, size_t *cap, uint64_t b) {
+	if (*count == *cap) {
+		*cap = *cap ? 2 * *cap : 16;
+		*list = realloc(*list, *cap * sizeof **list);
+		assert (*list);
+	}
+	(*list)[(*count)++] = b;
+}
+
+static inline void scrub_thread_init(scrub_thread_t *s, const scrub_tree_t *tree) {
+	memset(s, 0, sizeof *s);
+	s->tree = tree;
+	s->ctx = EVP_MD_CTX_new();
+	assert (s->ctx);
+}
+
+/* Compares a finished block hash with the tree. */
+static inline void scrub_check(scrub_thread_t *s, uint64_t b, const digest_t hash) {
+	++s->checked;
+	if (memcmp(hash, scrub_leaf(s->tree, b), s->tree->info.hash_size)) {
+		scrub_push(&s->corrupt, &s->ncorrupt, &s->corrupt_cap, b);
+	}
+}
+
+/* Gives up on the block being hashed, leaving it for scrub_finish. */
+static inline void scrub_break(scrub_thread_t *s) {
+	if (s->open) {
+		scrub_push(&s->edges, &s->nedges, &s->edge_cap, s->block);
+		s->open = false;
+	}
+}
+
+/* Feeds in the len bytes at offset; bytes past the end of the data (the
+ * padding of the last row) are ignored. */
+static inline void scrub_feed(scrub_thread_t *s, const void *data, uint64_t offset, uint64_t len) {
+	const scrub_tree_t *t = s->tree;
+	const char *p = data;
+	if (offset >= t->info.size) return;
+	if (len > t->info.size - offset) len = t->info.size - offset;
+	if (s->open && s->pos != offset) scrub_break(s);
+
+	while (len) {
+		uint64_t b = offset / t->info.block_size;
+		uint64_t stop = scrub_block_stop(t, b);
+		uint64_t take = (stop - offset < len) ? stop - offset : len;
+		if (!s->open) {
+			if (offset % t->info.block_size) {
+				// the start of this block went elsewhere
+				scrub_push(&s->edges, &s->nedges, &s->edge_cap, b);
+				p += take;
+				offset += take;
+				len -= take;
+				continue;
+			}
+			hash_leaf_start(&t->info, s->ctx);
+			s->open = true;
+			s->block = b;
+		}
+		hash_leaf_update(p, take, s->ctx);
+		p += take;
+		offset += take;
+		len -= take;
+		if (offset == stop) {
+			digest_t hash;
+			hash_leaf_finish(hash, s->ctx);
+			s->open = false;
+			scrub_check(s, b, hash);
+		}
+	}
+	s->pos = offset;
+}
+
+static inline void scrub_thread_clear(scrub_thread_t *s) {
+	EVP_MD_CTX_free(s->ctx);
+	free(s->edges);
+	free(s->corrupt);
+	memset(s, 0, sizeof *s);
+}
+
+/* The queue from one audit thread to its hashing thread. */
+typedef struct {
+	scrub_thread_t *s;
+	size_t row_bytes;
+	size_t nslots;
+	char *rows;                   // nslots copies of rows
+	uint64_t *offsets;            // where each one starts
+	size_t head, tail;            // hashed up to head, queued up to tail
+	bool closing;                 // no more rows are coming
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+} scrub_pipe_t;
+
+static inline void* scrub_pipe_run(void *arg) {
+	scrub_pipe_t *p = arg;
+	pthread_mutex_lock(&p->lock);
+	while (true) {
+		while (p->head == p->tail && !p->closing) pthread_cond_wait(&p->cond, &p->lock);
+		if (p->head == p->tail) break;
+		size_t slot = p->head % p->nslots;
+		pthread_mutex_unlock(&p->lock);
+		scrub_feed(p->s, p->rows + slot * p->row_bytes, p->offsets[slot], p->row_bytes);
+		pthread_mutex_lock(&p->lock);
+		++p->head;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/* Starts a hashing thread that feeds rows of row_bytes into s. */
+static inline void scrub_pipe_start(scrub_pipe_t *p, scrub_thread_t *s, size_t row_bytes) {
+	memset(p, 0, sizeof *p);
+	p->s = s;
+	p->row_bytes = row_bytes;
+	p->nslots = (SCRUB_QUEUE_BYTES / row_bytes > 2) ? SCRUB_QUEUE_BYTES / row_bytes : 2;
+	p->rows = malloc(p->nslots * row_bytes);
+	p->offsets = malloc(p->nslots * sizeof *p->offsets);
+	assert (p->rows && p->offsets);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	if (pthread_create(&p->thread, NULL, scrub_pipe_run, p) != 0) {
+		fprintf(stderr, "ERROR: could not start a scrub hashing thread\n");
+		exit(6);
+	}
+}
+
+/* Queues a copy of the row at offset, waiting while the queue is full. */
+static inline void scrub_pipe_feed(scrub_pipe_t *p, const void *row, uint64_t offset) {
+	pthread_mutex_lock(&p->lock);
+	while (p->tail - p->head == p->nslots) pthread_cond_wait(&p->cond, &p->lock);
+	size_t slot = p->tail % p->nslots;
+	pthread_mutex_unlock(&p->lock);
+	// the hashing thread does not touch a slot until it is queued
+	memcpy(p->rows + slot * p->row_bytes, row, p->row_bytes);
+	p->offsets[slot] = offset;
+	pthread_mutex_lock(&p->lock);
+	++p->tail;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* Waits for the queued rows to be hashed and stops the thread. */
+static inline void scrub_pipe_stop(scrub_pipe_t *p) {
+	pthread_mutex_lock(&p->lock);
+	p->closing = true;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	pthread_join(p->thread, NULL);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p->rows);
+	free(p->offsets);
+}
+
+static inline int scrub_cmp_block(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/* Merges the threads' results into the first: the edge blocks are read
+ * from data (the logical bytes, seekable) and checked whole, and the
+ * corrupt blocks end up sorted in threads[0].corrupt. Returns how many
+ * edge blocks were read again. */
+static inline size_t scrub_finish(scrub_thread_t *threads, size_t nthreads, FILE *data) {
+	scrub_thread_t *s = &threads[0];
+	const scrub_tree_t *t = s->tree;
+	scrub_break(s);
+	for (size_t k = 1; k < nthreads; ++k) {
+		scrub_break(&threads[k]);
+		for (size_t e = 0; e < threads[k].nedges; ++e) {
+			scrub_push(&s->edges, &s->nedges, &s->edge_cap, threads[k].edges[e]);
+		}
+		for (size_t c = 0; c < threads[k].ncorrupt; ++c) {
+			scrub_push(&s->corrupt, &s->ncorrupt, &s->corrupt_cap, threads[k].corrupt[c]);
+		}
+		s->checked += threads[k].checked;
+	}
+
+	// edge blocks are listed once by each thread that saw part of them
+	qsort(s->edges, s->nedges, sizeof *s->edges, scrub_cmp_block);
+	char *block = malloc(t->info.block_size);
+	assert (block);
+	size_t reread = 0;
+	for (size_t e = 0; e < s->nedges; ++e) {
+		uint64_t b = s->edges[e];
+		if (e && b == s->edges[e - 1]) continue;
+		uint64_t start = b * t->info.block_size;
+		uint64_t len = scrub_block_stop(t, b) - start;
+		digest_t hash;
+		if (fseek(data, start, SEEK_SET) || fread(block, 1, len, data) != len) {
+			memset(hash, 0, sizeof hash);  // unreadable counts as corrupt
+		}
+		else {
+			hash_leaf(hash, block, len, &t->info, s->ctx);
+		}
+		scrub_check(s, b, hash);
+		++reread;
+	}
+	free(block);
+	qsort(s->corrupt, s->ncorrupt, sizeof *s->corrupt, scrub_cmp_block);
+	return reread;
+}
+
+#endif // LAPOR_SCRUB_H
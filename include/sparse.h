@@ -0,0 +1,139 @@
+#ifndef LAPOR_SPARSE_H
+#define LAPOR_SPARSE_H
+
+/* Data extents of sparse files, so scans can skip their holes.
+ *
+ * Holes read back as zeros, and zero chunks add nothing to a row's dot
+ * products or to the client's column sums, so a scan only needs the bytes
+ * that are actually allocated. The extents come from SEEK_DATA/SEEK_HOLE;
+ * on file systems without them lseek reports the whole file as data and
+ * nothing is skipped.
+ *
+ * A row with no data in it is not read at all. A row that is partly data
+ * is read as usual, but only the column ranges that overlap the extents,
+ * widened to whole groups of 8 columns (56 bytes, which the row kernels
+ * work in), are multiplied.
+ */
+
+#include "integrity.h"
+#include <errno.h>
+#include <fcntl.h>
+
+// at most this many column ranges per row; beyond that the last is widened
+#define SPARSE_MAX_COL_RANGES (16)
+
+typedef struct {
+	uint64_t start, stop;  // bytes [start, stop) hold data
+} extent_t;
+
+typedef struct {
+	size_t nextents;
+	extent_t *ext;         // sorted, never adjacent
+	uint64_t file_size;
+	uint64_t data_bytes;   // total length of the extents
+} extent_map_t;
+
+typedef struct {
+	size_t col, ncols;     // multiples of 8
+} col_range_t;
+
+static inline void extent_map_clear(extent_map_t *em) {
+	free(em->ext);
+	em->ext = NULL;
+	em->nextents = 0;
+}
+
+/* Finds the data extents of the file at path. Returns false if it cannot
+ * be opened. */
+static inline bool extent_map_load(extent_map_t *em, const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat s;
+	if (fstat(fd, &s) != 0) {
+		close(fd);
+		return false;
+	}
+	em->file_size = s.st_size;
+	em->nextents = 0;
+	em->ext = NULL;
+	em->data_bytes = 0;
+	size_t cap = 0;
+
+	off_t pos = 0;
+	while ((uint64_t)pos < em->file_size) {
+		off_t start = lseek(fd, pos, SEEK_DATA);
+		if (start < 0) {
+			if (errno == ENXIO) break;  // only a hole from here on
+			start = pos;                // no SEEK_DATA; take it all as data
+		}
+		off_t stop = lseek(fd, start, SEEK_HOLE);
+		if (stop < 0 || (uint64_t)stop > em->file_size) stop = em->file_size;
+		if (stop <= start) break;
+		if (em->nextents == cap) {
+			cap = cap ? 2 * cap : 16;
+			em->ext = realloc(em->ext, cap * sizeof *em->ext);
+			assert (em->ext);
+		}
+		em->ext[em->nextents++] = (extent_t){.start = start, .stop = stop};
+		em->data_bytes += stop - start;
+		pos = stop;
+	}
+	close(fd);
+	return true;
+}
+
+static inline bool extent_map_sparse(const extent_map_t *em) {
+	return em->data_bytes < em->file_size;
+}
+
+/* Index of the first extent ending after byte pos. */
+static inline size_t extent_map_find(const extent_map_t *em, uint64_t pos) {
+	size_t a = 0, b = em->nextents;
+	while (a < b) {
+		size_t mid = (a + b) / 2;
+		if (em->ext[mid].stop <= pos) a = mid + 1;
+		else b = mid;
+	}
+	return a;
+}
+
+/* Whether any byte of [lo, hi) holds data. */
+static inline bool extent_map_has_data(const extent_map_t *em, uint64_t lo, uint64_t hi) {
+	size_t e = extent_map_find(em, lo);
+	return e < em->nextents && em->ext[e].start < hi;
+}
+
+/* Whether every byte of [lo, hi) that is in the file holds data. */
+static inline bool extent_map_dense(const extent_map_t *em, uint64_t lo, uint64_t hi) {
+	if (hi > em->file_size) hi = em->file_size;
+	if (lo >= hi) return false;
+	size_t e = extent_map_find(em, lo);
+	return e < em->nextents && em->ext[e].start <= lo && em->ext[e].stop >= hi;
+}
+
+/* The column ranges of the row of ncols columns at byte offset that
+ * overlap data, in order. Returns how many there are, zero for a row that
+ * is all hole. */
+static inline size_t extent_map_row_cols(const extent_map_t *em, uint64_t offset,
+		size_t ncols, col_range_t *out)
+{
+	const uint64_t group_bytes = 8 * BYTES_UNDER_P;
+	uint64_t stop = offset + ncols * BYTES_UNDER_P;
+	size_t nr = 0;
+	for (size_t e = extent_map_find(em, offset); e < em->nextents && em->ext[e].start < stop; ++e) {
+		uint64_t a = ((em->ext[e].start > offset) ? em->ext[e].start : offset) - offset;
+		uint64_t b = ((em->ext[e].stop < stop) ? em->ext[e].stop : stop) - offset;
+		size_t c0 = a / group_bytes * 8;
+		size_t c1 = (b + group_bytes - 1) / group_bytes * 8;
+		if (c1 > ncols) c1 = ncols;
+		if (nr && (out[nr - 1].col + out[nr - 1].ncols >= c0 || nr == SPARSE_MAX_COL_RANGES)) {
+			out[nr - 1].ncols = c1 - out[nr - 1].col;
+		}
+		else {
+			out[nr++] = (col_range_t){.col = c0, .ncols = c1 - c0};
+		}
+	}
+	return nr;
+}
+
+#endif // LAPOR_SPARSE_H
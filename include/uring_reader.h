@@ -0,0 +1,162 @@
+#ifndef LAPOR_URING_READER_H
+#define LAPOR_URING_READER_H
+
+/* A minimal io_uring read queue, talking to the kernel through the raw
+ * syscalls so there is no dependency on liburing.
+ *
+ * Each queue owns `depth` row buffers of `buf_bytes` bytes, registered with
+ * the kernel when the memlock limit allows it so reads go straight into them
+ * (IORING_OP_READ_FIXED); otherwise plain IORING_OP_READ is used. One queue
+ * is meant to be used by a single thread: submit reads into free buffers,
+ * then reap completions in whatever order the device finishes them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define POR_HAVE_URING 1
+#endif
+
+typedef struct {
+	unsigned depth;
+	size_t buf_bytes;
+	uint64_t *bufs;       // depth buffers, one after the other
+	bool fixed;           // buffers are registered with the ring
+	unsigned inflight;
+#ifdef POR_HAVE_URING
+	int ring_fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_bytes, cq_ring_bytes, sqes_bytes;
+#endif
+} uring_reader_t;
+
+static inline uint64_t* uring_reader_buf(uring_reader_t *ur, unsigned slot) {
+	return ur->bufs + slot * (ur->buf_bytes / sizeof *ur->bufs);
+}
+
+#ifdef POR_HAVE_URING
+
+/* Sets up the ring and its buffers. Returns false, leaving nothing to clean
+ * up, if io_uring is not available. buf_bytes must be a multiple of 8. */
+static inline bool uring_reader_init(uring_reader_t *ur, unsigned depth, size_t buf_bytes) {
+	memset(ur, 0, sizeof *ur);
+	struct io_uring_params p;
+	memset(&p, 0, sizeof p);
+	int fd = syscall(__NR_io_uring_setup, depth, &p);
+	if (fd < 0) return false;
+
+	ur->ring_fd = fd;
+	ur->depth = depth;
+	ur->buf_bytes = buf_bytes;
+	ur->sq_ring_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_ring_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	ur->cq_ring = mmap(NULL, ur->cq_ring_bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	ur->sqes = mmap(NULL, ur->sqes_bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ur->sq_ring == MAP_FAILED || ur->cq_ring == MAP_FAILED || ur->sqes == MAP_FAILED) {
+		if (ur->sq_ring != MAP_FAILED) munmap(ur->sq_ring, ur->sq_ring_bytes);
+		if (ur->cq_ring != MAP_FAILED) munmap(ur->cq_ring, ur->cq_ring_bytes);
+		if (ur->sqes != MAP_FAILED) munmap(ur->sqes, ur->sqes_bytes);
+		close(fd);
+		return false;
+	}
+
+	ur->sq_head = ur->sq_ring + p.sq_off.head;
+	ur->sq_tail = ur->sq_ring + p.sq_off.tail;
+	ur->sq_mask = ur->sq_ring + p.sq_off.ring_mask;
+	ur->sq_array = ur->sq_ring + p.sq_off.array;
+	ur->cq_head = ur->cq_ring + p.cq_off.head;
+	ur->cq_tail = ur->cq_ring + p.cq_off.tail;
+	ur->cq_mask = ur->cq_ring + p.cq_off.ring_mask;
+	ur->cqes = ur->cq_ring + p.cq_off.cqes;
+
+	if (posix_memalign((void**)&ur->bufs, 4096, depth * buf_bytes)) {
+		munmap(ur->sq_ring, ur->sq_ring_bytes);
+		munmap(ur->cq_ring, ur->cq_ring_bytes);
+		munmap(ur->sqes, ur->sqes_bytes);
+		close(fd);
+		return false;
+	}
+
+	// one registered region covering all the buffers; this fails quietly
+	// when it would exceed RLIMIT_MEMLOCK
+	struct iovec iov = {.iov_base = ur->bufs, .iov_len = depth * buf_bytes};
+	ur->fixed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+	return true;
+}
+
+static inline void uring_reader_clear(uring_reader_t *ur) {
+	munmap(ur->sq_ring, ur->sq_ring_bytes);
+	munmap(ur->cq_ring, ur->cq_ring_bytes);
+	munmap(ur->sqes, ur->sqes_bytes);
+	close(ur->ring_fd);
+	free(ur->bufs);
+}
+
+/* Queues a read of len bytes at offset into buffer `slot`; user comes back
+ * with the completion. Nothing is sent to the kernel until uring_reader_wait. */
+static inline void uring_reader_queue(uring_reader_t *ur, int fd, unsigned slot,
+		size_t len, uint64_t offset, uint64_t user)
+{
+	unsigned tail = *ur->sq_tail;
+	unsigned idx = tail & *ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = ur->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)uring_reader_buf(ur, slot);
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->buf_index = 0;
+	sqe->user_data = user;
+	ur->sq_array[idx] = idx;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ur->inflight;
+}
+
+/* Submits everything queued and waits for one read to finish. Returns the
+ * byte count (or -errno) and its user value. */
+static inline int uring_reader_wait(uring_reader_t *ur, uint64_t *user) {
+	unsigned head = *ur->cq_head;
+	while (head == __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+		unsigned to_submit = *ur->sq_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+		syscall(__NR_io_uring_enter, ur->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	}
+	struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+	*user = cqe->user_data;
+	int res = cqe->res;
+	__atomic_store_n(ur->cq_head, head + 1, __ATOMIC_RELEASE);
+	--ur->inflight;
+	return res;
+}
+
+#else // no io_uring
+
+static inline bool uring_reader_init(uring_reader_t *ur, unsigned depth, size_t buf_bytes) {
+	return false;
+}
+static inline void uring_reader_clear(uring_reader_t *ur) {}
+static inline void uring_reader_queue(uring_reader_t *ur, int fd, unsigned slot,
+		size_t len, uint64_t offset, uint64_t user) {}
+static inline int uring_reader_wait(uring_reader_t *ur, uint64_t *user) { return -1; }
+
+#endif // POR_HAVE_URING
+
+#endif // LAPOR_URING_READER_H
@@ -0,0 +1,75 @@
+#ifndef LAPOR_ZERO_COPY_H
+#define LAPOR_ZERO_COPY_H
+
+/* Block bytes moved from the data file to a client socket without passing
+ * through user space.
+ *
+ * A retrieval used to fread each block into a buffer and fwrite it into
+ * the socket's stdio buffer, which is two copies through the process for
+ * every byte sent. sendfile has the kernel send straight from the page
+ * cache instead, and it takes its own file offset, so the data stream's
+ * position is left alone. Streams with no descriptor of their own, such as
+ * the logical bytes of a compressed store, still have to be copied.
+ */
+
+#include "integrity.h"
+#include <errno.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+// most bytes asked of one sendfile call
+#define SENDFILE_CHUNK (UINT64_C(1) << 30)
+
+/* Sends len bytes of fd at offset on sock, which may be non-blocking.
+ * Returns how many went, which is short only if sock is full; -1 on an
+ * error, including a file that ends early. */
+static inline int64_t sendfile_some(int sock, int fd, uint64_t offset, uint64_t len) {
+	uint64_t sent = 0;
+	while (sent < len) {
+		off_t pos = offset + sent;
+		size_t want = (len - sent < SENDFILE_CHUNK) ? len - sent : SENDFILE_CHUNK;
+		ssize_t got = sendfile(sock, fd, &pos, want);
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return -1;
+		}
+		if (got == 0) return -1;
+		sent += got;
+	}
+	return sent;
+}
+
+/* Writes all of iov to the blocking socket sock, in as few calls as it
+ * takes; iov is used up in the process. */
+static inline bool writev_all(int sock, struct iovec *iov, int count) {
+	while (count) {
+		ssize_t wrote = writev(sock, iov, (count < IOV_MAX) ? count : IOV_MAX);
+		if (wrote < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		while (count && (size_t)wrote >= iov->iov_len) {
+			wrote -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count) {
+			iov->iov_base = (char*)iov->iov_base + wrote;
+			iov->iov_len -= wrote;
+		}
+	}
+	return true;
+}
+
+/* Holds back partial segments on a TCP socket while on is set, so that a
+ * small header and the file bytes after it leave as full segments; turning
+ * it off sends whatever is left. Other sockets ignore it. */
+static inline void tcp_cork(int sock, bool on) {
+	int val = on;
+	setsockopt(sock, IPPROTO_TCP, TCP_CORK, &val, sizeof val);
+}
+
+#endif // LAPOR_ZERO_COPY_H
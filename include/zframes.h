@@ -0,0 +1,281 @@
+#ifndef LAPOR_ZFRAMES_H
+#define LAPOR_ZFRAMES_H
+
+/* Data files stored as compressed frames of whole matrix rows.
+ *
+ * For compressible data on a disk-bound server, reading a third of the
+ * bytes and decompressing them in memory is faster than reading them all.
+ * A compressed store keeps the logical bytes of the data file in frames of
+ * frame_rows rows each (about ZFRAMES_FRAME_BYTES), every frame compressed
+ * on its own with zlib, so any row can be reached by decompressing just
+ * its frame. The audit scans decompress a frame at a time per thread;
+ * retrievals and the Merkle tree read the logical bytes through a seekable
+ * stdio stream. Secrets, tree and protocol are all over the logical bytes,
+ * so clients cannot tell the difference.
+ *
+ * Layout, all integers in host byte order:
+ *   zframes_header_t
+ *   nframes + 1 file offsets, where frame f is [offset[f], offset[f+1])
+ *   the compressed frames
+ *
+ * The format can be recognised without zlib; reading and writing it need
+ * a build with POR_ZLIB. The stores are read-only: updates need the data
+ * file uncompressed.
+ */
+
+#include "integrity.h"
+#include <fcntl.h>
+
+#define ZFRAMES_MAGIC UINT64_C(0x31465a524f50414c) // "LAPORZF1"
+
+// logical bytes aimed for in each frame
+#define ZFRAMES_FRAME_BYTES (UINT64_C(1) << 20)
+
+typedef struct {
+	uint64_t magic;         // ZFRAMES_MAGIC
+	uint64_t logical_size;  // bytes of the uncompressed data file
+	uint64_t row_bytes;     // bytes per matrix row
+	uint64_t frame_rows;    // rows per frame; the last frame may be short
+	uint64_t nframes;
+} zframes_header_t;
+
+typedef struct {
+	zframes_header_t hdr;
+	uint64_t *index;        // nframes + 1 file offsets
+	uint64_t max_packed;    // largest compressed frame
+} zframes_t;
+
+/* Whether the file open on fd is a compressed store. */
+static inline bool zframes_probe(int fd) {
+	uint64_t magic;
+	return pread(fd, &magic, sizeof magic, 0) == (ssize_t)sizeof magic && magic == ZFRAMES_MAGIC;
+}
+
+static inline uint64_t zframes_frame_bytes(const zframes_t *z) {
+	return z->hdr.frame_rows * z->hdr.row_bytes;
+}
+
+/* Loads the header and frame index of the store open on fd. The header
+ * must describe the rows it claims to hold, and the index must rise from
+ * frame to frame and stay inside the file, or the store is not opened. */
+static inline bool zframes_open(zframes_t *z, int fd) {
+	z->index = NULL;
+	struct stat s;
+	if (fstat(fd, &s) != 0
+			|| pread(fd, &z->hdr, sizeof z->hdr, 0) != (ssize_t)sizeof z->hdr
+			|| z->hdr.magic != ZFRAMES_MAGIC || !z->hdr.frame_rows || !z->hdr.row_bytes
+			|| z->hdr.frame_rows > UINT64_MAX / z->hdr.row_bytes) {
+		return false;
+	}
+	uint64_t file_size = s.st_size;
+	uint64_t frame_bytes = zframes_frame_bytes(z);
+	uint64_t max_frames = (file_size < sizeof z->hdr) ? 0 : (file_size - sizeof z->hdr) / sizeof *z->index;
+	if (z->hdr.nframes != z->hdr.logical_size / frame_bytes + (z->hdr.logical_size % frame_bytes != 0)
+			|| z->hdr.nframes >= max_frames) {
+		return false;
+	}
+	size_t bytes = (z->hdr.nframes + 1) * sizeof *z->index;
+	z->index = (uint64_t*)malloc(bytes);
+	assert (z->index);
+	bool ok = pread(fd, z->index, bytes, sizeof z->hdr) == (ssize_t)bytes
+		&& z->index[0] >= sizeof z->hdr + bytes
+		&& z->index[z->hdr.nframes] <= file_size;
+	z->max_packed = 0;
+	for (uint64_t f = 0; ok && f < z->hdr.nframes; ++f) {
+		if (z->index[f + 1] <= z->index[f]) ok = false;
+		uint64_t packed = z->index[f + 1] - z->index[f];
+		if (packed > z->max_packed) z->max_packed = packed;
+	}
+	if (!ok) {
+		free(z->index);
+		z->index = NULL;
+	}
+	return ok;
+}
+
+static inline void zframes_close(zframes_t *z) {
+	free(z->index);
+	z->index = NULL;
+}
+
+/* Logical bytes in frame f. */
+static inline uint64_t zframes_frame_len(const zframes_t *z, uint64_t f) {
+	uint64_t start = f * zframes_frame_bytes(z);
+	uint64_t len = z->hdr.logical_size - start;
+	return (len < zframes_frame_bytes(z)) ? len : zframes_frame_bytes(z);
+}
+
+#ifdef POR_ZLIB
+#include <zlib.h>
+#include <omp.h>
+
+/* Decompresses frame f into out, which holds zframes_frame_bytes, zero
+ * padding a short last frame; packed is scratch of max_packed bytes. */
+static inline bool zframes_read_frame(const zframes_t *z, int fd, uint64_t f,
+		void *packed, void *out)
+{
+	uint64_t plen = z->index[f + 1] - z->index[f];
+	if (pread(fd, packed, plen, z->index[f]) != (ssize_t)plen) return false;
+	uLongf len = zframes_frame_bytes(z);
+	if (uncompress((Bytef*)out, &len, (const Bytef*)packed, plen) != Z_OK
+			|| len != zframes_frame_len(z, f)) {
+		return false;
+	}
+	memset((char*)out + len, 0, zframes_frame_bytes(z) - len);
+	return true;
+}
+
+/* Writes the file at in_path to out_path as a compressed store of rows of
+ * row_bytes, compressing a batch of frames in parallel at a time. */
+static inline bool zframes_write(const char *in_path, const char *out_path,
+		uint64_t row_bytes, int level)
+{
+	int in = open(in_path, O_RDONLY);
+	if (in < 0) return false;
+	struct stat s;
+	if (fstat(in, &s) != 0) {
+		close(in);
+		return false;
+	}
+	FILE *out = fopen(out_path, "w");
+	if (!out) {
+		close(in);
+		return false;
+	}
+
+	zframes_t z;
+	z.hdr.magic = ZFRAMES_MAGIC;
+	z.hdr.logical_size = s.st_size;
+	z.hdr.row_bytes = row_bytes;
+	z.hdr.frame_rows = (ZFRAMES_FRAME_BYTES > row_bytes) ? ZFRAMES_FRAME_BYTES / row_bytes : 1;
+	z.hdr.nframes = (z.hdr.logical_size + zframes_frame_bytes(&z) - 1) / zframes_frame_bytes(&z);
+	z.index = (uint64_t*)calloc(z.hdr.nframes + 1, sizeof *z.index);
+	assert (z.index);
+	fwrite(&z.hdr, sizeof z.hdr, 1, out);
+	fwrite(z.index, sizeof *z.index, z.hdr.nframes + 1, out);
+	z.index[0] = sizeof z.hdr + (z.hdr.nframes + 1) * sizeof *z.index;
+
+	int batch = 4 * omp_get_max_threads();
+	uint64_t frame_bytes = zframes_frame_bytes(&z);
+	uLong bound = compressBound(frame_bytes);
+	char *raw = (char*)malloc(batch * frame_bytes);
+	char *packed = (char*)malloc(batch * bound);
+	uLongf *plen = (uLongf*)malloc(batch * sizeof *plen);
+	assert (raw && packed && plen);
+	bool ok = true;
+
+	for (uint64_t first = 0; first < z.hdr.nframes && ok; first += batch) {
+		int count = (z.hdr.nframes - first < (uint64_t)batch) ? z.hdr.nframes - first : batch;
+#pragma omp parallel for schedule(dynamic, 1) reduction(&&:ok)
+		for (int b = 0; b < count; ++b) {
+			uint64_t len = zframes_frame_len(&z, first + b);
+			my_pread(in, raw + b * frame_bytes, len, (first + b) * frame_bytes);
+			plen[b] = bound;
+			ok = compress2((Bytef*)packed + b * bound, &plen[b],
+					(const Bytef*)raw + b * frame_bytes, len, level) == Z_OK;
+		}
+		for (int b = 0; b < count && ok; ++b) {
+			ok = fwrite(packed + b * bound, 1, plen[b], out) == plen[b];
+			z.index[first + b + 1] = z.index[first + b] + plen[b];
+		}
+	}
+
+	free(raw);
+	free(packed);
+	free(plen);
+	close(in);
+	if (ok) {
+		fseek(out, sizeof z.hdr, SEEK_SET);
+		ok = fwrite(z.index, sizeof *z.index, z.hdr.nframes + 1, out) == z.hdr.nframes + 1;
+	}
+	zframes_close(&z);
+	return fclose(out) == 0 && ok;
+}
+
+/* A stdio stream over the logical bytes of a store, for the code that
+ * reads the data file with fseek and fread. */
+typedef struct {
+	zframes_t z;
+	int fd;
+	uint64_t pos;
+	uint64_t cached;        // frame in buf, or UINT64_MAX
+	char *buf, *packed;
+} zframes_stream_t;
+
+static inline ssize_t zframes_stream_read(void *cookie, char *dest, size_t size) {
+	zframes_stream_t *st = (zframes_stream_t*)cookie;
+	size_t done = 0;
+	while (done < size && st->pos < st->z.hdr.logical_size) {
+		uint64_t f = st->pos / zframes_frame_bytes(&st->z);
+		if (f != st->cached) {
+			if (!zframes_read_frame(&st->z, st->fd, f, st->packed, st->buf)) return -1;
+			st->cached = f;
+		}
+		uint64_t off = st->pos - f * zframes_frame_bytes(&st->z);
+		uint64_t len = zframes_frame_len(&st->z, f) - off;
+		if (len > size - done) len = size - done;
+		memcpy(dest + done, st->buf + off, len);
+		done += len;
+		st->pos += len;
+	}
+	return done;
+}
+
+static inline int zframes_stream_seek(void *cookie, off64_t *offset, int whence) {
+	zframes_stream_t *st = (zframes_stream_t*)cookie;
+	int64_t base = (whence == SEEK_SET) ? 0
+		: (whence == SEEK_CUR) ? (int64_t)st->pos : (int64_t)st->z.hdr.logical_size;
+	if (base + *offset < 0) return -1;
+	st->pos = base + *offset;
+	*offset = st->pos;
+	return 0;
+}
+
+static inline int zframes_stream_close(void *cookie) {
+	zframes_stream_t *st = (zframes_stream_t*)cookie;
+	close(st->fd);
+	zframes_close(&st->z);
+	free(st->buf);
+	free(st->packed);
+	free(st);
+	return 0;
+}
+
+/* Opens the logical bytes of the store at path, to be read with
+ * zframes_stream_pread and let go with zframes_stream_close. */
+static inline zframes_stream_t* zframes_stream_open(const char *path) {
+	zframes_stream_t *st = (zframes_stream_t*)calloc(1, sizeof *st);
+	assert (st);
+	st->fd = open(path, O_RDONLY);
+	if (st->fd < 0 || !zframes_open(&st->z, st->fd)) {
+		if (st->fd >= 0) close(st->fd);
+		free(st);
+		return NULL;
+	}
+	st->cached = UINT64_MAX;
+	st->buf = (char*)malloc(zframes_frame_bytes(&st->z));
+	st->packed = (char*)malloc(st->z.max_packed ? st->z.max_packed : 1);
+	assert (st->buf && st->packed);
+	return st;
+}
+
+/* Reads up to size logical bytes at offset, like pread; returns how many
+ * were read, which is fewer only at the end, or -1. */
+static inline ssize_t zframes_stream_pread(zframes_stream_t *st, void *dest, size_t size, uint64_t offset) {
+	st->pos = offset;
+	return zframes_stream_read(st, (char*)dest, size);
+}
+
+/* Opens a read-only stream of the logical bytes of the store at path. */
+static inline FILE* zframes_fopen(const char *path) {
+	zframes_stream_t *st = zframes_stream_open(path);
+	if (!st) return NULL;
+	cookie_io_functions_t io = {zframes_stream_read, NULL, zframes_stream_seek, zframes_stream_close};
+	FILE *f = fopencookie(st, "r", io);
+	if (!f) zframes_stream_close(st);
+	return f;
+}
+
+#endif // POR_ZLIB
+
+#endif // LAPOR_ZFRAMES_H
@@ -103,6 +103,18 @@ void print_hash(const char *before, const digest_t hash, const char *after,
 void hash_leaf(digest_t dest, const char *restrict block, uint32_t bsize,
     const store_info_t *info, EVP_MD_CTX *ctx);
 
+/* hash_leaf over a block that is not contiguous in memory: start, then
+ * update with each piece in order, then finish. */
+void hash_leaf_start(const store_info_t *info, EVP_MD_CTX *ctx);
+
+void hash_leaf_update(const char *restrict piece, uint32_t len, EVP_MD_CTX *ctx);
+
+void hash_leaf_finish(digest_t dest, EVP_MD_CTX *ctx);
+
+/* index of the leaf hash of the given block among the hashes init_root
+ * writes, not counting the metadata block */
+uint64_t leaf_hash_index(uint64_t nblocks, uint64_t block);
+
 void hash_internal(digest_t dest, const digest_t child1, const digest_t child2,
     const store_info_t *info, EVP_MD_CTX *ctx);
 
@@ -112,6 +124,14 @@ void hash_internal(digest_t dest, const digest_t child1, const digest_t child2,
  */
 void init_root(FILE *in, FILE *out, store_info_t *info, work_space_t *space);
 
+/* writes to indices, from next_ind on, the indices of the hashes needed to
+ * verify block_count blocks from block_offset in a tree of nblocks leaves,
+ * in the order post_read takes them; returns the next free position.
+ * At the top level pass index_offset and next_ind as 0. */
+uint32_t hash_indices_for_range(
+    uint64_t nblocks, uint64_t block_offset, uint64_t block_count,
+    uint64_t index_offset, uint64_t *indices, uint32_t next_ind);
+
 void pre_read(read_req_t *rreq, char *buf, uint32_t count, uint64_t offset,
     const store_info_t *info, work_space_t *space);
 
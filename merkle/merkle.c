@@ -210,6 +210,23 @@ void hash_leaf(digest_t dest, const char *restrict block, uint32_t bsize,
     EMSG("DigestFinal leaf");
 }
 
+void hash_leaf_start(const store_info_t *info, EVP_MD_CTX *ctx) {
+  if (!EVP_DigestInit(ctx, info->md_alg))
+    EMSG("DigestInit");
+  if (!EVP_DigestUpdate(ctx, &LEAF_PREFIX, sizeof LEAF_PREFIX))
+    EMSG("DigestUpdate leaf prefix");
+}
+
+void hash_leaf_update(const char *restrict piece, uint32_t len, EVP_MD_CTX *ctx) {
+  if (!EVP_DigestUpdate(ctx, piece, len))
+    EMSG("DigestUpdate leaf block");
+}
+
+void hash_leaf_finish(digest_t dest, EVP_MD_CTX *ctx) {
+  if (!EVP_DigestFinal_ex(ctx, dest, NULL))
+    EMSG("DigestFinal leaf");
+}
+
 void hash_internal(digest_t dest, const digest_t child1, const digest_t child2,
     const store_info_t *info, EVP_MD_CTX *ctx)
 {
@@ -317,6 +334,23 @@ uint32_t hash_indices_for_range(
       index_offset + 2*pow2 - 1, indices, next_ind);
 }
 
+/* The tree is written in post-order. The siblings on the path to a leaf,
+ * which hash_indices_for_range gives for its block, are in order, and the
+ * ones left of it hold the block leaves before it, a subtree of k leaves
+ * in 2k - 1 hashes; so if nleft of them come first, the leaf comes at
+ * 2*block - nleft, right after the last of them. */
+uint64_t leaf_hash_index(uint64_t nblocks, uint64_t block) {
+  uint64_t siblings[64];
+  uint32_t count, nleft;
+
+  assert (block < nblocks);
+  count = hash_indices_for_range(nblocks, block, 1, 0, siblings, 0);
+  nleft = 0;
+  while (nleft < count && siblings[nleft] < 2*block - nleft)
+    ++nleft;
+  return 2*block - nleft;
+}
+
 /* Fills in rreq in order to read count bytes at the given offset into buf. */
 void pre_read(read_req_t *rreq, char *buf, uint32_t count, uint64_t offset,
     const store_info_t *info, work_space_t *space)
@@ -12,6 +12,7 @@ static bool randomDB(true);
 static bool runServer(true);
 static bool runPublic(true);
 static std::string DATABASEF_NAME("/tmp/ffmat.bin");
+static std::string READER_NAME(ROW_READER_NAMES[row_reader_default()]);
 static Argument as[] = {
     { 'm', "-m M", "Set the row dimension of the matrix.",  TYPE_INT , &m },
     { 'k', "-k K", "Set the col dimension of the matrix.",  TYPE_INT , &k },
@@ -23,9 +24,21 @@ static Argument as[] = {
     { 'p', "-p Y/N", "Run public part.",		TYPE_BOOL , &runPublic },
     { 'b', "-b bits", "Size of the field.",		TYPE_INT , &bits },
     { 'q', "-q string", "Prime order.",		TYPE_STR , &primeorder },
+    { 'g', "-g name", "Row reader: pread, mmap, mmap-populate, pinned or direct.",		TYPE_STR , &READER_NAME },
     END_OF_ARGUMENTS
 };
 
+    // the row reader chosen with -g, or the build's default if unknown
+row_backend_t readerBackend() {
+    int b = row_reader_lookup(READER_NAME.c_str());
+    if (b < 0) {
+        std::cerr << "Unknown row reader " << READER_NAME << ", using "
+                  << ROW_READER_NAMES[row_reader_default()] << std::endl;
+        return row_reader_default();
+    }
+    return static_cast<row_backend_t>(b);
+}
+
 
 
     //=========================================
@@ -66,7 +79,8 @@ bool Protocol(double& timeinit, double& timeaudit, double& timeserver,
             if (runServer) {
                     // Creating the control vector with the database
                 LeftVectorMatrixbyDotProducts(F, m, k, uu, vv,
-                                              DATABASEF_NAME.c_str());
+                                              DATABASEF_NAME.c_str(),
+                                              readerBackend());
 #ifdef _LAPOR_DETAILED_COMMENTS_
         std::clog << "[SETUP] [CLIENT] v^T=u^T M done. " << std::endl;
 #endif
@@ -147,7 +161,8 @@ bool Protocol(double& timeinit, double& timeaudit, double& timeserver,
         if (runServer) {
                 // Server is computing the matrix-vector product row by row
             MatrixVectorRightbyDotProducts(F, m, k, xx, yy,
-                                           DATABASEF_NAME.c_str());
+                                           DATABASEF_NAME.c_str(),
+                                           readerBackend());
         } else {
                 // ... or just a simulation
             FFLAS::fassign(F, std::min(m,k), xx, 1, yy, 1);
@@ -341,14 +341,12 @@ Givaro::Integer fdot(const Givaro::Modular<Givaro::Integer>& F, const size_t N,
 #include <unistd.h>
 #include <omp.h>
 
-#ifdef POR_MMAP
-#include <sys/mman.h>
-#endif
 extern "C" {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
 #pragma GCC diagnostic ignored "-Wpointer-arith"
 #include <integrity.h>
+#include <row_reader.h>
 #pragma GCC diagnostic pop
 }
 
@@ -357,36 +355,27 @@ typename Field::Element_ptr&
 MatrixVectorRightbyDotProducts(const Field& F, size_t m, size_t k,
                                typename Field::ConstElement_ptr B,
                                typename Field::Element_ptr& C,
-                               const char * filename = DATAF_NAME) {
+                               const char * filename = DATAF_NAME,
+                               row_backend_t backend = row_reader_default()) {
 
     const size_t N(k<<5); // 32 bytes in per element
 
+    row_source_t src;
+    bool opened = row_source_open(&src, filename, N, backend);
+    assert (opened);
+
 #pragma omp parallel
     {
-        int fd = open(filename, O_RDONLY);
-        assert (fd >= 0);
-#ifdef POR_MMAP
-        std::clog << "[ROWDP] MMAP, " << omp_get_num_threads() << " threads, on: " << omp_get_thread_num() << ".\n";
-        void* fdmap = mmap(NULL, m*N, PROT_READ, MAP_PRIVATE, fd, 0);
-        assert (fdmap != MAP_FAILED);
-        uint8_t const* udmap = reinterpret_cast<uint8_t const*>(fdmap);
-        close(fd);
-#else // no MMAP
-        std::clog << "[ROWDP] PREAD, " << omp_get_num_threads() << " threads, on: " << omp_get_thread_num() << ".\n";
-        uint64_t *data_in_64s = reinterpret_cast<uint64_t*>(malloc(N));
-        assert (data_in_64s);
-#endif // POR_MMAP
+        std::clog << "[ROWDP] " << ROW_READER_NAMES[src.backend] << ", " << omp_get_num_threads() << " threads, on: " << omp_get_thread_num() << ".\n";
+        row_reader_t rr;
+        row_reader_init(&rr, &src);
 
         typename Field::Element_ptr A;
         AllocateRaw256(F, k, A);
 
 #pragma omp for schedule(static) nowait
         for(size_t i=0; i<m; ++i) {
-#ifdef POR_MMAP
-            uint64_t const* data_in_64s = reinterpret_cast<uint64_t const*>(udmap + (N*i));
-#else // no MMAP
-            my_pread(fd, data_in_64s, N, N*i);
-#endif // POR_MMAP
+            uint64_t const* data_in_64s = row_reader_get(&rr, i);
             for(size_t j=0; j<k; ++j) {
                 scalar2Integer(A[j],
                                data_in_64s[4*j+0],
@@ -399,13 +388,10 @@ MatrixVectorRightbyDotProducts(const Field& F, size_t m, size_t k,
         }
 
         FFLAS::fflas_delete(A);
-#ifdef POR_MMAP
-        munmap(fdmap, m*N);
-#else // no MMAP
-        free(data_in_64s);
-#endif // POR_MMAP
+        row_reader_clear(&rr);
 
     }
+    row_source_close(&src);
     return C;
 }
 
@@ -416,22 +402,16 @@ LeftVectorMatrixbyDotProducts(const Field& F,
                               size_t m, size_t k,
                               typename Field::ConstElement_ptr B,
                               typename Field::Element_ptr& C,
-                              const char * filename = DATAF_NAME) {
+                              const char * filename = DATAF_NAME,
+                              row_backend_t backend = row_reader_default()) {
 
     const size_t N(k<<5); // 32 bytes in per element
-#ifdef _LAPOR_MMAP_
-    std::clog << "[LEFTDP] MMAP.\n";
-    int fd = open(filename, O_RDONLY);
-    assert (fd >= 0);
-    void* fdmap = mmap(NULL, m*N, PROT_READ, MAP_PRIVATE, fd, 0);
-    assert (fdmap != MAP_FAILED);
-    uint8_t const* udmap = reinterpret_cast<uint8_t const*>(fdmap);
-    close(fd);
-#else
-    std::clog << "[LEFTDP] FREAD.\n";
-    FILE* dataf = fopen(filename, "r");
-    unsigned char* data_buf = reinterpret_cast<unsigned char*>( calloc(N, 1) );
-#endif
+    row_source_t src;
+    bool opened = row_source_open(&src, filename, N, backend);
+    assert (opened);
+    std::clog << "[LEFTDP] " << ROW_READER_NAMES[src.backend] << ".\n";
+    row_reader_t rr;
+    row_reader_init(&rr, &src);
 
     Givaro::ZRing<Givaro::Integer> ZZ;
 
@@ -439,12 +419,7 @@ LeftVectorMatrixbyDotProducts(const Field& F,
     AllocateRaw256(F, k, A);
 
     for (size_t i=0; i<m; i++){
-#ifdef _LAPOR_MMAP_
-        uint64_t const* data_in_64s = reinterpret_cast<uint64_t const*>(udmap + (N*i));
-#else
-        fread(data_buf, 1, N, dataf);
-        uint64_t const* data_in_64s = reinterpret_cast<uint64_t const*>(data_buf);
-#endif
+        uint64_t const* data_in_64s = row_reader_get(&rr, i);
         for(size_t j=0; j<k; ++j) {
             scalar2Integer(A[j],
                            data_in_64s[4*j+0],
@@ -458,13 +433,8 @@ LeftVectorMatrixbyDotProducts(const Field& F,
     }
 
     FFLAS::fflas_delete(A);
-
-#ifdef _LAPOR_MMAP_
-    munmap(fdmap, m*N);
-#else
-    fclose(dataf);
-    free(data_buf);
-#endif
+    row_reader_clear(&rr);
+    row_source_close(&src);
 
     FFLAS::freduce(F,k,C,1);
     return C;
@@ -7,14 +7,33 @@
 #include <sys/random.h>
 #include <getopt.h>
 #include <integrity.h>
+#include <p57.h>
+#include <audit_proto.h>
+#include <challenge_prg.h>
+#include <bands.h>
+#include <frame.h>
+#include <proof.h>
 
 #define MAX(a,b) ((a) < (b) ? (b) : (a))
 
+// requests a framed client keeps in flight at once
+#define FRAME_WINDOW (32)
+// a request with more payload than this first waits for every response,
+// so that neither side can block sending while the other does too
+#define FRAME_DRAIN_BYTES (1 << 16)
+
 void usage(const char* arg0) {
 	fprintf(stderr, "usage: %s [OPTIONS] [<config_file>] [<merkle_config_file>]\n"
 			"	-s --serverIP		IP address of the cloud server; defaults to 'localhost'\n"
 			"	-p --port			port over which to connect with cloud server; defaults to 2020\n"
 			"	-a --audit		run an audit (non-interatively)\n"
+			"	-k --challenges <k>	number of challenge vectors per audit; defaults to 1\n"
+			"	-z --seeded		send challenge seeds instead of full vectors (no ACK round trip)\n"
+			"	-t --stream		have responses streamed and check them as they arrive\n"
+			"	-b --bands <list>	audit only these bands, e.g. 0,4-7 (needs a config from dual_init -b)\n"
+			"	-f --framed		send many requests over one connection, pipelined; they are\n"
+			"				read from stdin, one per line: 'a' to audit, 'r <count> <offset>'\n"
+			"				to read, 'u <offset> <text>' to write <text> at <offset>\n"
 			"	-v --verbose		verbose mode\n"
 			"	-h --help			show this help menu\n"
 			, arg0);
@@ -22,9 +41,22 @@ void usage(const char* arg0) {
 
 void my_fread(void* ptr, size_t size, size_t nmemb, FILE* stream);
 void my_fwrite(void* ptr, size_t size, size_t nmemb, FILE* stream);
+uint64_t makeSeed(void);
 uint64_t* makeChallengeVector(uint64_t size); 
-int runAudit(FILE* fconfig, uint64_t* challenge1,
-				uint64_t* response1, uint64_t n, uint64_t m);
+uint32_t loadBands(FILE* fconfig, const char* list, uint64_t n, uint64_t m,
+				audit_range_t** ranges, uint64_t* secret);
+int runAudit(FILE* fconfig, uint64_t* challenges,
+				uint64_t* responses, uint32_t nchal, uint64_t n, uint64_t m,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret);
+int runStreamAudit(FILE* fconfig, FILE* sock, uint64_t* challenges,
+				uint32_t nchal, uint64_t n, uint64_t m,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret);
+
+int runFramed(FILE* sock, FILE* fconfig, const store_info_t* info, work_space_t* space,
+				uint64_t n, uint64_t m, uint32_t nchal, int seeded, int audit_only,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret);
+void applyUpdate(FILE* fconfig, uint64_t n, uint64_t m, uint64_t first, uint64_t count,
+				const unsigned char* bytes, const uint64_t* old);
 
 bool client_prep_read(read_req_t* rreq, char** buf, uint64_t* bufsize,
     const store_info_t* info, work_space_t* space);
@@ -43,19 +75,29 @@ int main(int argc, char* argv[]) {
 	double comm_time = 0;
 	int trash;
 	int audit = 0;
+	uint32_t nchal = 1;
+	int seeded = 0;
+	int stream = 0;
+	const char* band_list = NULL; /*defaults to the whole matrix*/
+	int framed = 0; /*defaults to off (one request per connection)*/
 
 	// handle command line arguments
 	struct option longopts[] = {
 		{"serverIP", required_argument, NULL, 's'},
 		{"port", required_argument, NULL, 'p'},
 		{"audit", no_argument, NULL, 'a'},
+		{"challenges", required_argument, NULL, 'k'},
+		{"seeded", no_argument, NULL, 'z'},
+		{"stream", no_argument, NULL, 't'},
+		{"bands", required_argument, NULL, 'b'},
+		{"framed", no_argument, NULL, 'f'},
 		{"verbose", no_argument, NULL, 'v'},
 		{"help", no_argument, NULL, 'h'},
 		{NULL, 0, NULL, 0}
 	};
 
 	while (true) {
-		switch (getopt_long(argc, argv, "s:p:avh", longopts, NULL)) {
+		switch (getopt_long(argc, argv, "s:p:ak:ztb:fvh", longopts, NULL)) {
 			case -1:
 				goto done_opts;
 
@@ -78,6 +120,30 @@ int main(int argc, char* argv[]) {
 				audit = 1;
 				break;
 
+			case 'k':
+				nchal = atoi(optarg);
+				if (nchal < 1 || nchal > AUDIT_MAX_CHAL) {
+					fprintf(stderr, "ERROR: number of challenges must be between 1 and %d\n", AUDIT_MAX_CHAL);
+					exit(1);
+				}
+				break;
+
+			case 'z':
+				seeded = 1;
+				break;
+
+			case 't':
+				stream = 1;
+				break;
+
+			case 'b':
+				band_list = optarg;
+				break;
+
+			case 'f':
+				framed = 1;
+				break;
+
 			case 'v':
 				verbose = 1;
 				break;
@@ -146,8 +212,24 @@ done_opts:
 	// convert socket to file
 	FILE* sock = fdopen(sockfd, "r+");
 
+	// rows to audit, and the secret to check them against
+	audit_range_t whole = {.start = 0, .count = m};
+	audit_range_t* ranges = &whole;
+	uint32_t nranges = 1;
+	uint64_t* band_secret = NULL;
+	if (band_list) {
+		band_secret = calloc(n, sizeof *band_secret);
+		nranges = loadBands(fconfig, band_list, n, m, &ranges, band_secret);
+	}
+	uint64_t rows = 0;
+	for (uint32_t r = 0; r < nranges; r++) rows += ranges[r].count;
+
 	char op;
-	if (audit) {
+	int audit_only = audit; /*the audit case below has its own 'audit'*/
+	if (framed) {
+		op = FRAME_PROTO_OP;
+	}
+	else if (audit) {
 		op = '1';
 	}
 	else {
@@ -164,51 +246,109 @@ done_opts:
 	switch(op) {
 		case '1':
 			/* Audit */
-			// send op code to server
-			op = 'A';
-			my_fwrite(&op, 1, 1, sock);
+			// send op code to server, plus the request header if
+			// more than one challenge or seeds are sent
+			if (nchal == 1 && !seeded && !stream && !band_list) {
+				op = AUDIT_OP;
+				my_fwrite(&op, 1, 1, sock);
+			}
+			else {
+				audit_req_t areq = {.nchal = nchal, .flags = 0};
+				if (seeded) areq.flags |= AUDIT_FLAG_SEEDED;
+				if (stream) areq.flags |= AUDIT_FLAG_STREAM;
+				if (band_list) areq.flags |= AUDIT_FLAG_RANGES;
+				op = AUDIT_EXT_OP;
+				my_fwrite(&op, 1, 1, sock);
+				my_fwrite(&areq, sizeof areq, 1, sock);
+				if (band_list) {
+					audit_ranges_t rhdr = {.nranges = nranges, .reserved = 0};
+					my_fwrite(&rhdr, sizeof rhdr, 1, sock);
+					my_fwrite(ranges, sizeof *ranges, nranges, sock);
+				}
+			}
 			fflush(sock);
 			
-			// create and send challenge vectors (of size n)
+			// create and send challenge vectors (nchal of size n)
 			start_time(&timer);				/* START COMP TIMER */
             start_cpu_time(&cpu_timer);
-			uint64_t* challenge1;
-			uint64_t challengeBytes = n * sizeof(uint64_t);
-			challenge1 = makeChallengeVector(n);
-			client_comp_time = stop_time(&timer);		/* PAUSE COMP TIMER */
-            client_cpu_time = stop_cpu_time(&cpu_timer);
-			start_time(&timer);				/* START COMM TIMER */
-			my_fwrite(challenge1, 1, challengeBytes, sock);
-			fflush(sock);
-
-			// wait for ACK from server
-			char ack = '0';
-			my_fread(&ack, 1, 1, sock);
-			if (ack == '1') comm_time = stop_time(&timer);	/* STOP COMM TIMER */
-			else printf("Did not receive ACK from server after sending challenge.\n");
-			printf("challenge[0] = %"PRIu64"\n", challenge1[0]);
-			printf("challenge[n-1] = %"PRIu64"\n", challenge1[n-1]);
-
-			// read response vectors from server (of size m)
-			uint64_t* response1 = calloc(m, sizeof(uint64_t));
-			uint64_t responseBytes = m * sizeof(uint64_t);
-			my_fread(response1, 1, responseBytes, sock);
-			printf("response[0] = %"PRIu64"\n", response1[0]);
-			printf("response[m-1] = %"PRIu64"\n", response1[m-1]);
-
-			// send previous comm_time as ack to server
-			my_fwrite(&comm_time, sizeof(comm_time), 1, sock);
-			fflush(sock);
-			fprintf(stderr, "Sent 1-way comm time of %f to server.\n", comm_time);
+			uint64_t* challenges = malloc(nchal * n * sizeof *challenges);
+			uint64_t challengeBytes = nchal * n * sizeof(uint64_t);
+			if (seeded) {
+				// send only the seeds; the server's responses double as the ACK
+				audit_seeds_t sreq = {.prg = CHAL_PRG_TINYMT64, .reserved = 0};
+				uint64_t seeds[nchal];
+				for (uint32_t j = 0; j < nchal; j++) {
+					seeds[j] = makeSeed();
+				}
+				expand_challenges(sreq.prg, seeds, nchal, n, challenges);
+				client_comp_time = stop_time(&timer);		/* PAUSE COMP TIMER */
+				client_cpu_time = stop_cpu_time(&cpu_timer);
+				start_time(&timer);				/* START COMM TIMER */
+				my_fwrite(&sreq, sizeof sreq, 1, sock);
+				my_fwrite(seeds, sizeof *seeds, nchal, sock);
+				fflush(sock);
+				comm_time = stop_time(&timer);	/* STOP COMM TIMER */
+			}
+			else {
+				for (uint32_t j = 0; j < nchal; j++) {
+					uint64_t* challenge1 = makeChallengeVector(n);
+					memcpy(challenges + j * n, challenge1, n * sizeof *challenge1);
+					free(challenge1);
+				}
+				client_comp_time = stop_time(&timer);		/* PAUSE COMP TIMER */
+				client_cpu_time = stop_cpu_time(&cpu_timer);
+				start_time(&timer);				/* START COMM TIMER */
+				my_fwrite(challenges, 1, challengeBytes, sock);
+				fflush(sock);
 
-			// run audit and report to client
-			// use m for size
-			start_time(&timer);				/* RESUME COMP TIMER */
-            start_cpu_time(&cpu_timer);
-			int audit = runAudit(fconfig, challenge1,
-							response1, n, m);
-			client_comp_time += stop_time(&timer);		/* STOP TIMER */
-            client_cpu_time += stop_cpu_time(&cpu_timer);
+				// wait for ACK from server
+				char ack = '0';
+				my_fread(&ack, 1, 1, sock);
+				if (ack == '1') comm_time = stop_time(&timer);	/* STOP COMM TIMER */
+				else printf("Did not receive ACK from server after sending challenge.\n");
+			}
+			printf("challenge[0] = %"PRIu64"\n", challenges[0]);
+			printf("challenge[n-1] = %"PRIu64"\n", challenges[n-1]);
+
+			int audit;
+			if (stream) {
+				// check the response segments as they arrive; this time
+				// overlaps with the server's computation and the transfer
+				start_time(&timer);				/* RESUME COMP TIMER */
+				start_cpu_time(&cpu_timer);
+				audit = runStreamAudit(fconfig, sock, challenges, nchal, n, m,
+								ranges, nranges, band_secret);
+				client_comp_time += stop_time(&timer);		/* STOP TIMER */
+				client_cpu_time += stop_cpu_time(&cpu_timer);
+
+				// send previous comm_time as ack to server
+				my_fwrite(&comm_time, sizeof(comm_time), 1, sock);
+				fflush(sock);
+				fprintf(stderr, "Sent 1-way comm time of %f to server.\n", comm_time);
+			}
+			else {
+				// read response vectors from server (nchal for each audited row, row by row)
+				uint64_t* responses = calloc(nchal * rows, sizeof(uint64_t));
+				uint64_t responseBytes = nchal * rows * sizeof(uint64_t);
+				my_fread(responses, 1, responseBytes, sock);
+				printf("response[0] = %"PRIu64"\n", responses[0]);
+				printf("response[%"PRIu64"] = %"PRIu64"\n", rows - 1, responses[(rows-1) * nchal]);
+
+				// send previous comm_time as ack to server
+				my_fwrite(&comm_time, sizeof(comm_time), 1, sock);
+				fflush(sock);
+				fprintf(stderr, "Sent 1-way comm time of %f to server.\n", comm_time);
+
+				// run audit and report to client
+				// use m for size
+				start_time(&timer);				/* RESUME COMP TIMER */
+				start_cpu_time(&cpu_timer);
+				audit = runAudit(fconfig, challenges,
+								responses, nchal, n, m, ranges, nranges, band_secret);
+				client_comp_time += stop_time(&timer);		/* STOP TIMER */
+				client_cpu_time += stop_cpu_time(&cpu_timer);
+				free(responses);
+			}
 			printf("Audit has ");
 			printf(audit ? "PASSED!\n" : "FAILED.\n");
 
@@ -216,14 +356,13 @@ done_opts:
 			fprintf(stderr, "***CLIENT COMP TIME: %f***\n***CLIENT CPU  TIME: %f ***\n***CLIENT COMM TIME: %f ***\n", client_comp_time, client_cpu_time, comm_time);
 
 			// clean up
-			free(challenge1);
-			free(response1);
+			free(challenges);
 			break;
 
 		case '2':
 			/*Retrieval*/
 			// send op code to server
-			op = 'R';
+			op = PROOF_READ_OP;
 			my_fwrite(&op, 1, 1, sock);
 			fflush(sock);
 
@@ -232,21 +371,24 @@ done_opts:
 				fprintf(stderr, "Invalid request: Failed.\n");
 			}
 
-			// send info to get hashes
-			my_fwrite(&rreq.nhash,        sizeof(uint32_t),          1, sock);
+			// the server works out the hashes from the range itself
+			my_fwrite(&rreq.offset,       sizeof(uint64_t),          1, sock);
+			my_fwrite(&rreq.count,        sizeof(uint64_t),          1, sock);
 			fflush(sock);
 
-			// get hashes from server
+			// get hashes from server, all in one response
+			proof_reply_t preply;
+			my_fread(&preply, sizeof preply, 1, sock);
+			if (preply.status != PROOF_OK || preply.nhash != rreq.nhash) {
+				fprintf(stderr, "ERROR: server refused the read (status %"PRIu32", %"PRIu32" hashes)\n",
+						preply.status, preply.nhash);
+				free(buf);
+				break;
+			}
 			for (uint32_t i = 0; i < rreq.nhash; i++) {
-				my_fwrite(&rreq.hash_ind[i], sizeof(uint64_t), 1, sock);
 				my_fread(&rreq.hashes[i], sinfo.hash_size, 1, sock);
 			}
 
-			// send info get blocks
-			my_fwrite(&rreq.block_count,  sizeof(uint64_t),          1, sock);
-			my_fwrite(&rreq.block_offset, sizeof(uint64_t),          1, sock);
-			my_fwrite(&rreq.lbsize,       sizeof(uint32_t),          1, sock);
-			fflush(sock);
 			// read back blocks back
 			if (rreq.block_count >= 2) {
 				my_fread(rreq.first_block, sinfo.block_size, 1, sock);
@@ -284,6 +426,10 @@ done_opts:
 			assert(final < n*m);
 			assert(initial <= final);
 
+			// band secrets, if the config has them, change along with secret1
+			uint64_t nbands = band_config_load(fconfig, n, m);
+			fseek(fconfig, 2*sizeof(uint64_t), SEEK_SET);
+
 			// send first and last byte numbers to server
 			my_fwrite(&initial, sizeof(uint64_t), 1, sock);
 			my_fwrite(&final, sizeof(uint64_t), 1, sock);
@@ -297,6 +443,7 @@ done_opts:
 			uint64_t newVectorValue;
 			uint64_t random1;
 			uint64_t secret1;
+			uint64_t delta;
 			long index;
 			unsigned char* oldByte = &newValue; /*initialized only to get rid of warning*/
 			for (uint64_t i = initial; i <= final; i++) {
@@ -351,15 +498,28 @@ done_opts:
 						printf("No update needed.\n");
 						break;
 					}else if (newVectorValue > oldValue) {
-						secret1 = (uint64_t)((secret1 + ((uint128_t)(newVectorValue - oldValue)) * random1) % P57);
+						delta = newVectorValue - oldValue;
 					}else {
-						secret1 = (uint64_t)((secret1 + ((uint128_t)(newVectorValue + P57 - oldValue)) * random1) % P57);
+						delta = newVectorValue + P57 - oldValue;
 					}
+					secret1 = p57_reduce(secret1 + ((uint128_t)delta) * random1);
 
 
 					// update the secret vectors at the affected index
 					fseek(fconfig, index, SEEK_SET);
 					my_fwrite(&secret1, sizeof(uint64_t), 1, fconfig);
+
+					// and the secret of the band holding the affected row
+					if (nbands) {
+						uint64_t band = band_of_row(m, nbands, affectedRandom);
+						uint64_t bandSecret;
+						index = band_secret_offset(n, m, band) + affectedSecret*sizeof(uint64_t);
+						fseek(fconfig, index, SEEK_SET);
+						my_fread(&bandSecret, sizeof(uint64_t), 1, fconfig);
+						bandSecret = p57_reduce(bandSecret + ((uint128_t)delta) * random1);
+						fseek(fconfig, index, SEEK_SET);
+						my_fwrite(&bandSecret, sizeof(uint64_t), 1, fconfig);
+					}
 					fflush(fconfig);
 
 					// rewind the config file to after n,m
@@ -372,12 +532,20 @@ done_opts:
 			printf("Update Completed.\n");
 			break;
 
+		case FRAME_PROTO_OP:
+			/*Any number of requests, pipelined*/
+			runFramed(sock, fconfig, &sinfo, &wspace, n, m, nchal, seeded, audit_only,
+					band_list ? ranges : NULL, nranges, band_secret);
+			break;
+
 		default:
 			fprintf(stderr, "ERROR: Invalid mode given\n");
 	}
 
 
 	// clean up
+	free(band_secret);
+	if (ranges != &whole) free(ranges);
 	fclose(sock);
 	fclose(fconfig);
 	fclose(fmerkleconfig);
@@ -406,8 +574,7 @@ void my_fwrite(void* ptr, size_t size, size_t nmemb, FILE* stream) {
 }
 
 
-uint64_t* makeChallengeVector(uint64_t size) {
-	// seed Tiny Mersenne Twister
+uint64_t makeSeed(void) {
 	uint64_t seed;
 #if __APPLE__
 	if (getentropy(&seed, sizeof seed) == -1) {
@@ -420,6 +587,12 @@ uint64_t* makeChallengeVector(uint64_t size) {
 		exit(7);
 	}
 #endif
+	return seed;
+}
+
+uint64_t* makeChallengeVector(uint64_t size) {
+	// seed Tiny Mersenne Twister
+	uint64_t seed = makeSeed();
 	tinymt64_t state = {0};
 	tinymt64_init(&state, seed);
 
@@ -433,47 +606,524 @@ uint64_t* makeChallengeVector(uint64_t size) {
 }
 
 
-int runAudit(FILE* fconfig, uint64_t* challenge1,
-				uint64_t* response1, uint64_t n, uint64_t m) {
-	uint128_t rxr1 = 0;
-	uint128_t sxc1 = 0;
+/* Reads the band secrets from the client config and turns the band list
+ * (such as "0,4-7") into row ranges, merging adjacent bands. The selected
+ * band secrets are summed into secret, which holds n words. Returns the
+ * number of ranges and leaves fconfig just after n and m.
+ */
+uint32_t loadBands(FILE* fconfig, const char* list, uint64_t n, uint64_t m,
+				audit_range_t** ranges, uint64_t* secret) {
+	uint64_t nbands = band_config_load(fconfig, n, m);
+	if (!nbands) {
+		fprintf(stderr, "ERROR: config has no band secrets; rerun dual_init with -b\n");
+		exit(8);
+	}
+
+	char* selected = calloc(nbands, 1);
+	const char* pos = list;
+	while (*pos) {
+		char* end;
+		uint64_t lo = strtoull(pos, &end, 10);
+		uint64_t hi = lo;
+		if (end == pos) break;
+		if (*end == '-') hi = strtoull(end + 1, &end, 10);
+		if (lo > hi || hi >= nbands) {
+			fprintf(stderr, "ERROR: bands must be between 0 and %"PRIu64"\n", nbands - 1);
+			exit(8);
+		}
+		for (uint64_t b = lo; b <= hi; b++) selected[b] = 1;
+		pos = (*end == ',') ? end + 1 : end;
+	}
+	if (*pos) {
+		fprintf(stderr, "ERROR: cannot parse band list <%s>\n", list);
+		exit(8);
+	}
+
+	uint64_t* band1 = malloc(n * sizeof *band1);
+	uint32_t nranges = 0;
+	*ranges = malloc(nbands * sizeof **ranges);
+	for (uint64_t b = 0; b < nbands; b++) {
+		if (!selected[b]) continue;
+		uint64_t start = band_start(m, nbands, b);
+		uint64_t stop = band_start(m, nbands, b + 1);
+		if (nranges && (*ranges)[nranges-1].start + (*ranges)[nranges-1].count == start) {
+			(*ranges)[nranges-1].count += stop - start;
+		}
+		else {
+			(*ranges)[nranges].start = start;
+			(*ranges)[nranges].count = stop - start;
+			nranges++;
+		}
+
+		fseek(fconfig, band_secret_offset(n, m, b), SEEK_SET);
+		my_fread(band1, sizeof *band1, n, fconfig);
+		for (uint64_t k = 0; k < n; k++) {
+			secret[k] = p57_add(secret[k], p57_reduce64(band1[k]));
+		}
+	}
+	if (nranges == 0 || nranges > AUDIT_MAX_RANGES) {
+		fprintf(stderr, "ERROR: band list <%s> gives %"PRIu32" row ranges\n", list, nranges);
+		exit(8);
+	}
+	fprintf(stderr, "Auditing bands <%s> of %"PRIu64": %"PRIu32" row ranges\n", list, nbands, nranges);
+
+	free(selected);
+	free(band1);
+	fseek(fconfig, 2*sizeof(uint64_t), SEEK_SET);
+	return nranges;
+}
+
 
-	// compute dot products:
+int runAudit(FILE* fconfig, uint64_t* challenges,
+				uint64_t* responses, uint32_t nchal, uint64_t n, uint64_t m,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret) {
+	// compute dot products for each challenge:
 	// random dot response & secret dot challenge.
 	// config file read through once
-	// doing modulo calc for each mul,
-	// doing one modulo after all addition at end.
-	size_t accum_count = 0;
+	// folding lazily, with one full reduction at the end.
+	// for a partial audit, only the audited rows' randoms are used and the
+	// secret is the sum of the audited bands' secrets
+	uint64_t *random1 = malloc(m * sizeof *random1);
+	uint64_t *secret1 = malloc(n * sizeof *secret1);
+	my_fread(random1, sizeof *random1, m, fconfig);
+	my_fread(secret1, sizeof *secret1, n, fconfig);
+	if (band_secret) memcpy(secret1, band_secret, n * sizeof *secret1);
+
+	uint64_t rows = 0;
+	for (uint32_t r = 0; r < nranges; r++) {
+		memmove(random1 + rows, random1 + ranges[r].start, ranges[r].count * sizeof *random1);
+		rows += ranges[r].count;
+	}
+	uint64_t *response1 = malloc(rows * sizeof *response1);
+
+	// check each for equal and return result
+	// 1 if all pass
+	// 0 if any fail
+	int passed = 1;
+	for (uint32_t j = 0; j < nchal; j++) {
+		// the responses come from the server, so reduce them before
+		// trusting them to stay within the lazy accumulation bound
+		for (size_t i = 0; i < rows; i++) {
+			response1[i] = p57_reduce64(responses[i * nchal + j]);
+		}
+		uint64_t rxr1 = p57_dot(random1, response1, rows); /*random1 dot response (rows)*/
+		uint64_t sxc1 = p57_dot(secret1, challenges + j * n, n); /*secret1 dot challenge (n)*/
+
+		printf("rxr%"PRIu32" = %"PRIu64"\n", j + 1, rxr1);
+		printf("sxc%"PRIu32" = %"PRIu64"\n", j + 1, sxc1);
+		if (rxr1 != sxc1) {
+			printf("Challenge %"PRIu32" of %"PRIu32" FAILED.\n", j + 1, nchal);
+			passed = 0;
+		}
+	}
+
+	free(random1);
+	free(secret1);
+	free(response1);
+	return passed;
+}
+
+
+/* Like runAudit, but reads the responses from sock as streamed segments and
+ * folds each one into r dot y as it arrives. Every audited row must be
+ * covered by exactly one segment; failed segments are reported with their
+ * row range.
+ */
+int runStreamAudit(FILE* fconfig, FILE* sock, uint64_t* challenges,
+				uint32_t nchal, uint64_t n, uint64_t m,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret) {
+	uint64_t *random1 = malloc(m * sizeof *random1);
+	uint64_t *secret1 = malloc(n * sizeof *secret1);
+	my_fread(random1, sizeof *random1, m, fconfig);
+	my_fread(secret1, sizeof *secret1, n, fconfig);
+	if (band_secret) memcpy(secret1, band_secret, n * sizeof *secret1);
+
+	// rows that were not asked for count as already seen
+	char *seen = malloc(m);
+	memset(seen, 1, m);
+	uint64_t rows = 0;
+	for (uint32_t r = 0; r < nranges; r++) {
+		memset(seen + ranges[r].start, 0, ranges[r].count);
+		rows += ranges[r].count;
+	}
 
-	uint64_t *temp = malloc(MAX(m,n) * sizeof *temp);
-	my_fread(temp, sizeof *temp, m, fconfig);
+	uint128_t acc[nchal];
+	memset(acc, 0, sizeof acc);
+	uint64_t since_fold = 0;
+	uint64_t *seg_resp = NULL;
+	uint64_t seg_cap = 0;
+	uint64_t covered = 0, nsegs = 0;
+	int passed = 1;
 
-	for (int i = 0; i < m; i++) { /*random1 dot response1 (m)*/
-		if ((accum_count += 2) > MAX_ACCUM_P) {
-			rxr1 %= P57;
-			accum_count = 2;
+	while (true) {
+		audit_seg_t seg;
+		my_fread(&seg, sizeof seg, 1, sock);
+		if (seg.status == AUDIT_SEG_END) break;
+
+		if (seg.start > m || seg.count > m - seg.start) {
+			printf("Server sent an invalid segment of rows [%"PRIu64", +%"PRIu64").\n", seg.start, seg.count);
+			passed = 0;
+			break;
+		}
+		if (seg.status != AUDIT_SEG_OK) {
+			printf("Server could not compute rows [%"PRIu64", %"PRIu64") (status %"PRIu32").\n",
+					seg.start, seg.start + seg.count, seg.status);
+			passed = 0;
+			continue;
+		}
+
+		if (seg.count * nchal > seg_cap) {
+			seg_cap = seg.count * nchal;
+			seg_resp = realloc(seg_resp, seg_cap * sizeof *seg_resp);
+		}
+		my_fread(seg_resp, sizeof *seg_resp, seg.count * nchal, sock);
+		++nsegs;
+
+		for (uint64_t t = 0; t < seg.count; ++t) {
+			uint64_t i = seg.start + t;
+			if (seen[i]++) {
+				printf("Row %"PRIu64" was sent more than once, or not asked for.\n", i);
+				passed = 0;
+			}
+			// fold before another product could overflow the accumulators
+			if (++since_fold > P57_LAZY_TERMS(P57_FULL_PRODUCT_BITS)) {
+				for (uint32_t j = 0; j < nchal; j++) acc[j] = p57_fold(acc[j]);
+				since_fold = 1;
+			}
+			for (uint32_t j = 0; j < nchal; j++) {
+				acc[j] += (uint128_t)random1[i] * p57_reduce64(seg_resp[t * nchal + j]);
+			}
+		}
+		covered += seg.count;
+	}
+	fprintf(stderr, "Received %"PRIu64" rows in %"PRIu64" segments.\n", covered, nsegs);
+
+	if (covered != rows) {
+		printf("Responses cover %"PRIu64" of %"PRIu64" rows.\n", covered, rows);
+		passed = 0;
+	}
+	for (uint32_t j = 0; j < nchal; j++) {
+		uint64_t rxr1 = p57_reduce(acc[j]); /*random1 dot response (m)*/
+		uint64_t sxc1 = p57_dot(secret1, challenges + j * n, n); /*secret1 dot challenge (n)*/
+
+		printf("rxr%"PRIu32" = %"PRIu64"\n", j + 1, rxr1);
+		printf("sxc%"PRIu32" = %"PRIu64"\n", j + 1, sxc1);
+		if (rxr1 != sxc1) {
+			printf("Challenge %"PRIu32" of %"PRIu32" FAILED.\n", j + 1, nchal);
+			passed = 0;
+		}
+	}
+
+	free(random1);
+	free(secret1);
+	free(seen);
+	free(seg_resp);
+	return passed;
+}
+
+
+/* A request of a framed connection that has not been answered yet. */
+typedef struct {
+	uint8_t op;             // 0 when the slot is free
+	uint64_t id;
+	uint64_t count;         // bytes read or written
+	uint64_t offset;        // where they start
+	uint64_t* challenges;   // of an audit
+	unsigned char* bytes;   // new bytes of an update
+} pending_t;
+
+/* Checks the response to a framed request against what was asked, and
+ * reports it. Returns whether it passed. */
+static bool framedResponse(const frame_hdr_t* hdr, pending_t* p, FILE* sock, FILE* fconfig,
+				const store_info_t* info, work_space_t* space, char** buf, uint64_t* bufsize,
+				uint64_t n, uint64_t m, uint32_t nchal, uint64_t rows,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret) {
+	if (hdr->status != FRAME_OK) {
+		printf("Request %"PRIu64" failed with status %"PRIu8".\n", p->id, hdr->status);
+		return false;
+	}
+
+	if (p->op == FRAME_READ) {
+		read_req_t rreq;
+		memset(&rreq, 0, sizeof rreq);
+		pre_read(&rreq, *buf, p->count, p->offset, info, space);
+		if (hdr->length != proof_bytes(rreq.nhash, rreq.block_count, rreq.lbsize, info)) {
+			fprintf(stderr, "ERROR: response to read %"PRIu64" has %"PRIu64" bytes\n", p->id, hdr->length);
+			exit(9);
+		}
+		for (uint32_t i = 0; i < rreq.nhash; i++) {
+			my_fread(&rreq.hashes[i], info->hash_size, 1, sock);
+		}
+		if (rreq.block_count >= 2) {
+			my_fread(rreq.first_block, info->block_size, 1, sock);
+		}
+		if (rreq.block_count >= 3) {
+			my_fread(rreq.middle_blocks, info->block_size, rreq.block_count - 2, sock);
+		}
+		if (rreq.block_count >= 1) {
+			my_fread(rreq.last_block, rreq.lbsize, 1, sock);
+		}
+		printf("Read %"PRIu64": ", p->id);
+		return client_post_read(&rreq, info, space);
+	}
+
+	if (p->op == FRAME_UPDATE) {
+		uint64_t chunks = frame_update_chunks(p->offset, p->count);
+		if (hdr->length != chunks * sizeof(uint64_t)) {
+			fprintf(stderr, "ERROR: response to update %"PRIu64" has %"PRIu64" bytes\n", p->id, hdr->length);
+			exit(9);
+		}
+		uint64_t* old = malloc(chunks * sizeof *old);
+		my_fread(old, sizeof *old, chunks, sock);
+		applyUpdate(fconfig, n, m, p->offset, p->count, p->bytes, old);
+		printf("Update %"PRIu64" of "_CHUNK_SPECIFIER" bytes at "_CHUNK_SPECIFIER" completed.\n",
+				p->id, p->count, p->offset);
+		free(old);
+		return true;
+	}
+
+	if (hdr->length != nchal * rows * sizeof(uint64_t)) {
+		fprintf(stderr, "ERROR: response to audit %"PRIu64" has %"PRIu64" bytes\n", p->id, hdr->length);
+		exit(9);
+	}
+	uint64_t* responses = malloc(nchal * rows * sizeof *responses);
+	my_fread(responses, sizeof *responses, nchal * rows, sock);
+	fseek(fconfig, 2*sizeof(uint64_t), SEEK_SET);
+	int audit = runAudit(fconfig, p->challenges, responses, nchal, n, m, ranges, nranges, band_secret);
+	printf("Audit %"PRIu64" has ", p->id);
+	printf(audit ? "PASSED!\n" : "FAILED.\n");
+	free(responses);
+	return audit;
+}
+
+
+/* Runs requests over a framed connection (frame.h) until stdin runs out,
+ * or just one audit if audit_only is set. Up to FRAME_WINDOW of them are in
+ * flight at once, and each response is checked as it comes in, in whatever
+ * order the server sends them. Partial audits pass the ranges; otherwise
+ * ranges is NULL. Returns the number of requests that failed.
+ */
+int runFramed(FILE* sock, FILE* fconfig, const store_info_t* info, work_space_t* space,
+				uint64_t n, uint64_t m, uint32_t nchal, int seeded, int audit_only,
+				const audit_range_t* ranges, uint32_t nranges, const uint64_t* band_secret) {
+	audit_range_t whole = {.start = 0, .count = m};
+	audit_req_t areq = {.nchal = nchal, .flags = 0};
+	if (seeded) areq.flags |= AUDIT_FLAG_SEEDED;
+	if (ranges) areq.flags |= AUDIT_FLAG_RANGES;
+	else ranges = &whole;
+	uint64_t rows = 0;
+	for (uint32_t r = 0; r < nranges; r++) rows += ranges[r].count;
+
+	pending_t pending[FRAME_WINDOW];
+	memset(pending, 0, sizeof pending);
+	uint64_t bufsize = 1024;
+	char* buf = malloc(bufsize);
+	char* line = NULL;
+	size_t linecap = 0;
+	uint64_t next_id = 0, inflight = 0, failed = 0;
+	bool more = true;
+	struct timespec timer;
+	start_time(&timer);
+
+	// responses are read on a stream of their own: with reads and writes
+	// interleaved at will, one stream for both would lose buffered input
+	FILE* in = fdopen(dup(fileno(sock)), "r");
+	if (!in) {
+		perror("fdopen");
+		exit(9);
+	}
+	char op = FRAME_PROTO_OP;
+	my_fwrite(&op, 1, 1, sock);
+
+	while (more || inflight) {
+		pending_t req = {.op = 0, .id = next_id};
+		uint64_t bytes = 0;
+		if (more && inflight < FRAME_WINDOW) {
+			// the next request, if there is one
+			if (audit_only) {
+				more = next_id == 0;
+				if (more) req.op = FRAME_AUDIT;
+			}
+			else if (getline(&line, &linecap, stdin) < 0) {
+				more = false;
+			}
+			else {
+				int used = 0;
+				char kind = ' ';
+				sscanf(line, " %c%n", &kind, &used);
+				if (kind == 'a') {
+					req.op = FRAME_AUDIT;
+				}
+				else if (kind == 'r' && sscanf(line + used, " "_CHUNK_SPECIFIER" "_CHUNK_SPECIFIER"",
+							&req.count, &req.offset) == 2) {
+					req.op = FRAME_READ;
+				}
+				else if (kind == 'u' && sscanf(line + used, " "_CHUNK_SPECIFIER" %n", &req.offset, &used) >= 1) {
+					char* text = line + used + strspn(line + used, "0123456789 \t");
+					req.count = strcspn(text, "\n");
+					req.bytes = malloc(req.count + 1);
+					memcpy(req.bytes, text, req.count);
+					req.op = FRAME_UPDATE;
+				}
+				else if (kind != ' ') {
+					fprintf(stderr, "ERROR: cannot parse request <%.*s>\n", (int)strcspn(line, "\n"), line);
+				}
+			}
+
+			if (req.op == FRAME_READ && (req.offset > info->size || req.count > info->size - req.offset
+						|| req.count > UINT32_MAX)) {
+				fprintf(stderr, "ERROR: read of "_CHUNK_SPECIFIER" bytes at "_CHUNK_SPECIFIER" goes past end of size\n",
+						req.count, req.offset);
+				req.op = 0;
+			}
+			if (req.op == FRAME_UPDATE && (req.count == 0 || req.offset > info->size
+						|| req.count > info->size - req.offset)) {
+				fprintf(stderr, "ERROR: update of "_CHUNK_SPECIFIER" bytes at "_CHUNK_SPECIFIER" is out of range\n",
+						req.count, req.offset);
+				free(req.bytes);
+				req.op = 0;
+			}
+			if (req.op == FRAME_AUDIT) bytes = frame_audit_bytes(&areq, nranges, n);
+			else if (req.op == FRAME_UPDATE) bytes = sizeof(frame_update_t) + req.count;
+			if (!more) fflush(sock);
+		}
+
+		// wait for a response when there is nothing to send or the window
+		// is full, when the slot this request needs is still taken, and for
+		// all of them before a big request
+		pending_t* slot = &pending[next_id % FRAME_WINDOW];
+		while (inflight && (req.op ? slot->op || bytes > FRAME_DRAIN_BYTES
+					: !more || inflight >= FRAME_WINDOW)) {
+			fflush(sock);
+			frame_hdr_t hdr;
+			if (frame_recv_hdr(in, &hdr) != 1) {
+				fprintf(stderr, "ERROR: connection closed with %"PRIu64" requests unanswered\n", inflight);
+				exit(9);
+			}
+			pending_t* p = &pending[hdr.id % FRAME_WINDOW];
+			if (!p->op || p->id != hdr.id || hdr.op != p->op) {
+				fprintf(stderr, "ERROR: response to unknown request %"PRIu64"\n", hdr.id);
+				exit(9);
+			}
+			if (!framedResponse(&hdr, p, in, fconfig, info, space, &buf, &bufsize,
+						n, m, nchal, rows, ranges, nranges, band_secret)) {
+				++failed;
+			}
+			free(p->challenges);
+			free(p->bytes);
+			memset(p, 0, sizeof *p);
+			--inflight;
+		}
+		if (!req.op) continue;
+
+		// send it
+		if (req.op == FRAME_AUDIT) {
+			req.challenges = malloc(nchal * n * sizeof *req.challenges);
+			frame_send(sock, req.id, FRAME_AUDIT, 0, bytes, NULL);
+			my_fwrite(&areq, sizeof areq, 1, sock);
+			if (areq.flags & AUDIT_FLAG_RANGES) {
+				audit_ranges_t rhdr = {.nranges = nranges, .reserved = 0};
+				my_fwrite(&rhdr, sizeof rhdr, 1, sock);
+				my_fwrite((void*)ranges, sizeof *ranges, nranges, sock);
+			}
+			if (seeded) {
+				audit_seeds_t sreq = {.prg = CHAL_PRG_TINYMT64, .reserved = 0};
+				uint64_t seeds[nchal];
+				for (uint32_t j = 0; j < nchal; j++) {
+					seeds[j] = makeSeed();
+				}
+				expand_challenges(sreq.prg, seeds, nchal, n, req.challenges);
+				my_fwrite(&sreq, sizeof sreq, 1, sock);
+				my_fwrite(seeds, sizeof *seeds, nchal, sock);
+			}
+			else {
+				for (uint32_t j = 0; j < nchal; j++) {
+					uint64_t* challenge1 = makeChallengeVector(n);
+					memcpy(req.challenges + j * n, challenge1, n * sizeof *challenge1);
+					free(challenge1);
+				}
+				my_fwrite(req.challenges, sizeof *req.challenges, nchal * n, sock);
+			}
 		}
-		rxr1 += ((uint128_t)temp[i]) * response1[i];
-	}
-	rxr1 %= P57;
-	accum_count = 0;
-	my_fread(temp, sizeof *temp, n, fconfig);
-	for (int i = 0; i < n; i++) { /*secret1 dot challenge1 (n)*/
-		if ((accum_count += 2) > MAX_ACCUM_P) {
-			sxc1 %= P57;
-			accum_count = 2;
+		else if (req.op == FRAME_READ) {
+			if (bufsize < req.count) {
+				bufsize = MAX(2 * bufsize, req.count);
+				if (!(buf = realloc(buf, bufsize))) {
+					fprintf(stderr, "ERROR: can't allocate buffer large enough to read\n");
+					exit(2);
+				}
+			}
+			frame_read_t fread_req = {.offset = req.offset, .count = req.count};
+			frame_send(sock, req.id, FRAME_READ, 0, sizeof fread_req, &fread_req);
+		}
+		else {
+			frame_update_t ureq = {.first = req.offset, .count = req.count};
+			frame_send(sock, req.id, FRAME_UPDATE, 0, bytes, NULL);
+			my_fwrite(&ureq, sizeof ureq, 1, sock);
+			my_fwrite(req.bytes, 1, req.count, sock);
 		}
-		sxc1 += ((uint128_t)temp[i]) * challenge1[i];
+		*slot = req;
+		++inflight;
+		++next_id;
 	}
-	sxc1 %= P57;
-	free(temp);
 
-	// check for equal and return result
-	// 1 for pass
-	// 0 for fail (default)
-	printf("rxr1 = %"PRIu64"\n", (uint64_t)rxr1);
-	printf("sxc1 = %"PRIu64"\n", (uint64_t)sxc1);
-	return (rxr1 == sxc1);
+	fprintf(stderr, "Framed: %"PRIu64" requests, %"PRIu64" failed, in %f s\n",
+			next_id, failed, stop_time(&timer));
+	fclose(in);
+	free(buf);
+	free(line);
+	return failed;
+}
+
+
+/* Folds an update of count bytes at first into the secrets in fconfig;
+ * old holds the matrix entries the bytes fall in, as they were. Each entry
+ * is BYTES_UNDER_P bytes of the data file, as the audits read it. Leaves
+ * fconfig just after n and m.
+ */
+void applyUpdate(FILE* fconfig, uint64_t n, uint64_t m, uint64_t first, uint64_t count,
+				const unsigned char* bytes, const uint64_t* old) {
+	uint64_t nbands = band_config_load(fconfig, n, m);
+	uint64_t chunk0 = first / BYTES_UNDER_P;
+	uint64_t chunks = frame_update_chunks(first, count);
+	for (uint64_t k = 0; k < chunks; k++) {
+		uint64_t oldValue = old[k];
+		uint64_t newValue = oldValue;
+		unsigned char* newByte = (unsigned char*)&newValue;
+		for (uint64_t b = 0; b < BYTES_UNDER_P; b++) {
+			uint64_t i = (chunk0 + k) * BYTES_UNDER_P + b;
+			if (i >= first && i < first + count) newByte[b] = bytes[i - first];
+		}
+		if (newValue == oldValue) continue;
+		uint64_t delta = (newValue > oldValue) ? newValue - oldValue : newValue + P57 - oldValue;
+
+		// the random and secret entries of the affected row and column
+		uint64_t affectedRandom = (chunk0 + k) / n;
+		uint64_t affectedSecret = (chunk0 + k) % n;
+		uint64_t random1, secret1;
+		fseek(fconfig, (2 + affectedRandom) * sizeof(uint64_t), SEEK_SET);
+		my_fread(&random1, sizeof(uint64_t), 1, fconfig);
+		long index = (2 + m + affectedSecret) * sizeof(uint64_t);
+		fseek(fconfig, index, SEEK_SET);
+		my_fread(&secret1, sizeof(uint64_t), 1, fconfig);
+		secret1 = p57_reduce(secret1 + ((uint128_t)delta) * random1);
+		fseek(fconfig, index, SEEK_SET);
+		my_fwrite(&secret1, sizeof(uint64_t), 1, fconfig);
+
+		// and the secret of the band holding the affected row
+		if (nbands) {
+			uint64_t band = band_of_row(m, nbands, affectedRandom);
+			uint64_t bandSecret;
+			index = band_secret_offset(n, m, band) + affectedSecret*sizeof(uint64_t);
+			fseek(fconfig, index, SEEK_SET);
+			my_fread(&bandSecret, sizeof(uint64_t), 1, fconfig);
+			bandSecret = p57_reduce(bandSecret + ((uint128_t)delta) * random1);
+			fseek(fconfig, index, SEEK_SET);
+			my_fwrite(&bandSecret, sizeof(uint64_t), 1, fconfig);
+		}
+	}
+	fflush(fconfig);
+	fseek(fconfig, 2*sizeof(uint64_t), SEEK_SET);
 }
 
 
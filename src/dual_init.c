@@ -1,13 +1,19 @@
+#define _GNU_SOURCE // for O_DIRECT
 #include "integrity.h"
+#include "p57.h"
+#include "field.h"
+#include "row_reader.h"
+#include "readahead.h"
+#include "bands.h"
+#include "row_sched.h"
+#include "sparse.h"
+#include <getopt.h>
 #include <limits.h>
 #include <inttypes.h>
 #include <openssl/objects.h>
 #include <omp.h>
 #include <fcntl.h>
 #include <unistd.h>
-#ifdef POR_MMAP
-#include <sys/mman.h>
-#endif
 
 /*****Compile with -lm flag due to inclusion of math.h*****/
 /***Compile using Makefile due to Mersenne Twist library***/
@@ -15,20 +21,112 @@
 
 #define DEFAULT_DIGEST ("sha512-224")
 #define DEFAULT_BLOCKSIZE (2 << 12)
+// flushing the band sums costs about as much as a row, so stolen work comes
+// in chunks of at least this many rows
+#define STEAL_MIN_ROWS (8)
+
+void usage(const char* arg) {
+	printf("USAGE: %s [OPTIONS] <input_data> "
+		"<output_client_config> "
+		"<output_server_config> "
+		"<output_merkle_config> "
+		"<output_merkle_tree>\n"
+		"	-r --reader <name>	how to read rows: pread, mmap, mmap-populate, pinned or direct\n"
+		"	-D --direct	same as --reader direct, bypassing the page cache\n"
+		"	-R --readahead <rows>	ask the kernel to prefetch <rows> rows ahead of each thread\n"
+		"	-B --drop-behind	drop rows from the page cache once they have been read\n"
+		"	-b --bands <B>	also write secrets for B row bands, for partial audits\n"
+		"	-s --steal	let idle threads steal rows from busy ones\n"
+		"	-Z --compress <store>	also write the data as a compressed store, which the server then reads\n"
+		"	-h --help	show this help menu\n",
+		arg);
+}
 
 int main(int argc, char* argv[]) {
 	struct timespec timer;
+	row_backend_t reader = row_reader_default();
+	uint64_t readahead_rows = 0; /*defaults to off*/
+	int drop_behind = 0; /*defaults to off*/
+	uint64_t nbands = 0; /*defaults to off*/
+	int steal_rows = 0; /*defaults to off (static blocks)*/
+	const char* compress_path = NULL; /*defaults to off*/
+
+	struct option longopts[] = {
+		{"reader", required_argument, NULL, 'r'},
+		{"direct", no_argument, NULL, 'D'},
+		{"readahead", required_argument, NULL, 'R'},
+		{"drop-behind", no_argument, NULL, 'B'},
+		{"bands", required_argument, NULL, 'b'},
+		{"steal", no_argument, NULL, 's'},
+		{"compress", required_argument, NULL, 'Z'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while (true) {
+		switch (getopt_long(argc, argv, "r:DR:Bb:sZ:h", longopts, NULL)) {
+			case -1:
+				goto done_opts;
+
+			case 'r':
+				if (row_reader_lookup(optarg) < 0) {
+					fprintf(stderr, "Row reader <%s> is unknown\n", optarg);
+					return 1;
+				}
+				reader = row_reader_lookup(optarg);
+				break;
+
+			case 'D':
+				reader = ROW_READER_DIRECT;
+				break;
+
+			case 'R':
+				readahead_rows = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'B':
+				drop_behind = 1;
+				break;
+
+			case 'b':
+				nbands = strtoull(optarg, NULL, 10);
+				if (nbands < 1) {
+					fprintf(stderr, "Number of bands must be at least 1\n");
+					return 1;
+				}
+				break;
+
+			case 's':
+				steal_rows = 1;
+				break;
+
+			case 'Z':
+#ifdef POR_ZLIB
+				compress_path = optarg;
+				break;
+#else
+				fprintf(stderr, "Compressed stores need a build with zlib\n");
+				return 1;
+#endif
+
+			case 'h': case '?':
+				usage(argv[0]);
+				return 1;
+
+			default:
+				fprintf(stderr, "unexpected getopt return value\n");
+				return 1;
+		}
+	}
 
+done_opts:
 	// arguments checks
-	if (argc < 6) {
-		printf("USAGE: %s <input_data> "
-			"<output_client_config> "
-			"<output_server_config> "
-			"<output_merkle_config> "
-			"<output_merkle_tree>\n",
-			argv[0]);
+	if (argc - optind < 5) {
+		usage(argv[0]);
 		return 1;
 	}
+	// the positional arguments, from here on argv[1] is the input data
+	argv += optind - 1;
 
 	FILE* fin, * fclient, * fserver, * fmerkle, * ftree;
 
@@ -47,6 +145,27 @@ int main(int argc, char* argv[]) {
 	struct stat s;
 	stat(argv[1], &s);
 	off_t fileSize = s.st_size;
+
+	// a compressed store stands for its logical bytes, which the tree covers
+	if (zframes_probe(fileno(fin))) {
+#ifdef POR_ZLIB
+		zframes_t frames;
+		if (compress_path || !zframes_open(&frames, fileno(fin))) {
+			fprintf(stderr, "ERROR: <%s> is a compressed store, and cannot be %s\n",
+					argv[1], compress_path ? "compressed again" : "read");
+			return 2;
+		}
+		fileSize = frames.hdr.logical_size;
+		zframes_close(&frames);
+		fclose(fin);
+		fin = zframes_fopen(argv[1]);
+		assert (fin);
+		printf("<%s> is a compressed store.\n", argv[1]);
+#else
+		fprintf(stderr, "ERROR: <%s> is a compressed store, and this build has no zlib\n", argv[1]);
+		return 2;
+#endif
+	}
 	printf("The size of <%s> is %"PRIu64".\n", argv[1], fileSize);
     fflush(stdout);
 
@@ -59,14 +178,36 @@ int main(int argc, char* argv[]) {
 	uint64_t m = 1 + (num_chunks - 1) / n;
 	printf("Using m = %"PRIu64", n = %"PRIu64".\n", m, n);
     fflush(stdout);
+	if (nbands > m) {
+		fprintf(stderr, "ERROR: %"PRIu64" bands for only %"PRIu64" rows\n", nbands, m);
+		return 1;
+	}
 	fwrite(&n, sizeof(uint64_t), 1, fclient);
 	fwrite(&m, sizeof(uint64_t), 1, fclient);
 	fwrite(&n, sizeof(uint64_t), 1, fserver);
 	fwrite(&m, sizeof(uint64_t), 1, fserver);
 
+	// the server reads the compressed store, if there is one; it holds the
+	// same logical bytes, so the rest still reads the input
+	const char* serverData = argv[1];
+#ifdef POR_ZLIB
+	if (compress_path) {
+		start_time(&timer);
+		if (!zframes_write(argv[1], compress_path, BYTES_UNDER_P * n, Z_DEFAULT_COMPRESSION)) {
+			fprintf(stderr, "ERROR: could not write the compressed store <%s>\n", compress_path);
+			return 2;
+		}
+		struct stat zs;
+		stat(compress_path, &zs);
+		printf("Compressed <%s> into <%s>: %"PRIu64" of %"PRIu64" bytes, in %lg seconds\n",
+				argv[1], compress_path, (uint64_t)zs.st_size, (uint64_t)fileSize, stop_time(&timer));
+		serverData = compress_path;
+	}
+#endif
+
 	// write data file name to fserver
 	char actualPath[PATH_MAX];
-	char* trash = realpath(argv[1], actualPath);
+	char* trash = realpath(serverData, actualPath);
 	if (trash == NULL) {
 		fprintf(stderr, "ERROR: realpath returned null\n");
 		exit(1);
@@ -105,95 +246,137 @@ int main(int argc, char* argv[]) {
 
 	uint64_t bytes_per_row = BYTES_UNDER_P * n;
 	assert (n % 8 == 0);
-	static const uint64_t CHUNK_MASK = (UINT64_C(1) << (8 * BYTES_UNDER_P)) - 1;
+
+	row_source_t src;
+	if (!row_source_open(&src, argv[1], bytes_per_row, reader)) {
+		fprintf(stderr, "ERROR: could not open <%s> for reading rows\n", argv[1]);
+		return 2;
+	}
+	bool direct = src.backend == ROW_READER_DIRECT;
+	printf("Using %s for file reads\n", ROW_READER_NAMES[src.backend]);
+
+	// rows of a sparse file that are all hole are never read
+	extent_map_t extents = {0};
+	bool sparse = !src.frames && extent_map_load(&extents, argv[1]) && extent_map_sparse(&extents);
+	if (sparse) {
+		printf("Sparse input: %"PRIu64" of %"PRIu64" bytes allocated, in %zu extents\n",
+				extents.data_bytes, extents.file_size, extents.nextents);
+	}
+
+	// without bands the whole matrix is one band, whose secret is secret1
+	uint64_t bands = nbands ? nbands : 1;
+	uint64_t *band_secrets = nbands ? calloc(nbands * n, sizeof *band_secrets) : NULL;
+	row_sched_t sched;
 
 #pragma omp parallel reduction(+:partials1[:n])
 	{
 		printf("thread %d starting vector-matrix mul\n", omp_get_thread_num());
-		size_t accum_count = 0;
-		int fd = open(argv[1], O_RDONLY);
-		assert (fd >= 0);
-#ifdef POR_MMAP
-		void *fdmap = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
-		assert (fdmap != MAP_FAILED);
-		close(fd);
-#else // no MMAP
-		uint64_t *raw_row = malloc(bytes_per_row);
-		assert (raw_row);
-#endif // POR_MMAP
-
-#pragma omp for schedule(static) nowait
-		for (size_t i = 0; i < m; i++) {
-			// mod reduce in case of overflow
-			if (++accum_count > MAX_ACCUM_P) {
-				for (size_t k = 0; k < n; ++k) {
-					partials1[k] %= P57;
-				}
-				accum_count = 1;
+		size_t rows_since_fold = 0;
+		// each thread starts on a contiguous block of rows, as schedule(static)
+		// would give, and with stealing takes more from the others at the end
+		size_t nthreads = omp_get_num_threads();
+		size_t tid = omp_get_thread_num();
+#pragma omp single
+		row_sched_init(&sched, 0, m, nthreads, STEAL_MIN_ROWS, steal_rows, NULL);
+
+		// sums for the current band, added to partials1 and the band's
+		// secret whenever the band or the chunk of rows ends
+		uint128_t *band_partials = calloc(n, sizeof *band_partials);
+		assert (band_partials);
+
+		row_reader_t rr;
+		row_reader_init(&rr, &src);
+
+		// readahead follows each contiguous run of chunks the thread gets;
+		// page cache hints make no sense for reads that bypass it, nor for
+		// the offsets of rows in a compressed store
+		bool hints = !direct && !src.frames;
+		readahead_t ra = {.fd = -1}; // hints nothing until the first run
+		size_t run_end = 0;
+		row_chunk_t chunk;
+		while (row_sched_next(&sched, tid, &chunk)) {
+			size_t lo = chunk.lo, hi = chunk.hi;
+			if (chunk.new_run) {
+				readahead_truncate(&ra, bytes_per_row * run_end);
+				readahead_finish(&ra);
+				uint64_t run_stop = (bytes_per_row * chunk.run_stop < fileSize) ? bytes_per_row * chunk.run_stop : fileSize;
+				readahead_init(&ra, rr.fd, src.map, bytes_per_row * lo, run_stop,
+						hints ? readahead_rows * bytes_per_row : 0, drop_behind && hints);
 			}
-
-#ifdef POR_MMAP
-			// get a pointer to the row
-			uint64_t *raw_row;
-			if (i < m-1) {
-				raw_row = fdmap + (bytes_per_row * i);
-			}
-			else {
-				raw_row = calloc(bytes_per_row, 1);
-				memcpy(raw_row, fdmap + (bytes_per_row * i), fileSize - (bytes_per_row * i));
-			}
-#else // no MMAP
-			my_pread(fd, raw_row, bytes_per_row, bytes_per_row * i);
-#endif // POR_MMAP
-
-			// XXX: this part assumes BYTES_UNDER_P equals 7
-			assert (BYTES_UNDER_P == 7);
-			// accumulate across one row, 56 bytes (8 chunks) at a time
-			for (size_t raw_ind = 0, full_ind = 0; full_ind < n; raw_ind += 7, full_ind += 8) {
-				uint128_t data_val = raw_row[raw_ind] & CHUNK_MASK;
-				partials1[full_ind] += data_val * vector1[i];
-
-				for (int k = 1; k < 7; ++k) {
-					data_val = (raw_row[raw_ind + k - 1] >> (64 - k*8))
-						| ((raw_row[raw_ind + k] << (k*8)) & CHUNK_MASK);
-					partials1[full_ind + k] += data_val * vector1[i];
+			run_end = hi;
+
+			uint64_t band = band_of_row(m, bands, lo);
+			uint64_t band_stop = band_start(m, bands, band + 1);
+			for (size_t i = lo; i < hi; i++) {
+				// holes add nothing, so only the columns holding data are summed
+				col_range_t cols[SPARSE_MAX_COL_RANGES] = {{.col = 0, .ncols = n}};
+				size_t ncols = sparse ? extent_map_row_cols(&extents, bytes_per_row * i, n, cols) : 1;
+
+				if (ncols) {
+					// fold the partial sums before another row could overflow them
+					if (++rows_since_fold > P57_LAZY_TERMS(P57_DATA_PRODUCT_BITS)) {
+						for (size_t k = 0; k < n; ++k) {
+							band_partials[k] = p57_fold(band_partials[k]);
+						}
+						rows_since_fold = 1;
+					}
+
+					readahead_advance(&ra, bytes_per_row * i);
+					const uint64_t *raw_row = row_reader_get(&rr, i);
+
+					// accumulate across one row, 8 chunks at a time
+					for (size_t r = 0; r < ncols; ++r) {
+						field_p57_accum(raw_row, vector1[i], band_partials, cols[r].col, cols[r].ncols);
+					}
 				}
 
-				data_val = raw_row[raw_ind + 6] >> 8;
-				partials1[full_ind + 7] += data_val * vector1[i];
-			}
-			// XXX (end assumption that BYTES_UNDER_P equals 7)
-
-#ifdef POR_MMAP
-			if (i == m-1) {
-				free(raw_row);
+				if (i + 1 == band_stop || i + 1 == hi) {
+					// bands can span threads, so their secrets are summed under a lock
+					for (size_t k = 0; k < n; ++k) {
+						uint64_t sum = p57_reduce(band_partials[k]);
+						partials1[k] += sum;
+						band_partials[k] = sum;
+					}
+					if (band_secrets) {
+#pragma omp critical(band_secrets)
+						for (size_t k = 0; k < n; ++k) {
+							uint64_t *secret = band_secrets + band * n + k;
+							*secret = p57_add(*secret, band_partials[k]);
+						}
+					}
+					memset(band_partials, 0, n * sizeof *band_partials);
+					rows_since_fold = 0;
+					++band;
+					band_stop = band_start(m, bands, band + 1);
+				}
 			}
-#endif // POR_MMAP
 		}
+		free(band_partials);
 
-#ifdef POR_MMAP
-		munmap(fdmap, fileSize);
-#else // no MMAP
-		free(raw_row);
-		close(fd);
-#endif // POR_MMAP
+		readahead_truncate(&ra, bytes_per_row * run_end);
+		readahead_finish(&ra);
+		row_reader_clear(&rr);
 
 		// mod reduction before parallel accumulate
 		for (size_t k = 0; k < n; ++k) {
-			partials1[k] %= P57;
+			partials1[k] = p57_reduce(partials1[k]);
 		}
 		printf("thread %d finished vector-matrix mul\n", omp_get_thread_num());
 	}
 
+	row_sched_report(&sched, stdout);
+	row_sched_clear(&sched);
+	extent_map_clear(&extents);
     fflush(stdout);
 	free(vector1);
 
 	// final mod reduction after parallel accumulate
 	for (size_t k = 0; k < n; ++k) {
-		partials1[k] %= P57;
+		partials1[k] = p57_reduce(partials1[k]);
 	}
 
 	double mul_time = stop_time(&timer);
+	row_source_close(&src);
 	printf("vector-matrix mul took %lg seconds\n", mul_time);
     fflush(stdout);
 
@@ -207,6 +390,16 @@ int main(int argc, char* argv[]) {
 	fwrite(secret1, sizeof *secret1, n, fclient);
 	free(secret1);
 
+	// band secrets go after secret1, so older clients still read the config
+	if (nbands) {
+		uint64_t tag = BAND_CONFIG_TAG;
+		fwrite(&tag, sizeof tag, 1, fclient);
+		fwrite(&nbands, sizeof nbands, 1, fclient);
+		fwrite(band_secrets, sizeof *band_secrets, nbands * n, fclient);
+		free(band_secrets);
+		printf("Secrets for %"PRIu64" bands appended to <%s>.\n", nbands, argv[2]);
+	}
+
 	/*printf("\n");*/
 	printf("Secret vectors appended to <%s>.\n", argv[2]);
 	fclose(fclient);
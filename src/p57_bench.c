@@ -0,0 +1,193 @@
+// Microbenchmarks for P57 arithmetic
+// compares the uint128_t % P57 reductions against the folding ones in p57.h,
+// and the row kernels of each field in field.h
+// optional first arg is the vector length (defaults to 186830, the n of a 1TB file)
+
+// the fields other than p57 are built only for measuring them here
+#define FIELD_ALTERNATES
+#include "integrity.h"
+#include "p57.h"
+#include "audit_kernel.h"
+#include "field.h"
+#include <inttypes.h>
+
+#define REPS (50)
+
+static volatile uint64_t sink;
+
+// the counter-based dot product formerly used in runAudit
+static uint64_t dot_counter(const uint64_t *a, const uint64_t *b, size_t len) {
+	uint128_t acc = 0;
+	size_t accum_count = 0;
+	for (size_t i = 0; i < len; i++) {
+		if ((accum_count += 2) > MAX_ACCUM_P) {
+			acc %= P57;
+			accum_count = 2;
+		}
+		acc += ((uint128_t)a[i]) * b[i];
+	}
+	return acc % P57;
+}
+
+int main(int argc, char* argv[]) {
+	uint64_t n = (argc > 1) ? strtoull(argv[1], NULL, 10) : 186830;
+	n = (n + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+	struct timespec timer;
+	double t1, t2;
+
+	tinymt64_t state = {0};
+	tinymt64_init(&state, 57);
+
+	uint64_t *a = malloc(n * sizeof *a);
+	uint64_t *b = malloc(n * sizeof *b);
+	uint128_t *wide = malloc(n * sizeof *wide);
+	uint64_t *raw_row = malloc(n * BYTES_UNDER_P + 8);
+	assert (a && b && wide && raw_row);
+	for (size_t i = 0; i < n; ++i) {
+		a[i] = rand_mod_p(&state);
+		b[i] = rand_mod_p(&state);
+	}
+	for (size_t i = 0; i < n * BYTES_UNDER_P / 8 + 1; ++i) {
+		raw_row[i] = tinymt64_generate_uint64(&state);
+	}
+	printf("vector length n = %"PRIu64", %d repetitions\n", n, REPS);
+
+	// single reductions of full-width products
+	uint64_t check1 = 0, check2 = 0;
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) {
+		for (size_t i = 0; i < n; ++i) {
+			wide[i] = ((uint128_t)a[i] * b[i]) << 13 | r;
+			check1 += wide[i] % P57;
+		}
+	}
+	t1 = stop_time(&timer);
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) {
+		for (size_t i = 0; i < n; ++i) {
+			wide[i] = ((uint128_t)a[i] * b[i]) << 13 | r;
+			check2 += p57_reduce(wide[i]);
+		}
+	}
+	t2 = stop_time(&timer);
+	printf("reduce     %%: %9.6f s   p57_reduce: %9.6f s   speedup %.2fx  %s\n",
+			t1, t2, t1 / t2, check1 == check2 ? "ok" : "MISMATCH");
+
+	// dot products as in runAudit
+	check1 = check2 = 0;
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) check1 += dot_counter(a, b, n);
+	t1 = stop_time(&timer);
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) check2 += p57_dot(a, b, n);
+	t2 = stop_time(&timer);
+	printf("dot  counter: %9.6f s   p57_dot:    %9.6f s   speedup %.2fx  %s\n",
+			t1, t2, t1 / t2, check1 == check2 ? "ok" : "MISMATCH");
+
+	// partial-sum sweeps as in dual_init
+	for (size_t i = 0; i < n; ++i) wide[i] = (uint128_t)a[i] * b[i] * 4099;
+	check1 = check2 = 0;
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) {
+		for (size_t i = 0; i < n; ++i) check1 += (uint64_t)(wide[i] % P57);
+	}
+	t1 = stop_time(&timer);
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) {
+		for (size_t i = 0; i < n; ++i) check2 += p57_reduce(wide[i]);
+	}
+	t2 = stop_time(&timer);
+	printf("sweep      %%: %9.6f s   p57_reduce: %9.6f s   speedup %.2fx  %s\n",
+			t1, t2, t1 / t2, check1 == check2 ? "ok" : "MISMATCH");
+
+	// whole-row audit kernels
+	audit_chal_t chal;
+	audit_chal_init(&chal, a, n);
+	uint64_t expected = 0;
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) expected = row_dot_reference(raw_row, &chal, 0, n);
+	t1 = stop_time(&timer);
+	printf("row   reference loop: %9.6f s\n", t1);
+	for (const audit_kernel_t *k = AUDIT_KERNELS; k->name; ++k) {
+		if (!audit_kernel_supported(k->name)) continue;
+		uint64_t got = 0;
+		start_time(&timer);
+		for (int r = 0; r < REPS; ++r) sink = got = k->fn(raw_row, &chal, 0, n);
+		t2 = stop_time(&timer);
+		printf("row %8s kernel: %9.6f s   speedup %.2fx  %s\n",
+				k->name, t2, t1 / t2, got == expected ? "ok" : "MISMATCH");
+	}
+
+	// a band of rows, one row at a time against the whole challenge versus
+	// a column tile at a time, as in the server's tiled mode
+	const audit_kernel_t *best = select_audit_kernel(NULL);
+	size_t nrows = audit_tile_rows(n * BYTES_UNDER_P);
+	size_t tile_cols = audit_tile_cols(1, nrows);
+	uint64_t *band = malloc(nrows * n * BYTES_UNDER_P + 8);
+	const uint64_t *rows[nrows];
+	uint64_t by_row[nrows], by_tile[nrows];
+	assert (band);
+	for (size_t i = 0; i < nrows * n * BYTES_UNDER_P / 8 + 1; ++i) {
+		band[i] = tinymt64_generate_uint64(&state);
+	}
+	for (size_t r = 0; r < nrows; ++r) {
+		rows[r] = band + r * n * BYTES_UNDER_P / 8;
+	}
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) {
+		for (size_t k = 0; k < nrows; ++k) by_row[k] = best->fn(rows[k], &chal, 0, n);
+	}
+	t1 = stop_time(&timer);
+	start_time(&timer);
+	for (int r = 0; r < REPS; ++r) {
+		row_dot_tiled(best->fn, rows, nrows, &chal, 1, n, tile_cols, by_tile);
+	}
+	t2 = stop_time(&timer);
+	printf("band of %zu rows (%s), by row: %9.6f s   tiles of %zu cols: %9.6f s   speedup %.2fx  %s\n",
+			nrows, best->name, t1, tile_cols, t2, t1 / t2,
+			memcmp(by_row, by_tile, sizeof by_row) == 0 ? "ok" : "MISMATCH");
+	free(band);
+	audit_chal_clear(&chal);
+
+	// specialized field kernels over rows of the same byte length, checked
+	// against a plain % loop over the unpacked chunks
+	size_t row_bytes = n * BYTES_UNDER_P;
+	for (int f = 0; f < FIELD_COUNT; ++f) {
+		const field_t *fld = &FIELDS[f];
+		size_t cols = row_bytes / fld->chunk_bytes / 8 * 8;
+		uint64_t *chal1 = malloc(cols * sizeof *chal1);
+		uint128_t *partials = calloc(cols, sizeof *partials);
+		assert (chal1 && partials);
+		for (size_t i = 0; i < cols; ++i) chal1[i] = field_rand(fld, &state);
+
+		uint128_t slow = 0;
+		const uint8_t *bytes = (const uint8_t*)raw_row;
+		for (size_t i = 0; i < cols; ++i) {
+			uint64_t chunk = 0;
+			memcpy(&chunk, bytes + i * fld->chunk_bytes, fld->chunk_bytes);
+			slow = (slow + (uint128_t)chunk * chal1[i]) % fld->prime;
+		}
+
+		uint64_t got = 0;
+		start_time(&timer);
+		for (int r = 0; r < REPS; ++r) sink = got = fld->dot(raw_row, chal1, 0, cols);
+		t1 = stop_time(&timer);
+		start_time(&timer);
+		for (int r = 0; r < REPS; ++r) fld->accum(raw_row, chal1[r], partials, 0, cols);
+		t2 = stop_time(&timer);
+		printf("field %s (%u-byte chunks): dot %7.1f MB/s  accum %7.1f MB/s  %s\n",
+				fld->name, fld->chunk_bytes,
+				REPS * cols * fld->chunk_bytes / t1 / 1e6,
+				REPS * cols * fld->chunk_bytes / t2 / 1e6,
+				got == (uint64_t)slow ? "ok" : "MISMATCH");
+		free(chal1);
+		free(partials);
+	}
+
+	sink = check1 + check2;
+	free(a);
+	free(b);
+	free(wide);
+	free(raw_row);
+	return 0;
+}
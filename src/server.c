@@ -3,16 +3,34 @@
 // second arg is merkle file
 // third arg is port number to listen on
 
+#define _GNU_SOURCE // for O_DIRECT
 #include "integrity.h"
+#include "audit_kernel.h"
+#include "audit_proto.h"
+#include "challenge_prg.h"
+#include "uring_reader.h"
+#include "row_reader.h"
+#include "readahead.h"
+#include "numa_topo.h"
+#include "row_sched.h"
+#include "residency.h"
+#include "sparse.h"
+#include "scan_share.h"
+#include "scrub.h"
+#include "event_loop.h"
+#include "frame.h"
+#include "zero_copy.h"
+#include "proof.h"
 #include <signal.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <omp.h>
 #include <fcntl.h>
 #include <unistd.h>
-#ifdef POR_MMAP
+#include <errno.h>
+#include <pthread.h>
 #include <sys/mman.h>
-#endif
+#include <sys/wait.h>
 
 int server;
 int clientfd;
@@ -21,10 +39,64 @@ FILE* fconfig;
 FILE* fmerkle;
 FILE* dataMatrix;
 work_space_t wspace;
+const audit_kernel_t *kernel;
+int selfcheck = 0; /*defaults to off*/
+unsigned uring_depth = 0; /*defaults to off (blocking pread)*/
+row_backend_t reader; /*defaults to mmap or pread, as built*/
+uint64_t readahead_rows = 0; /*defaults to off (kernel readahead only)*/
+int drop_behind = 0; /*defaults to off*/
+int numa_aware = 0; /*defaults to off*/
+bool numa_prefault = false; /*set when NUMA-aware threads prefault their own rows*/
+int tiled = 0; /*defaults to off (one row at a time)*/
+int steal_rows = 0; /*defaults to off (static blocks)*/
+int warm_first = 0; /*defaults to off (file order)*/
+bool compressed_store = false; /*set when the data file is a compressed store*/
+int overlap_chal = 0; /*defaults to off (whole challenge first)*/
+int scrub = 0; /*defaults to off*/
+scrub_tree_t scrub_tree; /*the mapped Merkle tree, when scrubbing*/
+proof_tree_t proof_tree; /*the mapped Merkle tree, for proofs, if it could be mapped*/
+digest_t proof_hashes[PROOF_MAX_HASHES]; /*the hashes of a proof, read when the tree is not mapped*/
+int nworkers = 0; /*defaults to off (fork per connection)*/
+int epoll_front = 0; /*defaults to off (workers accept for themselves)*/
+int npool = 0; /*processes in the pool: the workers, and any event loop*/
+pid_t* worker_pids = NULL; /*the pool, in the process that keeps it*/
+bool drop_on_error = false; /*set in pool workers, which drop a broken connection rather than exit*/
+bool client_gone = false; /*set once the connection being served is broken*/
+
+/* A buffer kept across the requests a process serves, grown as needed
+ * and cache-line aligned. */
+typedef struct {
+	void *ptr;
+	size_t bytes;
+} reuse_buf_t;
+
+reuse_buf_t chal_buf, result_buf;
+numa_topo_t topo;
+
+// rows the shared scan reads per thread between checks for new audits
+#define SCAN_CHUNK_ROWS_PER_THREAD (4)
+
+scan_share_t *scan_share = NULL;
 
 void usage(const char* arg0) {
 	fprintf(stderr, "usage: %s [OPTIONS] [<config_file>] [<merkle_config_file>]\n"
 			"	-p --port			port over which to connect with cloud server; defaults to 2020\n"
+			"	-K --kernel <name>	audit kernel: auto, avx512, avx2 or scalar; defaults to auto\n"
+			"	-c --selfcheck		compare the audit kernel against the scalar loop on every row\n"
+			"	-S --share-scans <slots>	let up to <slots> concurrent challenges share one scan of the data\n"
+			"	-u --uring-depth <d>	read rows through io_uring with up to <d> reads in flight per thread\n"
+			"	-r --reader <name>	how audits read rows: pread, mmap, mmap-populate, pinned or direct\n"
+			"	-D --direct		same as --reader direct, bypassing the page cache\n"
+			"	-R --readahead <rows>	ask the kernel to prefetch <rows> rows ahead of each audit thread\n"
+			"	-B --drop-behind	drop rows from the page cache once an audit has read them\n"
+			"	-N --numa		pin audit threads to NUMA nodes and keep challenges node-local\n"
+			"	-T --tiled		audit bands of rows a column tile at a time, sized to the cache\n"
+			"	-s --steal		let idle audit threads steal rows from busy ones\n"
+			"	-W --warm-first		audit rows already in the page cache first; best with --steal\n"
+			"	-O --overlap		compute on each column tile of a challenge as it arrives\n"
+			"	-M --scrub		check the rows an audit reads against the Merkle tree leaves\n"
+			"	-w --workers <N>	serve connections from a pool of <N> long-lived workers instead of forking for each\n"
+			"	-E --epoll		hold all connections in one epoll loop that serves retrievals and hands the rest to the workers\n"
 			"	-v --verbose		verbose mode\n"
 			"	-h --help			show this help menu\n"
 			, arg0);
@@ -35,20 +107,59 @@ void my_exits(void);
 
 void handler(int signum);
 
-void my_fread(void* ptr, size_t size, size_t nmemb, FILE* stream);
+bool my_fread(void* ptr, size_t size, size_t nmemb, FILE* stream);
 void my_fwrite(void* ptr, size_t size, size_t nmemb, FILE* stream);
 
+FILE* open_data_matrix(const char* path);
+int run_worker_pool(void);
+void* reuse_buf_get(reuse_buf_t* b, size_t bytes);
+bool audit_source(row_source_t* src, const char* path, uint64_t bytes_per_row);
+
 uint64_t retrieveAndSend(uint64_t index, FILE* data, FILE* sock);
 
 bool read_hash(uint64_t index, char* hash, FILE* merkle, const store_info_t* info);
 bool send_blocks(uint64_t offset, uint64_t count, uint32_t lbsize, FILE* data, FILE* sock, const store_info_t* info);
+bool plan_proof(proof_plan_t* p, struct iovec* iov, uint64_t offset, uint64_t count, const store_info_t* info);
+bool send_proof(const proof_plan_t* p, struct iovec* iov, FILE* data, FILE* sock, const store_info_t* info);
 void my_fwrite_rreq(read_req_t* rreq, uint64_t bufsize, FILE* sock, const store_info_t* info);
 
+// rows per segment when audit responses are streamed
+#define STREAM_SEG_ROWS (256)
+
+// audits a framed connection may have waiting before it reads on
+#define FRAME_QUEUED_AUDITS (16)
+
+typedef struct {
+	FILE *sock;
+	uint32_t nchal;
+	const uint64_t *results;
+} audit_stream_t;
+
+void audit_matrix(const char* path, uint64_t n, uint64_t first, uint64_t stop,
+		const uint64_t* challenges, uint32_t nchal, uint64_t* results,
+		audit_stream_t *stream);
+void audit_overlapped(FILE* sock, const char* path, uint64_t n,
+		const audit_range_t* ranges, uint32_t nranges, uint64_t* challenge, uint64_t* results,
+		struct timespec* timer, struct timespec* cpu_timer);
+void serve_audit(FILE* sock, const char* path, uint64_t n, uint64_t m, uint32_t nchal, uint32_t flags);
+void serve_frames(FILE* sock, const char* path, uint64_t n, uint64_t m, const store_info_t* info);
+audit_range_t* read_ranges(FILE* sock, uint64_t m, uint32_t* nranges, uint64_t* rows);
+bool check_ranges(const audit_range_t* ranges, uint32_t nranges, uint64_t m, uint64_t* rows);
+void compute_audit(const char* path, uint64_t n, uint64_t m,
+		const audit_range_t* ranges, uint32_t nranges,
+		const uint64_t* challenges, uint32_t nchal, uint64_t* results,
+		audit_stream_t* stream);
+
+bool shared_audit(const char* path, const uint64_t* challenges, uint32_t nchal, uint64_t* results);
+
 
 int main(int argc, char* argv[]) {
 
 	short port = 2020; /*defaults to 2020*/
 	int verbose = 0; /*defaults to off*/
+	const char *kernel_name = "auto";
+	const char *reader_name = NULL;
+	uint32_t share_slots = 0; /*defaults to off*/
 
 	// register handler and make it run at exit as well
 	signal(SIGINT, handler);
@@ -58,13 +169,29 @@ int main(int argc, char* argv[]) {
 	// handle command line arguments
 	struct option longopts[] = {
 		{"port", required_argument, NULL, 'p'},
+		{"kernel", required_argument, NULL, 'K'},
+		{"selfcheck", no_argument, NULL, 'c'},
+		{"share-scans", required_argument, NULL, 'S'},
+		{"uring-depth", required_argument, NULL, 'u'},
+		{"reader", required_argument, NULL, 'r'},
+		{"direct", no_argument, NULL, 'D'},
+		{"readahead", required_argument, NULL, 'R'},
+		{"drop-behind", no_argument, NULL, 'B'},
+		{"numa", no_argument, NULL, 'N'},
+		{"tiled", no_argument, NULL, 'T'},
+		{"steal", no_argument, NULL, 's'},
+		{"warm-first", no_argument, NULL, 'W'},
+		{"overlap", no_argument, NULL, 'O'},
+		{"scrub", no_argument, NULL, 'M'},
+		{"workers", required_argument, NULL, 'w'},
+		{"epoll", no_argument, NULL, 'E'},
 		{"verbose", no_argument, NULL, 'v'},
 		{"help", no_argument, NULL, 'h'},
 		{NULL, 0, NULL, 0}
 	};
 
 	while (true) {
-		switch (getopt_long(argc, argv, "p:vh", longopts, NULL)) {
+		switch (getopt_long(argc, argv, "p:K:cS:u:r:DR:BNTsWOMw:Evh", longopts, NULL)) {
 			case -1:
 				goto done_opts;
 
@@ -72,6 +199,74 @@ int main(int argc, char* argv[]) {
 				port = atoi(optarg);
 				break;
 
+			case 'K':
+				kernel_name = optarg;
+				break;
+
+			case 'c':
+				selfcheck = 1;
+				break;
+
+			case 'S':
+				share_slots = atoi(optarg);
+				break;
+
+			case 'u':
+				uring_depth = atoi(optarg);
+				break;
+
+			case 'r':
+				reader_name = optarg;
+				break;
+
+			case 'D':
+				reader_name = "direct";
+				break;
+
+			case 'R':
+				readahead_rows = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'B':
+				drop_behind = 1;
+				break;
+
+			case 'N':
+				numa_aware = 1;
+				break;
+
+			case 'T':
+				tiled = 1;
+				break;
+
+			case 's':
+				steal_rows = 1;
+				break;
+
+			case 'W':
+				warm_first = 1;
+				break;
+
+			case 'O':
+				overlap_chal = 1;
+				break;
+
+			case 'M':
+				scrub = 1;
+				break;
+
+			case 'w':
+				nworkers = atoi(optarg);
+				if (nworkers < 1) {
+					fprintf(stderr, "Number of workers must be at least 1\n");
+					exit(1);
+				}
+				break;
+
+			case 'E':
+				epoll_front = 1;
+				break;
+
 			case 'v':
 				verbose = 1;
 				break;
@@ -106,6 +301,35 @@ done_opts:
 		printf("Verbose output requested\n");
 	}
 
+	reader = row_reader_default();
+	if (reader_name) {
+		int b = row_reader_lookup(reader_name);
+		if (b < 0) {
+			fprintf(stderr, "Row reader <%s> is unknown\n", reader_name);
+			return 4;
+		}
+		reader = b;
+	}
+
+	if (numa_aware) {
+		numa_topo_load(&topo);
+		fprintf(stderr, "NUMA-aware audits over %d node(s)\n", topo.nnodes);
+		// MAP_POPULATE would fault the whole file in from this thread, onto
+		// its node; instead each pinned audit thread prefaults its own rows
+		if (reader == ROW_READER_MMAP_POPULATE) {
+			reader = ROW_READER_MMAP;
+			numa_prefault = true;
+			fprintf(stderr, "each audit thread prefaults its own rows of the mapping, rather than MAP_POPULATE\n");
+		}
+	}
+
+	kernel = select_audit_kernel(kernel_name);
+	if (!kernel) {
+		fprintf(stderr, "Audit kernel <%s> is unknown or not supported on this cpu\n", kernel_name);
+		return 4;
+	}
+	fprintf(stderr, "Using %s audit kernel%s\n", kernel->name, selfcheck ? " (self-check mode)" : "");
+
 	// read in dimensions
 	uint64_t n, m;
 	my_fread(&n, sizeof(uint64_t), 1, fconfig);
@@ -118,7 +342,11 @@ done_opts:
 	char path[pathSize];
 	my_fread(path, 1, pathSize, fconfig);
 	printf("Going to open file <%s> of length %d\n", path, pathSize);
-	dataMatrix = fopen(path, "r");
+	dataMatrix = open_data_matrix(path);
+	if (compressed_store) {
+		if (!dataMatrix) return 1;
+		fprintf(stderr, "<%s> is a compressed store; updates are disabled\n", path);
+	}
 
 	// load Merkle context
 	store_info_t sinfo;
@@ -128,6 +356,38 @@ done_opts:
 	}
 	init_work_space(&sinfo, &wspace);
 	update_signature(&sinfo, wspace.ctx);
+	if (scrub) {
+		if (!scrub_tree_open(&scrub_tree, fileno(fmerkle), &sinfo)) {
+			fprintf(stderr, "ERROR: could not map the Merkle tree for scrubbing\n");
+			return 1;
+		}
+		fprintf(stderr, "Scrubbing audited rows against %"PRIu64" Merkle leaves\n", sinfo.nblocks);
+		// a scrub hashes every row, in file order, whole and as the audit reads it
+		if (uring_depth) {
+			fprintf(stderr, "scrub: io_uring is off, as it completes rows out of order\n");
+		}
+		if (overlap_chal) {
+			fprintf(stderr, "scrub: overlapped audits are off; challenges are read whole first\n");
+		}
+		if (share_slots) {
+			fprintf(stderr, "scrub: shared scans are off; each audit scans the rows itself\n");
+		}
+	}
+	// the event loop serves its proofs from the mapping; without it they
+	// can read their hashes from the file instead
+	if (!proof_tree_open(&proof_tree, fileno(fmerkle))) {
+		if (epoll_front) {
+			fprintf(stderr, "ERROR: could not map the Merkle tree for the event loop\n");
+			return 1;
+		}
+		fprintf(stderr, "could not map the Merkle tree; proofs read their hashes from the file\n");
+	}
+
+	// shared memory for the children to coordinate audit scans
+	if (share_slots) {
+		scan_share = scan_share_create(share_slots, n, m);
+		fprintf(stderr, "Sharing audit scans among up to %"PRIu32" challenges\n", share_slots);
+	}
 
 	// open TCP socket
 	server = socket(AF_INET, SOCK_STREAM, 0);
@@ -154,17 +414,60 @@ done_opts:
 	}
 
 	// start listening
-	listen(server, 1);
+	listen(server, SOMAXCONN);
 	fprintf(stderr, "Listening...\n");
 
+	// an event loop hands its audits and updates to a pool of workers
+	int handoff[2] = {-1, -1};
+	if (epoll_front) {
+		if (!nworkers) nworkers = 1;
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, handoff) != 0) {
+			perror("socketpair");
+			return 1;
+		}
+	}
+
+	if (nworkers) {
+		// the workers inherit the mapped rows; each opens its own streams
+		// for retrievals, so their file offsets stay apart
+		row_source_t src;
+		if (!audit_source(&src, path, BYTES_UNDER_P * n)) {
+			fprintf(stderr, "ERROR: could not open <%s> for reading rows\n", path);
+			return 5;
+		}
+		npool = nworkers + epoll_front;
+		fprintf(stderr, "Starting %d workers%s\n", nworkers, epoll_front ? " behind an event loop" : "");
+		int slot = run_worker_pool();
+		fclose(dataMatrix);
+		fclose(fmerkle);
+		dataMatrix = open_data_matrix(path);
+		fmerkle = fopen(argv[optind+1], "r");
+		if (!dataMatrix || !fmerkle) {
+			fprintf(stderr, "ERROR: worker %d could not open the data and Merkle files\n", (int)getpid());
+			return 1;
+		}
+		if (epoll_front && slot == 0) {
+			event_loop_run(server, handoff[0], path, &proof_tree, &sinfo);
+		}
+		drop_on_error = true;
+	}
+
 	// make the connection when it comes
-	// after one connection is through, take the next
+	// after one connection is through, take the next; pool workers take
+	// turns accepting and serve each connection themselves, or behind an
+	// event loop, take turns at the connections it hands off, whose op byte
+	// it has already read
 	socklen_t sin_size = sizeof(struct sockaddr_in);
-	while( (clientfd = accept(server, (struct sockaddr*) &client_addr, &sin_size)) >= 0 ) {
+	// forked children are reaped as they exit, so a dead one is gone when
+	// the shared scan checks on the processes holding its slots
+	signal(SIGCHLD, SIG_IGN);
+	char mode;
+	while( (clientfd = epoll_front ? handoff_recv(handoff[1], &mode)
+				: accept(server, (struct sockaddr*) &client_addr, &sin_size)) >= 0 ) {
 
 		fprintf(stderr, "\nConnection made on server side\n");
 
-		pid_t c_pid = fork();
+		pid_t c_pid = nworkers ? 0 : fork();
 
 		if (c_pid == 0) {
 
@@ -173,141 +476,45 @@ done_opts:
 
 			// read mode type from user
 			// char 'A' (65) for audit
+			// char 'X' (88) for extended audit
 			// char 'R' (82) for retrieve
+			// char 'P' (80) for retrieve with the proof worked out here
 			// char 'U' (85) for update
-			char mode;
-			int gotem = read(clientfd, &mode, 1);
-			assert (gotem == 1);
+			// char 'F' (70) for framed requests
+			if (!epoll_front && read(clientfd, &mode, 1) != 1) {
+				mode = '\0';  // gone before saying what it wanted
+			}
 			fprintf(stderr, "\nTest Child\n");
 
 			// perform operation
 			switch (mode) {
-				case 'A':
+				case AUDIT_OP:
 					/*audit stuff*/
-					{
-						fprintf(stderr, "Entering Audit Mode...\n");
-#ifdef POR_MMAP
-						fprintf(stderr, "using mmap for file reads\n");
-#else // no MMAP
-						fprintf(stderr, "using pread for file reads\n");
-#endif // POR_MMAP
-
-						uint64_t *challenge1 = malloc(n * sizeof *challenge1);
-						uint64_t *dot_prods1 = malloc(m * sizeof *dot_prods1);
-
-						my_fread(challenge1, sizeof *challenge1, n, client);
-						char ack = '1';
-						my_fwrite(&ack, 1, 1, client);
-						fflush(client);
-
-						fprintf(stderr, "Read %"PRIu64" bytes from client.\n", n * sizeof *challenge1);
-
-						struct timespec timer, cpu_timer;
-						start_time(&timer);
-						start_cpu_time(&cpu_timer);
-
-						struct stat s;
-						stat(path, &s);
-						uint64_t filenm = s.st_size;
-						uint64_t bytes_per_row = BYTES_UNDER_P * n;
-						assert (n % 8 == 0);
-						static const uint64_t CHUNK_MASK = (UINT64_C(1) << (8 * BYTES_UNDER_P)) - 1;
-
-#pragma omp parallel
-						{
-							fprintf(stderr, "thread %d starting matrix-vector mul\n", omp_get_thread_num());
-							int fd = open(path, O_RDONLY);
-							assert (fd >= 0);
-#ifdef POR_MMAP
-							void *fdmap = mmap(NULL, filenm, PROT_READ, MAP_PRIVATE, fd, 0);
-							assert (fdmap != MAP_FAILED);
-							close(fd);
-#else // no MMAP
-							uint64_t *raw_row = malloc(bytes_per_row);
-							assert (raw_row);
-#endif // POR_MMAP
-
-#pragma omp for schedule(static) nowait
-							for (size_t i = 0; i < m; ++i) {
-								// get a pointer to the row
-#ifdef POR_MMAP
-								uint64_t *raw_row;
-								if (i < m-1) {
-									raw_row = fdmap + (bytes_per_row * i);
-								}
-								else {
-									raw_row = calloc(bytes_per_row, 1);
-									memcpy(raw_row, fdmap + (bytes_per_row * i), filenm - (bytes_per_row * i));
-								}
-#else // no MMAP
-								my_pread(fd, raw_row, bytes_per_row, bytes_per_row * i);
-#endif // POR_MMAP
-
-								// XXX: this part assumes BYTES_UNDER_P equals 7
-								// dot product accross the row, 56 bytes (8 chunks) at a time
-								uint128_t row_val = 0;
-								size_t accum_count = 0;
-								for (size_t raw_ind = 0, full_ind = 0; full_ind < n; raw_ind += 7, full_ind += 8) {
-									// avoid overflow using mod when needed
-									if ((accum_count += 8) > MAX_ACCUM_P) {
-										row_val %= P57;
-										accum_count = 8;
-									}
-
-									uint128_t data_val = raw_row[raw_ind] & CHUNK_MASK;
-									row_val += data_val * challenge1[full_ind];
-
-									for (int k = 1; k < 7; ++k) {
-										data_val = (raw_row[raw_ind + k - 1] >> (64 - k*8))
-											| ((raw_row[raw_ind + k] << (k*8)) & CHUNK_MASK);
-										row_val += data_val * challenge1[full_ind + k];
-									}
-
-									data_val = raw_row[raw_ind + 6] >> 8;
-									row_val += data_val * challenge1[full_ind + 7];
-								}
-								// XXX (end assumption that BYTES_UNDER_P equals 7)
-
-								// mod final result and save to shared vector
-								dot_prods1[i] = row_val % P57;
-
-#ifdef POR_MMAP
-								if (i == m-1) {
-									free(raw_row);
-								}
-#endif // POR_MMAP
-							}
-
-#ifdef POR_MMAP
-							munmap(fdmap, filenm);
-#else // no MMAP
-							free(raw_row);
-							close(fd);
-#endif // POR_MMAP
+					fprintf(stderr, "Entering Audit Mode...\n");
+					serve_audit(client, path, n, m, 1, 0);
+					break;
 
-							fprintf(stderr, "thread %d finished matrix-vector mul\n", omp_get_thread_num());
+				case AUDIT_EXT_OP:
+					/*extended audit stuff*/
+					{
+						fprintf(stderr, "Entering Extended Audit Mode...\n");
+						audit_req_t areq;
+						if (!my_fread(&areq, sizeof areq, 1, client)) break;
+						if (areq.nchal == 0 || areq.nchal > AUDIT_MAX_CHAL || (areq.flags & ~AUDIT_KNOWN_FLAGS)) {
+							fprintf(stderr, "ERROR: invalid extended audit request (%"PRIu32" challenges, flags %#"PRIx32")\n",
+									areq.nchal, areq.flags);
+							break;
 						}
-
-						double server_cpu_time = stop_cpu_time(&cpu_timer);
-						double server_comp_time = stop_time(&timer);
-
-						// write response back to client
-						start_time(&timer);
-						my_fwrite(dot_prods1, sizeof *dot_prods1, m, client);
-						fflush(client);
-						fprintf(stderr, "Wrote %"PRIu64" bytes to client.\n", m * sizeof *dot_prods1);
-
-						// receive communication time from client and compute total, print out
-						double comm_time = 0;
-						my_fread(&comm_time, sizeof comm_time, 1, client);
-						comm_time+= stop_time(&timer);
-						fprintf(stderr, "***SERVER COMP TIME: %f ***\n***SERVER CPU  TIME: %f ***\n***SERVER COMM TIME: %f ***\n", server_comp_time, server_cpu_time, comm_time);
-
-						free(challenge1);
-						free(dot_prods1);
+						serve_audit(client, path, n, m, areq.nchal, areq.flags);
 					}
 					break;
 
+				case FRAME_PROTO_OP:
+					/*any number of requests*/
+					fprintf(stderr, "Entering Framed Mode...\n");
+					serve_frames(client, path, n, m, &sinfo);
+					break;
+
 				case 'R':
 					/*retrieve stuff*/
 					fprintf(stderr, "Entering Retrieve Mode...\n");
@@ -317,33 +524,62 @@ done_opts:
 					uint64_t index, block_count, block_offset;
 					// get index, read, and send one hash at a time
 					char* hash = malloc(sinfo.hash_size);
-					my_fread(&nhash, sizeof(uint32_t), 1, client);
-					for (uint32_t i = 0; i < nhash; i++) {
-						my_fread(&index, sizeof(uint64_t), 1, client);
+					bool got = my_fread(&nhash, sizeof(uint32_t), 1, client);
+					for (uint32_t i = 0; got && i < nhash && !client_gone; i++) {
+						if (!(got = my_fread(&index, sizeof(uint64_t), 1, client))) break;
 						read_hash(index, hash, fmerkle, &sinfo);
 						my_fwrite(hash, sinfo.hash_size, 1, client);
 					}
 					// read all needed blocks and send them to client
-					my_fread(&block_count, sizeof(uint64_t), 1, client);
-					my_fread(&block_offset, sizeof(uint64_t), 1, client);
-					my_fread(&lbsize, sizeof(uint32_t), 1, client);
-					send_blocks(block_offset, block_count, lbsize, dataMatrix, client, &sinfo);
+					got = got && my_fread(&block_count, sizeof(uint64_t), 1, client)
+						&& my_fread(&block_offset, sizeof(uint64_t), 1, client)
+						&& my_fread(&lbsize, sizeof(uint32_t), 1, client);
+					if (got) send_blocks(block_offset, block_count, lbsize, dataMatrix, client, &sinfo);
 
 					fflush(client);
 					rewind(dataMatrix);
 					free(hash);
 					break;
 
+				case PROOF_READ_OP:
+					/*retrieve stuff, proof and all*/
+					fprintf(stderr, "Entering Proof Retrieve Mode...\n");
+					{
+						uint64_t range[2];
+						proof_plan_t plan;
+						struct iovec iov[PROOF_MAX_HASHES];
+						proof_reply_t reply = {.status = PROOF_OK, .nhash = 0};
+						if (!my_fread(range, sizeof(uint64_t), 2, client)) break;
+						if (plan_proof(&plan, iov, range[0], range[1], &sinfo)) {
+							reply.nhash = plan.nhash;
+						}
+						else {
+							fprintf(stderr, "ERROR: bytes "_CHUNK_SPECIFIER"+"_CHUNK_SPECIFIER" are not in the data\n",
+									range[0], range[1]);
+							reply.status = PROOF_INVALID;
+						}
+						my_fwrite(&reply, sizeof reply, 1, client);
+						if (reply.status == PROOF_OK) send_proof(&plan, iov, dataMatrix, client, &sinfo);
+						fflush(client);
+					}
+					break;
+
 				case 'U':
 					/*update stuff*/
 					fprintf(stderr, "Entering Update Mode...\n");
+					if (compressed_store) {
+						// the exchange has no way to say no, so the
+						// connection is dropped before anything is read
+						fprintf(stderr, "ERROR: cannot update a compressed store; closing the connection\n");
+						break;
+					}
 
 					// read first and last byte values
 					uint64_t initial;
 					uint64_t final;
-					my_fread(&initial, sizeof(uint64_t), 1, client);
+					if (!my_fread(&initial, sizeof(uint64_t), 1, client)) break;
 					fprintf(stderr, "Received initial index "_CHUNK_SPECIFIER"\n", initial);
-					my_fread(&final, sizeof(uint64_t), 1, client);
+					if (!my_fread(&final, sizeof(uint64_t), 1, client)) break;
 					fprintf(stderr, "Received final index "_CHUNK_SPECIFIER"\n", final);
 
 					// read new values in order and update
@@ -365,8 +601,9 @@ done_opts:
 							if (curr == initial) oldByte += (initial % sizeof(uint64_t));
 						}
 
-						// read next updated byte value from client
-						my_fread(&curByte, 1, 1, client);
+						// read next updated byte value from client; a client
+						// gone mid-update leaves the rest of the chunk alone
+						if (!my_fread(&curByte, 1, 1, client)) break;
 
 						// update the old value for this byte
 						*oldByte = curByte;
@@ -395,7 +632,8 @@ done_opts:
 					my_fwrite("ERROR: Invalid mode given\n", 1, 27, client);
 			}
 			fclose(client);
-			return 0;
+			if (!nworkers) return 0;
+			client_gone = false;
 		} else if (c_pid > 0) {
 			// parent needs to close socket given to child
 			close(clientfd);
@@ -408,6 +646,8 @@ done_opts:
 	printf("By return 0\n");
 	fclose(dataMatrix);
 	fclose(fmerkle);
+	scrub_tree_close(&scrub_tree);
+	proof_tree_close(&proof_tree);
 	clear_work_space(&wspace);
 	return 0;
 }
@@ -420,6 +660,9 @@ void my_exits() {
 
 void handler(int signum) {
 	printf("In the handler...\n");
+	for (int w = 0; worker_pids && w < npool; ++w) {
+		if (worker_pids[w] > 0) kill(worker_pids[w], SIGTERM);
+	}
 	fclose(fconfig);
 	fclose(fmerkle);
 	fclose(dataMatrix);
@@ -430,16 +673,137 @@ void handler(int signum) {
 }
 
 
-void my_fread(void* ptr, size_t size, size_t nmemb, FILE* stream) {
-	if (fread(ptr, size, nmemb, stream) != nmemb) {
+/* Opens the data file for retrievals and updates; a compressed store is
+ * read through a stream of its logical bytes. */
+FILE* open_data_matrix(const char* path) {
+	FILE* data = fopen(path, "r");
+	if (data && zframes_probe(fileno(data))) {
+		fclose(data);
+		compressed_store = true;
+#ifdef POR_ZLIB
+		data = zframes_fopen(path);
+#else
+		fprintf(stderr, "ERROR: <%s> is a compressed store, and this build has no zlib\n", path);
+		data = NULL;
+#endif
+	}
+	return data;
+}
+
+
+/* Forks the npool processes of the pool, then waits in this process and
+ * replaces any that exits, as a worker does when a client errors out.
+ * Returns only in the pool, with the process's slot; with an event loop,
+ * slot 0 runs it. */
+int run_worker_pool(void) {
+	worker_pids = calloc(npool, sizeof *worker_pids);
+	assert (worker_pids);
+	while (true) {
+		for (int w = 0; w < npool; ++w) {
+			if (worker_pids[w] > 0) continue;
+			pid_t pid = fork();
+			if (pid == 0) {
+				free(worker_pids);
+				worker_pids = NULL;
+				return w;
+			}
+			if (pid < 0) {
+				fprintf(stderr, "ERROR: fork unsuccessful\n");
+				exit(1);
+			}
+			worker_pids[w] = pid;
+		}
+
+		int status;
+		pid_t done = waitpid(-1, &status, 0);
+		if (done < 0) {
+			if (errno == EINTR) continue;
+			perror("waitpid");
+			exit(1);
+		}
+		for (int w = 0; w < npool; ++w) {
+			if (worker_pids[w] != done) continue;
+			fprintf(stderr, "%s %d exited; starting another\n",
+					(epoll_front && w == 0) ? "event loop" : "worker", (int)done);
+			worker_pids[w] = 0;
+		}
+	}
+}
+
+
+void* reuse_buf_get(reuse_buf_t* b, size_t bytes) {
+	if (bytes > b->bytes) {
+		free(b->ptr);
+		int ret = posix_memalign(&b->ptr, 64, bytes);
+		assert (ret == 0);
+		b->bytes = bytes;
+	}
+	return b->ptr;
+}
+
+
+/* Sets src to the rows of the data file. The source is opened on first use
+ * and kept for the life of the process, so a pool worker maps the file
+ * once, not for every audit; callers must not close it. Updates since
+ * reach its shared mapping, but not what the source copied out of it:
+ * each audit opens it again if the file is no longer the size it was, and
+ * otherwise copies its partial last row afresh. A process runs one audit
+ * at a time, so none is still using what this replaces. */
+bool audit_source(row_source_t* src, const char* path, uint64_t bytes_per_row) {
+	static row_source_t kept;
+	static bool opened = false;
+	if (opened && row_source_resized(&kept)) {
+		row_source_close(&kept);
+		opened = false;
+	}
+	else if (opened) {
+		row_source_refresh_tail(&kept);
+	}
+	if (!opened) {
+		if (!row_source_open(&kept, path, bytes_per_row, reader)) return false;
+		opened = true;
+	}
+	assert (kept.row_bytes == bytes_per_row);
+	*src = kept;
+	return true;
+}
+
+
+/* Notes that the connection being served is broken. A pool worker, or a
+ * worker behind the event loop, keeps going and drops the connection once
+ * the request is through, so that one bad client does not take it down;
+ * until then, reads fail and writes do nothing. */
+static void drop_client(const char* what) {
+	if (!__atomic_exchange_n(&client_gone, true, __ATOMIC_RELAXED)) {
+		fprintf(stderr, "ERROR: did not %s proper amount; dropping the connection\n", what);
+	}
+}
+
+
+/* Reads nmemb items or, failing that, exits; a pool worker instead drops
+ * the client and returns false, and the request must stop there, as what
+ * was read is not all there. */
+bool my_fread(void* ptr, size_t size, size_t nmemb, FILE* stream) {
+	size_t got = __atomic_load_n(&client_gone, __ATOMIC_RELAXED) ? 0 : fread(ptr, size, nmemb, stream);
+	if (got != nmemb) {
+		if (drop_on_error) {
+			drop_client("read");
+			return false;
+		}
 		fprintf(stderr, "ERROR: did not read proper amount\n");
 		exit(1);
 	}
+	return true;
 }
 
 
 void my_fwrite(void* ptr, size_t size, size_t nmemb, FILE* stream) {
+	if (__atomic_load_n(&client_gone, __ATOMIC_RELAXED)) return;
 	if (fwrite(ptr, size, nmemb, stream) != nmemb) {
+		if (drop_on_error) {
+			drop_client("write");
+			return;
+		}
 		fprintf(stderr, "ERROR: did not write proper amount\n");
 		exit(1);
 	}
@@ -480,6 +844,24 @@ bool read_hash(uint64_t index, char* hash, FILE* merkle, const store_info_t* inf
 
 bool send_blocks(uint64_t offset, uint64_t count, uint32_t lbsize, FILE* data, FILE* sock, const store_info_t* info) {
 	printf("Reading blocks "_CHUNK_SPECIFIER"--"_CHUNK_SPECIFIER" from data\n", offset, offset+count-1);
+	if (!count) return true;
+
+	// the blocks are contiguous in the file, so the kernel can send them
+	// all in one go; the cork keeps whatever sock has buffered ahead of
+	// them from leaving as a segment of its own
+	if (fileno(data) >= 0) {
+		uint64_t len = (count - 1) * info->block_size + lbsize;
+		tcp_cork(fileno(sock), true);
+		fflush(sock);
+		int64_t sent = sendfile_some(fileno(sock), fileno(data), offset * info->block_size, len);
+		tcp_cork(fileno(sock), false);
+		if (sent != (int64_t)len) {
+			fprintf(stderr, "ERROR: sending blocks from data file\n");
+			return false;
+		}
+		return true;
+	}
+
 	if (fseek(data, offset * info->block_size, SEEK_SET)) {
 		fprintf(stderr, "ERROR: seek to block "_CHUNK_SPECIFIER" in data file\n", offset);
 		return false;
@@ -496,7 +878,7 @@ bool send_blocks(uint64_t offset, uint64_t count, uint32_t lbsize, FILE* data, F
 	}
 
 	if (count >= 3) {
-		for (uint32_t i = 0; i < count - 2; i++) {
+		for (uint32_t i = 0; i < count - 2 && !client_gone; i++) {
 			if (fread(block, info->block_size, 1, data) != 1) {
 				fprintf(stderr, "ERROR: middle read from data file\n");
 				return false;
@@ -519,3 +901,1361 @@ bool send_blocks(uint64_t offset, uint64_t count, uint32_t lbsize, FILE* data, F
 
 	return true;
 }
+
+/* Plans a read of count bytes at offset and points iov at the hashes of its
+ * proof, in the mapped tree or else in proof_hashes. Returns false if the
+ * range is not within the data.
+ */
+bool plan_proof(proof_plan_t* p, struct iovec* iov, uint64_t offset, uint64_t count, const store_info_t* info) {
+	if (!proof_plan(p, offset, count, info)) return false;
+	if (!proof_tree.map) {
+		for (uint32_t i = 0; i < p->nhash; ++i) {
+			if (!read_hash(p->ind[i], (char*)proof_hashes[i], fmerkle, info)) return false;
+			iov[i].iov_base = proof_hashes[i];
+			iov[i].iov_len = info->hash_size;
+		}
+		return true;
+	}
+	if (!proof_gather(p, &proof_tree, info->hash_size, iov)) {
+		fprintf(stderr, "ERROR: Merkle file too short for blocks "_CHUNK_SPECIFIER"+"_CHUNK_SPECIFIER"\n",
+				p->block_offset, p->block_count);
+		return false;
+	}
+	return true;
+}
+
+/* Sends the hashes of a planned proof, then its blocks, after whatever sock
+ * has buffered. The hashes go out in one writev, from where plan_proof
+ * found them.
+ */
+bool send_proof(const proof_plan_t* p, struct iovec* iov, FILE* data, FILE* sock, const store_info_t* info) {
+	printf("Sending %"PRIu32" hashes for blocks "_CHUNK_SPECIFIER"+"_CHUNK_SPECIFIER"\n",
+			p->nhash, p->block_offset, p->block_count);
+	tcp_cork(fileno(sock), true);
+	fflush(sock);
+	bool sent = writev_all(fileno(sock), iov, p->nhash)
+		&& send_blocks(p->block_offset, p->block_count, p->lbsize, data, sock, info);
+	fflush(sock);
+	tcp_cork(fileno(sock), false);
+	if (!sent) fprintf(stderr, "ERROR: sending proof\n");
+	return sent;
+}
+
+
+/* Reads the row ranges of a partial audit from the client and checks them.
+ * Returns them along with their count and total rows, or NULL if they are
+ * not valid.
+ */
+audit_range_t* read_ranges(FILE* sock, uint64_t m, uint32_t* nranges, uint64_t* rows) {
+	audit_ranges_t rreq;
+	if (!my_fread(&rreq, sizeof rreq, 1, sock)) return NULL;
+	if (rreq.nranges == 0 || rreq.nranges > AUDIT_MAX_RANGES || rreq.reserved) {
+		fprintf(stderr, "ERROR: invalid audit of %"PRIu32" row ranges\n", rreq.nranges);
+		return NULL;
+	}
+	audit_range_t *ranges = malloc(rreq.nranges * sizeof *ranges);
+	if (!my_fread(ranges, sizeof *ranges, rreq.nranges, sock)
+			|| !check_ranges(ranges, rreq.nranges, m, rows)) {
+		free(ranges);
+		return NULL;
+	}
+	*nranges = rreq.nranges;
+	return ranges;
+}
+
+
+/* Checks that row ranges are sorted, non-empty, apart and within the m
+ * rows, and counts the rows they cover. */
+bool check_ranges(const audit_range_t* ranges, uint32_t nranges, uint64_t m, uint64_t* rows) {
+	uint64_t next = 0;
+	*rows = 0;
+	for (uint32_t r = 0; r < nranges; ++r) {
+		if (ranges[r].start < next || ranges[r].count == 0
+				|| ranges[r].start >= m || ranges[r].count > m - ranges[r].start) {
+			fprintf(stderr, "ERROR: invalid row range [%"PRIu64", +%"PRIu64")\n",
+					ranges[r].start, ranges[r].count);
+			return false;
+		}
+		next = ranges[r].start + ranges[r].count;
+		*rows += ranges[r].count;
+	}
+	return true;
+}
+
+
+/* Reads nchal challenge vectors from the client, computes the matrix times
+ * each of them in one pass over the data file, and writes back the results.
+ */
+void serve_audit(FILE* sock, const char* path, uint64_t n, uint64_t m, uint32_t nchal, uint32_t flags) {
+	fprintf(stderr, "using %s for file reads\n", ROW_READER_NAMES[reader]);
+
+	// the rows to audit; all of them unless the client names ranges
+	audit_range_t whole = {.start = 0, .count = m};
+	audit_range_t *ranges = &whole;
+	uint32_t nranges = 1;
+	uint64_t rows = m;
+	if (flags & AUDIT_FLAG_RANGES) {
+		ranges = read_ranges(sock, m, &nranges, &rows);
+		if (!ranges) return;
+		fprintf(stderr, "Auditing %"PRIu64" of %"PRIu64" rows in %"PRIu32" ranges.\n", rows, m, nranges);
+	}
+
+	uint64_t *challenges = reuse_buf_get(&chal_buf, nchal * n * sizeof *challenges);
+	uint64_t *dot_prods = reuse_buf_get(&result_buf, nchal * m * sizeof *dot_prods);
+
+	struct timespec timer, cpu_timer;
+	bool overlapped = false;
+
+	if (flags & AUDIT_FLAG_SEEDED) {
+		// expand the seeds here; no ACK, the responses are the reply
+		audit_seeds_t sreq;
+		uint64_t seeds[nchal];
+		if (!my_fread(&sreq, sizeof sreq, 1, sock) || !my_fread(seeds, sizeof *seeds, nchal, sock)) {
+			if (ranges != &whole) free(ranges);
+			return;
+		}
+		if (!chal_prg_supported(sreq.prg) || sreq.reserved) {
+			fprintf(stderr, "ERROR: unsupported challenge PRG %"PRIu32"\n", sreq.prg);
+			if (ranges != &whole) free(ranges);
+			return;
+		}
+		fprintf(stderr, "Read %"PRIu32" seeds for PRG %"PRIu32" from client.\n", nchal, sreq.prg);
+
+		start_time(&timer);
+		start_cpu_time(&cpu_timer);
+		expand_challenges(sreq.prg, seeds, nchal, n, challenges);
+	}
+	else if (overlap_chal && nchal == 1 && !(flags & AUDIT_FLAG_STREAM) && !scrub) {
+		// reads the challenge, ACKs and computes, all at once
+		audit_overlapped(sock, path, n, ranges, nranges, challenges, dot_prods, &timer, &cpu_timer);
+		overlapped = true;
+	}
+	else {
+		if (!my_fread(challenges, sizeof *challenges, nchal * n, sock)) {
+			if (ranges != &whole) free(ranges);
+			return;
+		}
+		char ack = '1';
+		my_fwrite(&ack, 1, 1, sock);
+		fflush(sock);
+
+		fprintf(stderr, "Read %"PRIu64" bytes (%"PRIu32" challenges) from client.\n",
+				nchal * n * sizeof *challenges, nchal);
+
+		start_time(&timer);
+		start_cpu_time(&cpu_timer);
+	}
+
+	if (client_gone) {
+		// nobody is left to send the products to
+		if (ranges != &whole) free(ranges);
+		return;
+	}
+
+	audit_stream_t stream = {.sock = sock, .nchal = nchal, .results = dot_prods};
+	bool streaming = flags & AUDIT_FLAG_STREAM;
+	if (!overlapped) {
+		compute_audit(path, n, m, ranges, nranges, challenges, nchal, dot_prods,
+				streaming ? &stream : NULL);
+	}
+	if (streaming) {
+		audit_seg_t end = {.start = m, .count = 0, .status = AUDIT_SEG_END, .reserved = 0};
+		my_fwrite(&end, sizeof end, 1, sock);
+		fflush(sock);
+	}
+
+	double server_cpu_time = stop_cpu_time(&cpu_timer);
+	double server_comp_time = stop_time(&timer);
+
+	// write response back to client
+	start_time(&timer);
+	if (streaming) {
+		fprintf(stderr, "Streamed %"PRIu64" bytes to client.\n", nchal * rows * sizeof *dot_prods);
+	}
+	else {
+		for (uint32_t r = 0; r < nranges; ++r) {
+			my_fwrite(dot_prods + ranges[r].start * nchal, sizeof *dot_prods, ranges[r].count * nchal, sock);
+		}
+		fflush(sock);
+		fprintf(stderr, "Wrote %"PRIu64" bytes to client.\n", nchal * rows * sizeof *dot_prods);
+	}
+
+	// receive communication time from client and compute total, print out
+	double comm_time = 0;
+	my_fread(&comm_time, sizeof comm_time, 1, sock);
+	comm_time+= stop_time(&timer);
+	fprintf(stderr, "***SERVER COMP TIME: %f ***\n***SERVER CPU  TIME: %f ***\n***SERVER COMM TIME: %f ***\n", server_comp_time, server_cpu_time, comm_time);
+
+	if (ranges != &whole) free(ranges);
+}
+
+/* An audit waiting for the background thread of a framed connection. */
+typedef struct frame_job {
+	uint64_t id;
+	char *payload;
+	uint64_t length;
+	struct frame_job *next;
+} frame_job_t;
+
+typedef struct {
+	FILE *out;                 // responses; requests come in on a stream of their own
+	pthread_mutex_t out_lock;  // one response goes out at a time
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	frame_job_t *head, *tail;  // audits not yet started
+	size_t queued;
+	bool closing;              // no more requests are coming
+	const char *path;
+	uint64_t n, m;
+} frame_session_t;
+
+/* Most bytes a request payload with this op may have, or zero for an op
+ * that is not known. */
+static uint64_t frame_payload_max(uint8_t op, uint64_t n, const store_info_t *info) {
+	audit_req_t most = {.nchal = AUDIT_MAX_CHAL, .flags = AUDIT_FLAG_RANGES};
+	switch (op) {
+		case FRAME_AUDIT:
+			return frame_audit_bytes(&most, AUDIT_MAX_RANGES, n);
+		case FRAME_READ:
+			return sizeof(frame_read_t);
+		case FRAME_UPDATE:
+			return sizeof(frame_update_t) + info->size;
+		default:
+			return 0;
+	}
+}
+
+/* Sends a response with no payload. */
+static void frame_reply(frame_session_t *fs, uint64_t id, uint8_t op, uint8_t status) {
+	pthread_mutex_lock(&fs->out_lock);
+	frame_send(fs->out, id, op, status, 0, NULL);
+	fflush(fs->out);
+	pthread_mutex_unlock(&fs->out_lock);
+}
+
+/* Runs an audit request and sends its responses. */
+static void frame_audit(frame_session_t *fs, const frame_job_t *job) {
+	uint64_t n = fs->n, m = fs->m;
+	const char *pos = job->payload;
+	uint64_t left = job->length;
+	audit_req_t areq;
+	audit_ranges_t rhdr = {.nranges = 1, .reserved = 0};
+	audit_range_t whole = {.start = 0, .count = m};
+	audit_range_t *ranges = &whole;
+	uint64_t rows = m;
+	uint8_t status = FRAME_INVALID;
+
+	if (!frame_take(&pos, &left, &areq, sizeof areq)
+			|| areq.nchal == 0 || areq.nchal > AUDIT_MAX_CHAL || (areq.flags & ~FRAME_AUDIT_FLAGS)) {
+		goto done;
+	}
+	if (areq.flags & AUDIT_FLAG_RANGES) {
+		if (!frame_take(&pos, &left, &rhdr, sizeof rhdr)
+				|| rhdr.nranges == 0 || rhdr.nranges > AUDIT_MAX_RANGES || rhdr.reserved) {
+			goto done;
+		}
+	}
+	if (job->length != frame_audit_bytes(&areq, rhdr.nranges, n)) goto done;
+	if (areq.flags & AUDIT_FLAG_RANGES) {
+		ranges = malloc(rhdr.nranges * sizeof *ranges);
+		frame_take(&pos, &left, ranges, rhdr.nranges * sizeof *ranges);
+		if (!check_ranges(ranges, rhdr.nranges, m, &rows)) goto done;
+	}
+
+	uint32_t nchal = areq.nchal;
+	uint64_t *challenges = reuse_buf_get(&chal_buf, nchal * n * sizeof *challenges);
+	uint64_t *dot_prods = reuse_buf_get(&result_buf, nchal * m * sizeof *dot_prods);
+	if (areq.flags & AUDIT_FLAG_SEEDED) {
+		audit_seeds_t sreq;
+		uint64_t seeds[nchal];
+		frame_take(&pos, &left, &sreq, sizeof sreq);
+		frame_take(&pos, &left, seeds, sizeof seeds);
+		if (!chal_prg_supported(sreq.prg) || sreq.reserved) goto done;
+		expand_challenges(sreq.prg, seeds, nchal, n, challenges);
+	}
+	else {
+		frame_take(&pos, &left, challenges, nchal * n * sizeof *challenges);
+	}
+
+	struct timespec timer;
+	start_time(&timer);
+	compute_audit(fs->path, n, m, ranges, rhdr.nranges, challenges, nchal, dot_prods, NULL);
+	fprintf(stderr, "Framed audit %"PRIu64": %"PRIu32" challenges over %"PRIu64" rows in %f s\n",
+			job->id, nchal, rows, stop_time(&timer));
+
+	pthread_mutex_lock(&fs->out_lock);
+	frame_send(fs->out, job->id, FRAME_AUDIT, FRAME_OK, nchal * rows * sizeof *dot_prods, NULL);
+	for (uint32_t r = 0; r < rhdr.nranges; ++r) {
+		my_fwrite(dot_prods + ranges[r].start * nchal, sizeof *dot_prods, ranges[r].count * nchal, fs->out);
+	}
+	fflush(fs->out);
+	pthread_mutex_unlock(&fs->out_lock);
+	status = FRAME_OK;
+
+done:
+	if (status != FRAME_OK) {
+		fprintf(stderr, "ERROR: invalid framed audit request %"PRIu64"\n", job->id);
+		frame_reply(fs, job->id, FRAME_AUDIT, status);
+	}
+	if (ranges != &whole) free(ranges);
+}
+
+/* The background thread of a framed connection: runs its audits in turn. */
+static void* frame_audit_run(void *arg) {
+	frame_session_t *fs = arg;
+	pthread_mutex_lock(&fs->lock);
+	while (true) {
+		while (!fs->head && !fs->closing) pthread_cond_wait(&fs->cond, &fs->lock);
+		frame_job_t *job = fs->head;
+		if (!job) break;
+		fs->head = job->next;
+		if (!fs->head) fs->tail = NULL;
+		pthread_mutex_unlock(&fs->lock);
+
+		frame_audit(fs, job);
+		free(job->payload);
+		free(job);
+
+		pthread_mutex_lock(&fs->lock);
+		--fs->queued;
+		pthread_cond_broadcast(&fs->cond);
+	}
+	pthread_mutex_unlock(&fs->lock);
+	return NULL;
+}
+
+/* Serves a read request. Returns false if the response could not be sent
+ * whole, which leaves the connection out of step. */
+static bool frame_read(frame_session_t *fs, uint64_t id, const char *payload, uint64_t length,
+		FILE *data, const store_info_t *info) {
+	const char *pos = payload;
+	uint64_t left = length;
+	frame_read_t req;
+	proof_plan_t plan;
+	struct iovec iov[PROOF_MAX_HASHES];
+	if (!frame_take(&pos, &left, &req, sizeof req) || left
+			|| !plan_proof(&plan, iov, req.offset, req.count, info)) {
+		frame_reply(fs, id, FRAME_READ, FRAME_INVALID);
+		return true;
+	}
+
+	pthread_mutex_lock(&fs->out_lock);
+	frame_send(fs->out, id, FRAME_READ, FRAME_OK, proof_bytes(plan.nhash, plan.block_count, plan.lbsize, info), NULL);
+	bool sent = send_proof(&plan, iov, data, fs->out, info);
+	pthread_mutex_unlock(&fs->out_lock);
+	return sent;
+}
+
+/* Serves an update request; data is NULL if the file cannot be written. */
+static void frame_update(frame_session_t *fs, uint64_t id, const char *payload, uint64_t length,
+		FILE *data, const store_info_t *info) {
+	const char *pos = payload;
+	uint64_t left = length;
+	frame_update_t req;
+	if (!frame_take(&pos, &left, &req, sizeof req) || req.count == 0 || left != req.count
+			|| req.first > info->size || req.count > info->size - req.first) {
+		frame_reply(fs, id, FRAME_UPDATE, FRAME_INVALID);
+		return;
+	}
+	if (!data) {
+		frame_reply(fs, id, FRAME_UPDATE, FRAME_FAILED);
+		return;
+	}
+
+	// the entries as they were, zero past the end of the file
+	uint64_t chunks = frame_update_chunks(req.first, req.count);
+	unsigned char *raw = calloc(chunks, BYTES_UNDER_P);
+	uint64_t *old = calloc(chunks, sizeof *old);
+	assert (raw && old);
+	uint64_t start = req.first / BYTES_UNDER_P * BYTES_UNDER_P;
+	uint64_t present = chunks * BYTES_UNDER_P;
+	if (present > info->size - start) present = info->size - start;
+	if (fseek(data, start, SEEK_SET) != 0 || fread(raw, 1, present, data) != present) {
+		// nothing is written over entries that could not be read
+		fprintf(stderr, "ERROR: could not read the entries at "_CHUNK_SPECIFIER" to update\n", start);
+		frame_reply(fs, id, FRAME_UPDATE, FRAME_INVALID);
+		free(raw);
+		free(old);
+		return;
+	}
+	for (uint64_t k = 0; k < chunks; ++k) {
+		memcpy(&old[k], raw + k * BYTES_UNDER_P, BYTES_UNDER_P);
+	}
+	bool ok = fseek(data, req.first, SEEK_SET) == 0
+		&& fwrite(pos, 1, req.count, data) == req.count
+		&& fflush(data) == 0;
+	if (ok) {
+		pthread_mutex_lock(&fs->out_lock);
+		frame_send(fs->out, id, FRAME_UPDATE, FRAME_OK, chunks * sizeof *old, old);
+		fflush(fs->out);
+		pthread_mutex_unlock(&fs->out_lock);
+		// the next audit sees the new bytes, as after 'U': audit_source
+		// refreshes the source it keeps
+		fprintf(stderr, "Data Matrix Updated at "_CHUNK_SPECIFIER"--"_CHUNK_SPECIFIER".\n",
+				req.first, req.first + req.count - 1);
+	}
+	else {
+		fprintf(stderr, "ERROR: could not update bytes at "_CHUNK_SPECIFIER"\n", req.first);
+		frame_reply(fs, id, FRAME_UPDATE, FRAME_FAILED);
+	}
+	free(raw);
+	free(old);
+}
+
+/* Serves framed requests (frame.h) until the client closes its side. Reads
+ * and updates are answered in turn as they come in; audits are queued for
+ * a background thread, so a long one does not hold up the reads, and their
+ * responses go out whenever they are done. An update waits for the audits
+ * before it.
+ */
+void serve_frames(FILE* sock, const char* path, uint64_t n, uint64_t m, const store_info_t* info) {
+	frame_session_t fs = {.path = path, .n = n, .m = m};
+	int outfd = dup(fileno(sock));
+	if (outfd < 0 || !(fs.out = fdopen(outfd, "w"))) {
+		perror("framed connection");
+		return;
+	}
+	pthread_mutex_init(&fs.out_lock, NULL);
+	pthread_mutex_init(&fs.lock, NULL);
+	pthread_cond_init(&fs.cond, NULL);
+	pthread_t auditor;
+	if (pthread_create(&auditor, NULL, frame_audit_run, &fs) != 0) {
+		fprintf(stderr, "ERROR: could not start the framed audit thread\n");
+		exit(6);
+	}
+
+	// the reads and updates here get a stream of their own, apart from the
+	// one audits use; it is opened for update if the file allows
+	FILE *data = compressed_store ? NULL : fopen(path, "r+");
+	FILE *writable = data;
+	if (!data) data = open_data_matrix(path);
+
+	uint64_t served = 0;
+	frame_hdr_t hdr;
+	int got;
+	while (data && (got = frame_recv_hdr(sock, &hdr)) == 1) {
+		uint8_t status = FRAME_OK;
+		uint64_t most = frame_payload_max(hdr.op, n, info);
+		if (hdr.version != FRAME_VERSION) status = FRAME_BAD_VERSION;
+		else if (!most) status = FRAME_BAD_OP;
+		else if (hdr.length > most) status = FRAME_INVALID;
+		if (status != FRAME_OK) {
+			fprintf(stderr, "ERROR: bad frame (version %"PRIu16", op %#x, %"PRIu64" bytes)\n",
+					hdr.version, hdr.op, hdr.length);
+			frame_reply(&fs, hdr.id, hdr.op, status);
+			break;
+		}
+
+		char *payload = malloc(hdr.length ? hdr.length : 1);
+		assert (payload);
+		if (fread(payload, 1, hdr.length, sock) != hdr.length) {
+			free(payload);
+			got = -1;
+			break;
+		}
+		++served;
+
+		if (hdr.op == FRAME_AUDIT) {
+			frame_job_t *job = malloc(sizeof *job);
+			assert (job);
+			*job = (frame_job_t){.id = hdr.id, .payload = payload, .length = hdr.length, .next = NULL};
+			pthread_mutex_lock(&fs.lock);
+			while (fs.queued >= FRAME_QUEUED_AUDITS) pthread_cond_wait(&fs.cond, &fs.lock);
+			if (fs.tail) fs.tail->next = job;
+			else fs.head = job;
+			fs.tail = job;
+			++fs.queued;
+			pthread_cond_broadcast(&fs.cond);
+			pthread_mutex_unlock(&fs.lock);
+			continue;
+		}
+
+		bool ok = true;
+		if (hdr.op == FRAME_READ) {
+			ok = frame_read(&fs, hdr.id, payload, hdr.length, data, info);
+		}
+		else {
+			// the audits asked for first must not see the new bytes
+			pthread_mutex_lock(&fs.lock);
+			while (fs.queued) pthread_cond_wait(&fs.cond, &fs.lock);
+			pthread_mutex_unlock(&fs.lock);
+			frame_update(&fs, hdr.id, payload, hdr.length, writable, info);
+		}
+		free(payload);
+		if (!ok) break;
+	}
+	if (!data) fprintf(stderr, "ERROR: could not open <%s> for framed requests\n", path);
+	else if (got < 0) fprintf(stderr, "ERROR: framed connection ended part way through a request\n");
+
+	// the audits already in still get their responses
+	pthread_mutex_lock(&fs.lock);
+	fs.closing = true;
+	pthread_cond_broadcast(&fs.cond);
+	pthread_mutex_unlock(&fs.lock);
+	pthread_join(auditor, NULL);
+	fprintf(stderr, "Framed connection served %"PRIu64" requests.\n", served);
+
+	if (data) fclose(data);
+	fclose(fs.out);
+	pthread_mutex_destroy(&fs.out_lock);
+	pthread_mutex_destroy(&fs.lock);
+	pthread_cond_destroy(&fs.cond);
+}
+
+/* Multiplies the rows in the given ranges by nchal challenge vectors into
+ * results, laid out as for audit_matrix.
+ */
+void compute_audit(const char* path, uint64_t n, uint64_t m,
+		const audit_range_t* ranges, uint32_t nranges,
+		const uint64_t* challenges, uint32_t nchal, uint64_t* results,
+		audit_stream_t* stream) {
+	// streamed responses go out from inside the scan, and a shared scan
+	// covers every row, so neither partial nor streamed audits share;
+	// scrubs hash rows in file order, which a shared scan does not keep
+	bool whole = nranges == 1 && ranges[0].start == 0 && ranges[0].count == m;
+	if (stream || !whole || !scan_share || scrub || !shared_audit(path, challenges, nchal, results)) {
+		for (uint32_t r = 0; r < nranges; ++r) {
+			audit_matrix(path, n, ranges[r].start, ranges[r].start + ranges[r].count,
+					challenges, nchal, results, stream);
+		}
+	}
+}
+
+/* Compares the stored products of row i against the scalar loop. */
+static void selfcheck_row(const uint64_t *raw_row, size_t i, const audit_chal_t *chals,
+		uint32_t nchal, uint64_t n, uint64_t *results, size_t *mismatches)
+{
+	uint64_t *row_res = results + i * nchal;
+	for (uint32_t j = 0; j < nchal; ++j) {
+		uint64_t expected = row_dot_reference(raw_row, &chals[j], 0, n);
+		if (row_res[j] != expected) {
+			fprintf(stderr, "SELF-CHECK MISMATCH on row %zu, challenge %"PRIu32": %s gave %"PRIu64", scalar gave %"PRIu64"\n",
+					i, j, kernel->name, row_res[j], expected);
+			row_res[j] = expected;
+#pragma omp atomic
+			++*mismatches;
+		}
+	}
+}
+
+/* Computes and stores the products of one row with every challenge; in a
+ * sparse file, whose extents are given in sparse, only over the columns
+ * that hold data. */
+static void audit_row(const uint64_t *raw_row, size_t i, const extent_map_t *sparse,
+		const audit_chal_t *chals, uint32_t nchal, uint64_t n, uint64_t *results, size_t *mismatches)
+{
+	col_range_t cols[SPARSE_MAX_COL_RANGES];
+	size_t ncols = sparse ? extent_map_row_cols(sparse, BYTES_UNDER_P * n * i, n, cols) : 0;
+	if (sparse && !(ncols == 1 && cols[0].ncols == n)) {
+		uint64_t *row_res = results + i * nchal;
+		memset(row_res, 0, nchal * sizeof *row_res);
+		for (size_t r = 0; r < ncols; ++r) {
+			row_dot_multi_add(kernel->fn, raw_row, chals, nchal, cols[r].col, cols[r].ncols, row_res);
+		}
+	}
+	else {
+		row_dot_multi(kernel->fn, raw_row, chals, nchal, n, results + i * nchal);
+	}
+	if (selfcheck) {
+		selfcheck_row(raw_row, i, chals, nchal, n, results, mismatches);
+	}
+}
+
+/* Computes and stores the products of count consecutive rows, starting at
+ * row i, with every challenge, a column tile at a time. */
+static void audit_band(const uint64_t *const *rows, size_t i, size_t count,
+		const audit_chal_t *chals, uint32_t nchal, uint64_t n, size_t tile_cols,
+		uint64_t *results, size_t *mismatches)
+{
+	row_dot_tiled(kernel->fn, rows, count, chals, nchal, n, tile_cols, results + i * nchal);
+	if (selfcheck) {
+		for (size_t r = 0; r < count; ++r) {
+			selfcheck_row(rows[r], i + r, chals, nchal, n, results, mismatches);
+		}
+	}
+}
+
+/* Bookkeeping for streamed responses, shared by the audit threads: the rows
+ * are cut into segments of STREAM_SEG_ROWS, and whichever thread finishes
+ * the last row of a segment sends it, in whatever order that happens. With
+ * work stealing, the rows of one segment may be done by several threads. */
+typedef struct {
+	audit_stream_t *stream;  // NULL when not streaming
+	size_t lo, hi;
+	uint32_t *done;          // rows finished in each segment
+	bool *failed;            // some row of the segment could not be computed
+} stream_tracker_t;
+
+static void stream_tracker_init(stream_tracker_t *tr, audit_stream_t *stream, size_t lo, size_t hi) {
+	size_t nsegs = (hi - lo + STREAM_SEG_ROWS - 1) / STREAM_SEG_ROWS;
+	tr->stream = stream;
+	tr->lo = lo;
+	tr->hi = hi;
+	tr->done = stream ? calloc(nsegs + 1, sizeof *tr->done) : NULL;
+	tr->failed = stream ? calloc(nsegs + 1, sizeof *tr->failed) : NULL;
+}
+
+static void stream_tracker_clear(stream_tracker_t *tr) {
+	free(tr->done);
+	free(tr->failed);
+}
+
+/* Marks row i done, or failed, and sends its segment if it is complete. */
+static void stream_row_done(stream_tracker_t *tr, size_t i, bool ok) {
+	if (!tr->stream) return;
+	size_t seg = (i - tr->lo) / STREAM_SEG_ROWS;
+	size_t start = tr->lo + seg * STREAM_SEG_ROWS;
+	size_t count = (tr->hi - start < STREAM_SEG_ROWS) ? tr->hi - start : STREAM_SEG_ROWS;
+	if (!ok) __atomic_store_n(&tr->failed[seg], true, __ATOMIC_RELEASE);
+	// acq_rel so the last thread also sees the other threads' results
+	if (__atomic_add_fetch(&tr->done[seg], 1, __ATOMIC_ACQ_REL) < count) return;
+
+	audit_stream_t *st = tr->stream;
+	audit_seg_t hdr = {.start = start, .count = count, .reserved = 0};
+	hdr.status = __atomic_load_n(&tr->failed[seg], __ATOMIC_ACQUIRE) ? AUDIT_SEG_FAILED : AUDIT_SEG_OK;
+#pragma omp critical(audit_stream)
+	{
+		my_fwrite(&hdr, sizeof hdr, 1, st->sock);
+		if (hdr.status == AUDIT_SEG_OK) {
+			my_fwrite((void*)(st->results + start * st->nchal), sizeof *st->results, count * st->nchal, st->sock);
+		}
+		fflush(st->sock);
+	}
+}
+
+/* In a sparse file, a row with no data has all-zero products and need not
+ * be read; this stores them and returns true for such a row. */
+static bool audit_hole_row(size_t i, const extent_map_t *sparse, uint32_t nchal, uint64_t n,
+		uint64_t *results, stream_tracker_t *tr)
+{
+	uint64_t bytes_per_row = BYTES_UNDER_P * n;
+	if (!sparse || extent_map_has_data(sparse, bytes_per_row * i, bytes_per_row * (i + 1))) {
+		return false;
+	}
+	memset(results + i * nchal, 0, nchal * sizeof *results);
+	stream_row_done(tr, i, true);
+	return true;
+}
+
+/* Audits rows [lo, hi) through an io_uring queue, keeping up to its depth
+ * of row reads in flight and computing each row as its read completes.
+ * With direct set, fd is opened O_DIRECT and each read covers the aligned
+ * span around the row. */
+static void audit_rows_uring(uring_reader_t *ur, int fd, bool direct, size_t lo, size_t hi,
+		const extent_map_t *sparse, const audit_chal_t *chals, uint32_t nchal,
+		uint64_t n, uint64_t *results, size_t *mismatches, stream_tracker_t *tr)
+{
+	uint64_t bytes_per_row = BYTES_UNDER_P * n;
+	size_t next = lo;
+
+	for (unsigned slot = 0; slot < ur->depth && next < hi; ++slot, ++next) {
+		while (next < hi && audit_hole_row(next, sparse, nchal, n, results, tr)) ++next;
+		if (next == hi) break;
+		uint64_t offset = bytes_per_row * next;
+		uint64_t start = direct ? direct_span_start(offset) : offset;
+		uint64_t stop = direct ? direct_span_stop(offset, bytes_per_row) : offset + bytes_per_row;
+		uring_reader_queue(ur, fd, slot, stop - start, start, (uint64_t)next * ur->depth + slot);
+	}
+
+	while (ur->inflight) {
+		uint64_t user;
+		int res = uring_reader_wait(ur, &user);
+		size_t i = user / ur->depth;
+		unsigned slot = user % ur->depth;
+		uint64_t *raw_row = uring_reader_buf(ur, slot);
+		uint64_t offset = bytes_per_row * i;
+
+		if (res < 0) {
+			fprintf(stderr, "ERROR: io_uring read of row %zu failed: %s\n", i, strerror(-res));
+			// a streamed audit can report the failure and carry on
+			if (!tr->stream) exit(6);
+		}
+		else if (direct) {
+			uint64_t start = direct_span_start(offset);
+			if ((uint64_t)res < direct_span_stop(offset, bytes_per_row) - start) {
+				// short read, at the end of the file; redo it synchronously
+				raw_row = direct_pread_row(fd, raw_row, bytes_per_row, offset);
+			}
+			else {
+				raw_row = (uint64_t*)((char*)raw_row + (offset - start));
+			}
+		}
+		else if ((uint64_t)res < bytes_per_row) {
+			// short read; finish it directly (this zero pads the last row)
+			my_pread(fd, (char*)raw_row + res, bytes_per_row - res, offset + res);
+		}
+
+		if (res >= 0) {
+			audit_row(raw_row, i, sparse, chals, nchal, n, results, mismatches);
+		}
+		stream_row_done(tr, i, res >= 0);
+
+		while (next < hi && audit_hole_row(next, sparse, nchal, n, results, tr)) ++next;
+		if (next < hi) {
+			offset = bytes_per_row * next;
+			uint64_t start = direct ? direct_span_start(offset) : offset;
+			uint64_t stop = direct ? direct_span_stop(offset, bytes_per_row) : offset + bytes_per_row;
+			uring_reader_queue(ur, fd, slot, stop - start, start, (uint64_t)next * ur->depth + slot);
+			++next;
+		}
+	}
+}
+
+/* The order an audit takes rows [first, stop) in: file order, or with -W the
+ * cached rows first. Under -N the threads of each node start on the rows
+ * static blocks would give them, so the cached rows go first within each
+ * node's share, and no row moves off the node it was meant for. */
+static void audit_row_order(row_order_t *order, const row_source_t *src, const char* path,
+		uint64_t bytes_per_row, uint64_t first, uint64_t stop, const int *groups, size_t nthreads)
+{
+	bool direct = src->backend == ROW_READER_DIRECT;
+	bool frames = src->frames != NULL;
+	if (warm_first && direct) {
+		fprintf(stderr, "direct reads bypass the page cache; auditing rows in file order\n");
+	}
+	if (warm_first && frames) {
+		fprintf(stderr, "the cached pages of a compressed store are not its rows; auditing rows in file order\n");
+	}
+	if (!warm_first || direct || frames) {
+		row_order_identity(order, first, stop);
+		return;
+	}
+
+	row_order_t parts[nthreads];
+	size_t nparts = 0;
+	for (size_t t = 0; t < nthreads; ) {
+		size_t t_end = t + 1;
+		while (t_end < nthreads && groups[t_end] == groups[t]) ++t_end;
+		uint64_t lo = first + (stop - first) * t / nthreads;
+		uint64_t hi = first + (stop - first) * t_end / nthreads;
+		if (!row_order_residency(&parts[nparts], path, src->map, src->file_size, bytes_per_row, lo, hi)) {
+			while (nparts) row_order_clear(&parts[--nparts]);
+			row_order_identity(order, first, stop);
+			return;
+		}
+		++nparts;
+		t = t_end;
+	}
+	row_order_concat(order, parts, nparts);
+	fprintf(stderr, "residency: %"PRIu64" of %"PRIu64" rows cached, in %zu runs; auditing those first%s\n",
+			order->resident_rows, stop - first, order->nruns, (nparts > 1) ? " on each node" : "");
+}
+
+/* Loads the extents of the data file into extents, returning them if the
+ * file has holes and NULL otherwise; the audit passes them down with its
+ * rows. The extents of a compressed store are not those of its rows, so it
+ * has none, and a scrub hashes the holes along with the rest. */
+static const extent_map_t* sparse_map_open(extent_map_t *extents, const row_source_t *src) {
+	memset(extents, 0, sizeof *extents);
+	if (!src->frames && extent_map_load(extents, src->path) && extent_map_sparse(extents)) {
+		fprintf(stderr, "sparse data file: %"PRIu64" of %"PRIu64" bytes allocated, in %zu extents\n",
+				extents->data_bytes, extents->file_size, extents->nextents);
+		if (scrub) {
+			fprintf(stderr, "scrub: the holes are read and hashed rather than skipped\n");
+			return NULL;
+		}
+		return extents;
+	}
+	return NULL;
+}
+
+static void sparse_map_close(extent_map_t *extents) {
+	extent_map_clear(extents);
+}
+
+/* Multiplies rows [first, stop) of the data matrix by nchal challenge
+ * vectors at once. Each row is read once and reused for every challenge;
+ * results holds the nchal dot products of row 0, then those of row 1, and
+ * so on, with only the audited rows filled in.
+ */
+void audit_matrix(const char* path, uint64_t n, uint64_t first, uint64_t stop,
+		const uint64_t* challenges, uint32_t nchal, uint64_t* results,
+		audit_stream_t *stream)
+{
+	uint64_t bytes_per_row = BYTES_UNDER_P * n;
+	assert (n % 8 == 0);
+	audit_chal_t chals[nchal];
+	for (uint32_t j = 0; j < nchal; ++j) {
+		audit_chal_init(&chals[j], challenges + j * n, n);
+	}
+	size_t mismatches = 0;
+
+	row_source_t src;
+	if (!audit_source(&src, path, bytes_per_row)) {
+		fprintf(stderr, "ERROR: could not open <%s> for reading rows\n", path);
+		exit(5);
+	}
+	bool direct = src.backend == ROW_READER_DIRECT;
+
+	// a band of rows shares each challenge tile while it is in L2
+	size_t tile_rows = tiled ? audit_tile_rows(bytes_per_row) : 1;
+	size_t tile_cols = audit_tile_cols(nchal, tile_rows);
+	if (tiled) {
+		fprintf(stderr, "tiled audit: bands of %zu rows, tiles of %zu columns\n", tile_rows, tile_cols);
+	}
+
+	// per node: the node-local copy of the challenges, and throughput
+	uint64_t *node_challenges[NUMA_MAX_NODES];
+	int node_threads[NUMA_MAX_NODES] = {0};
+	uint64_t node_rows[NUMA_MAX_NODES] = {0};
+	double node_secs[NUMA_MAX_NODES] = {0};
+
+	stream_tracker_t tr;
+	stream_tracker_init(&tr, stream, first, stop);
+
+	// rows of a sparse file that are all hole are never read
+	extent_map_t extents;
+	const extent_map_t *sparse = sparse_map_open(&extents, &src);
+
+	row_order_t order;
+
+	// chunks cover at least a band, and enough rows to fill the io_uring queue
+	size_t min_chunk = (uring_depth > tile_rows) ? uring_depth : tile_rows;
+	row_sched_t sched;
+
+	// each thread hashes the Merkle blocks of the rows it audits
+	int max_threads = omp_get_max_threads();
+	scrub_thread_t scrubs[scrub ? max_threads : 1];
+	for (int t = 0; scrub && t < max_threads; ++t) {
+		scrub_thread_init(&scrubs[t], &scrub_tree);
+	}
+
+#pragma omp parallel
+	{
+		fprintf(stderr, "thread %d starting matrix-vector mul\n", omp_get_thread_num());
+		// each thread starts on a contiguous block of rows, as schedule(static)
+		// would give; the threads of a node are consecutive, so so are the
+		// node's rows, and with stealing a thread looks on its own node first
+		size_t nthreads = omp_get_num_threads();
+		size_t tid = omp_get_thread_num();
+#pragma omp single
+		{
+			int groups[nthreads];
+			for (size_t t = 0; t < nthreads; ++t) {
+				groups[t] = numa_aware ? numa_thread_node(&topo, t, nthreads) : 0;
+			}
+			row_sched_init(&sched, 0, stop - first, nthreads, min_chunk, steal_rows, groups);
+			audit_row_order(&order, &src, path, bytes_per_row, first, stop, groups, nthreads);
+		}
+
+		const audit_chal_t *my_chals = chals;
+		audit_chal_t local_chals[nchal];
+		int node = 0;
+		cpu_set_t saved_cpus;
+		struct timespec timer;
+		if (numa_aware) {
+			node = numa_thread_node(&topo, tid, nthreads);
+			sched_getaffinity(0, sizeof saved_cpus, &saved_cpus);
+			sched_setaffinity(0, sizeof topo.cpus[node], &topo.cpus[node]);
+
+			// the first thread on each node copies the challenges; being
+			// pinned there, its first touch puts the copy in local memory
+			if (tid == 0 || numa_thread_node(&topo, tid - 1, nthreads) != node) {
+				node_challenges[node] = malloc(nchal * n * sizeof *challenges);
+				assert (node_challenges[node]);
+				memcpy(node_challenges[node], challenges, nchal * n * sizeof *challenges);
+			}
+#pragma omp barrier
+			for (uint32_t j = 0; j < nchal; ++j) {
+				audit_chal_init(&local_chals[j], node_challenges[node] + j * n, n);
+			}
+			my_chals = local_chals;
+
+			// the pages of the thread's own block are read in from here, so
+			// that they land on its node
+			uint64_t lo = first + (stop - first) * tid / nthreads;
+			uint64_t hi = first + (stop - first) * (tid + 1) / nthreads;
+			uint64_t from = readahead_page_down(bytes_per_row * lo);
+			uint64_t to = (bytes_per_row * hi < src.file_size) ? bytes_per_row * hi : src.file_size;
+			if (numa_prefault && src.map && to > from) {
+				madvise(src.map + from, to - from, MADV_WILLNEED);
+			}
+			start_time(&timer);
+		}
+
+		row_reader_t rr;
+		row_reader_init_band(&rr, &src, tile_rows);
+		// rows go to a hashing thread of this thread's own, made after the
+		// NUMA pinning above so that it runs on the same node
+		scrub_pipe_t pipe;
+		scrub_pipe_t *sc = NULL;
+		if (scrub) {
+			scrub_pipe_start(&pipe, &scrubs[tid], bytes_per_row);
+			sc = &pipe;
+		}
+
+		uring_reader_t ur;
+		bool use_uring = false;
+		if (uring_depth && !row_reader_mapped(src.backend) && !src.frames && !scrub) {
+			use_uring = uring_reader_init(&ur, uring_depth, direct ? direct_buf_bytes(bytes_per_row) : bytes_per_row);
+			if (!use_uring) {
+				fprintf(stderr, "thread %zu could not set up io_uring, falling back to %s\n",
+						tid, ROW_READER_NAMES[src.backend]);
+			}
+			else if (tid == 0) {
+				fprintf(stderr, "using io_uring for file reads, depth %u%s\n",
+						uring_depth, ur.fixed ? " with registered buffers" : "");
+			}
+		}
+
+		// readahead follows each contiguous run of rows the thread gets;
+		// page cache hints make no sense for reads that bypass it, nor for
+		// the offsets of rows in a compressed store
+		bool hints = !direct && !src.frames;
+		readahead_t ra = {.fd = -1}; // hints nothing until the first run
+		size_t run_end = 0, hinted_stop = 0;
+		row_chunk_t chunk;
+		while (row_sched_next(&sched, tid, &chunk)) {
+			// the scheduler hands out positions in the order, which can span runs
+			for (uint64_t pos = chunk.lo; pos < chunk.hi; ) {
+				uint64_t lo, hi, run_stop;
+				uint64_t used = row_order_map(&order, pos, chunk.hi, &lo, &hi, &run_stop);
+				// a chunk that does not carry on from the last, rows that do not
+				// follow the last, or a run that starts where the hinted one ended
+				// (a cold run after a warm one) each need hints of their own
+				if ((pos == chunk.lo && chunk.new_run) || lo != run_end || lo >= hinted_stop) {
+					// hint no further than the run, nor the thread's share of the order
+					if (run_stop - lo > chunk.run_stop - pos) run_stop = lo + (chunk.run_stop - pos);
+					hinted_stop = run_stop;
+					readahead_truncate(&ra, bytes_per_row * run_end);
+					readahead_finish(&ra);
+					uint64_t hint_stop = (bytes_per_row * run_stop < src.file_size) ? bytes_per_row * run_stop : src.file_size;
+					readahead_init(&ra, rr.fd, src.map, bytes_per_row * lo, hint_stop,
+							hints ? readahead_rows * bytes_per_row : 0, drop_behind && hints);
+				}
+				run_end = hi;
+				pos += used;
+
+				if (use_uring) {
+					audit_rows_uring(&ur, rr.fd, direct, lo, hi, sparse, my_chals, nchal, n, results, &mismatches, &tr);
+				}
+				else if (tiled) {
+					for (size_t i = lo; i < hi; i += tile_rows) {
+						size_t count = (hi - i < tile_rows) ? hi - i : tile_rows;
+						const uint64_t *rows[count];
+						readahead_advance(&ra, bytes_per_row * i);
+						if (sparse && !extent_map_dense(sparse, bytes_per_row * i, bytes_per_row * (i + count))) {
+							// bands with holes go a row at a time, skipping the empty rows
+							for (size_t r = i; r < i + count; ++r) {
+								if (audit_hole_row(r, sparse, nchal, n, results, &tr)) continue;
+								audit_row(row_reader_get(&rr, r), r, sparse, my_chals, nchal, n, results, &mismatches);
+								stream_row_done(&tr, r, true);
+							}
+							continue;
+						}
+						row_reader_get_band(&rr, i, count, rows);
+						audit_band(rows, i, count, my_chals, nchal, n, tile_cols, results, &mismatches);
+						for (size_t r = 0; r < count; ++r) {
+							if (sc) scrub_pipe_feed(sc, rows[r], bytes_per_row * (i + r));
+							stream_row_done(&tr, i + r, true);
+						}
+					}
+				}
+				else {
+					for (size_t i = lo; i < hi; ++i) {
+						if (audit_hole_row(i, sparse, nchal, n, results, &tr)) continue;
+						readahead_advance(&ra, bytes_per_row * i);
+						const uint64_t *raw_row = row_reader_get(&rr, i);
+						audit_row(raw_row, i, sparse, my_chals, nchal, n, results, &mismatches);
+						if (sc) scrub_pipe_feed(sc, raw_row, bytes_per_row * i);
+						stream_row_done(&tr, i, true);
+					}
+				}
+			}
+		}
+
+		if (sc) scrub_pipe_stop(sc);
+		readahead_truncate(&ra, bytes_per_row * run_end);
+		readahead_finish(&ra);
+		if (use_uring) uring_reader_clear(&ur);
+		row_reader_clear(&rr);
+
+		if (numa_aware) {
+			double secs = stop_time(&timer);
+			for (uint32_t j = 0; j < nchal; ++j) {
+				audit_chal_clear(&local_chals[j]);
+			}
+#pragma omp critical
+			{
+				++node_threads[node];
+				node_rows[node] += sched.w[tid].rows;
+				if (secs > node_secs[node]) node_secs[node] = secs;
+			}
+			sched_setaffinity(0, sizeof saved_cpus, &saved_cpus);
+		}
+		fprintf(stderr, "thread %d finished matrix-vector mul\n", omp_get_thread_num());
+	}
+
+	row_sched_report(&sched, stderr);
+	row_sched_clear(&sched);
+	row_order_clear(&order);
+	if (scrub) {
+		// the blocks at the edges of thread runs are read again, whole
+		size_t reread = scrub_finish(scrubs, max_threads, dataMatrix);
+		fprintf(stderr, "scrub: %"PRIu64" Merkle blocks checked, %zu of them read again; %zu corrupt\n",
+				scrubs[0].checked, reread, scrubs[0].ncorrupt);
+		for (size_t c = 0; c < scrubs[0].ncorrupt; ++c) {
+			uint64_t b = scrubs[0].corrupt[c];
+			uint64_t lo = b * scrub_tree.info.block_size, hi = scrub_block_stop(&scrub_tree, b);
+			fprintf(stderr, "ERROR: Merkle block %"PRIu64" (bytes %"PRIu64"-%"PRIu64", rows %"PRIu64"-%"PRIu64") does not match the tree\n",
+					b, lo, hi - 1, lo / bytes_per_row, (hi - 1) / bytes_per_row);
+		}
+		for (int t = 0; t < max_threads; ++t) {
+			scrub_thread_clear(&scrubs[t]);
+		}
+	}
+	sparse_map_close(&extents);
+	stream_tracker_clear(&tr);
+	if (numa_aware) {
+		for (int g = 0; g < topo.nnodes; ++g) {
+			if (!node_threads[g]) continue;
+			fprintf(stderr, "node %d: %d threads, %"PRIu64" rows in %f s, %.1f MB/s\n",
+					topo.id[g], node_threads[g], node_rows[g], node_secs[g],
+					node_rows[g] * bytes_per_row / node_secs[g] / 1e6);
+			free(node_challenges[g]);
+		}
+	}
+	for (uint32_t j = 0; j < nchal; ++j) {
+		audit_chal_clear(&chals[j]);
+	}
+	if (selfcheck) {
+		fprintf(stderr, "self-check: %zu of %"PRIu64" row products differ from the scalar loop\n", mismatches, (stop - first) * nchal);
+	}
+}
+
+
+// an overlapped audit takes the challenge in this many column tiles
+#define OVERLAP_TILES (8)
+
+// most bytes of rows an overlapped audit holds while the challenge comes in
+#define OVERLAP_HOLD_BYTES (UINT64_C(256) << 20)
+
+// rows an audit thread takes at a time while the challenge comes in
+#define OVERLAP_CHUNK_ROWS (16)
+
+/* The challenge of an overlapped audit, as it comes in off the socket. */
+typedef struct {
+	FILE *sock;
+	uint64_t *challenge;
+	uint64_t n;
+	size_t tile_cols;
+	size_t arrived;          // tiles read in full
+	double last_arrival;     // when the last tile was in
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} chal_feed_t;
+
+/* Reads the challenge a tile at a time, then ACKs it. */
+static void* chal_feed_run(void *arg) {
+	chal_feed_t *f = arg;
+	for (size_t col = 0; col < f->n; col += f->tile_cols) {
+		size_t len = (f->n - col < f->tile_cols) ? f->n - col : f->tile_cols;
+		bool got = my_fread(f->challenge + col, sizeof *f->challenge, len, f->sock);
+		pthread_mutex_lock(&f->lock);
+		++f->arrived;
+		if (col + len == f->n) f->last_arrival = omp_get_wtime();
+		if (!got) {
+			// the client is gone, so the audit threads need wait no more;
+			// what they work out is never sent
+			f->arrived = (f->n + f->tile_cols - 1) / f->tile_cols;
+		}
+		pthread_cond_broadcast(&f->cond);
+		pthread_mutex_unlock(&f->lock);
+		if (!got) return NULL;
+	}
+	char ack = '1';
+	my_fwrite(&ack, 1, 1, f->sock);
+	fflush(f->sock);
+	return NULL;
+}
+
+static void chal_feed_wait(chal_feed_t *f, size_t tiles) {
+	pthread_mutex_lock(&f->lock);
+	while (f->arrived < tiles) pthread_cond_wait(&f->cond, &f->lock);
+	pthread_mutex_unlock(&f->lock);
+}
+
+static size_t chal_feed_arrived(chal_feed_t *f) {
+	pthread_mutex_lock(&f->lock);
+	size_t arrived = f->arrived;
+	pthread_mutex_unlock(&f->lock);
+	return arrived;
+}
+
+/* Adds the products of row i, held in raw_row, over challenge tiles
+ * [from, to) to its result. Holes add nothing, so tiles over them are
+ * skipped. */
+static void overlap_apply(const uint64_t *raw_row, size_t i, const extent_map_t *sparse,
+		const audit_chal_t *ch, uint64_t n, size_t tile_cols, size_t from, size_t to, uint64_t *results)
+{
+	uint64_t bytes_per_row = BYTES_UNDER_P * n;
+	for (size_t t = from; t < to; ++t) {
+		size_t col = t * tile_cols;
+		size_t len = (n - col < tile_cols) ? n - col : tile_cols;
+		if (sparse && !extent_map_has_data(sparse, bytes_per_row * i + col * BYTES_UNDER_P,
+					bytes_per_row * i + (col + len) * BYTES_UNDER_P)) {
+			continue;
+		}
+		results[i] = p57_add(results[i], kernel->fn(raw_row, ch, col, len));
+	}
+}
+
+/* Audits the given row ranges against one challenge that is still being
+ * received. A thread reads the challenge off sock in column tiles. While
+ * it comes in, the audit threads take rows off the front of the ranges,
+ * read each of them once, add its products over the tiles already in, and
+ * hold on to it to add the rest as they arrive; on a slow link the upload
+ * of the challenge so overlaps with reading and computing. Once the whole
+ * challenge is in, or OVERLAP_HOLD_BYTES of rows are held, no more rows
+ * are taken, and the rest go through audit_matrix with the full challenge
+ * and all of its options. results ends up with the full products of the
+ * audited rows; the timers start once the first tile is in.
+ */
+void audit_overlapped(FILE* sock, const char* path, uint64_t n,
+		const audit_range_t* ranges, uint32_t nranges, uint64_t* challenge, uint64_t* results,
+		struct timespec* timer, struct timespec* cpu_timer)
+{
+	uint64_t bytes_per_row = BYTES_UNDER_P * n;
+	size_t tile_cols = (n / OVERLAP_TILES + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+	if (!tile_cols) tile_cols = CHUNK_ALIGN;
+	size_t ntiles = (n + tile_cols - 1) / tile_cols;
+
+	// rows are taken in the order of the ranges; position p is the p-th of them
+	uint64_t range_pos[nranges + 1];
+	range_pos[0] = 0;
+	for (uint32_t r = 0; r < nranges; ++r) {
+		range_pos[r + 1] = range_pos[r] + ranges[r].count;
+	}
+	uint64_t hold_max = OVERLAP_HOLD_BYTES / bytes_per_row;
+	if (hold_max > range_pos[nranges]) hold_max = range_pos[nranges];
+	// only the part of the buffer that is used gets touched
+	char *held = malloc(hold_max * bytes_per_row);
+	uint64_t *held_row = malloc(hold_max * sizeof *held_row);
+	size_t *held_tiles = malloc(hold_max * sizeof *held_tiles);
+	assert ((held && held_row && held_tiles) || !hold_max);
+
+	chal_feed_t feed = {.sock = sock, .challenge = challenge, .n = n, .tile_cols = tile_cols, .arrived = 0};
+	pthread_mutex_init(&feed.lock, NULL);
+	pthread_cond_init(&feed.cond, NULL);
+	pthread_t receiver;
+	if (pthread_create(&receiver, NULL, chal_feed_run, &feed) != 0) {
+		fprintf(stderr, "ERROR: could not start the challenge receiver thread\n");
+		exit(6);
+	}
+
+	row_source_t src;
+	if (!audit_source(&src, path, bytes_per_row)) {
+		fprintf(stderr, "ERROR: could not open <%s> for reading rows\n", path);
+		exit(5);
+	}
+	extent_map_t extents;
+	const extent_map_t *sparse = sparse_map_open(&extents, &src);
+	audit_chal_t ch;
+	audit_chal_init(&ch, challenge, n);
+	size_t mismatches = 0;
+
+	chal_feed_wait(&feed, 1);
+	start_time(timer);
+	start_cpu_time(cpu_timer);
+	double started = omp_get_wtime();
+	uint64_t cursor = 0;
+
+#pragma omp parallel
+	{
+		row_reader_t rr;
+		row_reader_init(&rr, &src);
+		while (true) {
+			size_t arrived = chal_feed_arrived(&feed);
+			if (arrived == ntiles) break;
+			uint64_t pos;
+#pragma omp atomic capture
+			{ pos = cursor; cursor += OVERLAP_CHUNK_ROWS; }
+			if (pos >= hold_max) break;
+			uint64_t stop = (hold_max - pos < OVERLAP_CHUNK_ROWS) ? hold_max : pos + OVERLAP_CHUNK_ROWS;
+			uint32_t r = 0;
+			while (range_pos[r + 1] <= pos) ++r;
+			for (; pos < stop; ++pos) {
+				while (range_pos[r + 1] <= pos) ++r;
+				size_t i = ranges[r].start + (pos - range_pos[r]);
+				uint64_t *raw_row = (uint64_t*)(held + pos * bytes_per_row);
+				memcpy(raw_row, row_reader_get(&rr, i), bytes_per_row);
+				results[i] = 0;
+				overlap_apply(raw_row, i, sparse, &ch, n, tile_cols, 0, arrived, results);
+				held_row[pos] = i;
+				held_tiles[pos] = arrived;
+			}
+		}
+		row_reader_clear(&rr);
+
+#pragma omp barrier
+		// the held rows get the rest of the tiles as they arrive
+		size_t nthreads = omp_get_num_threads();
+		size_t tid = omp_get_thread_num();
+		uint64_t nheld = (cursor < hold_max) ? cursor : hold_max;
+		uint64_t lo = nheld * tid / nthreads, hi = nheld * (tid + 1) / nthreads;
+		for (size_t t = 0; t < ntiles; ++t) {
+			chal_feed_wait(&feed, t + 1);
+			for (uint64_t pos = lo; pos < hi; ++pos) {
+				if (held_tiles[pos] > t) continue;
+				overlap_apply((const uint64_t*)(held + pos * bytes_per_row), held_row[pos], sparse,
+						&ch, n, tile_cols, t, t + 1, results);
+			}
+		}
+		if (selfcheck) {
+			for (uint64_t pos = lo; pos < hi; ++pos) {
+				selfcheck_row((const uint64_t*)(held + pos * bytes_per_row), held_row[pos],
+						&ch, 1, n, results, &mismatches);
+			}
+		}
+	}
+
+	pthread_join(receiver, NULL);
+	uint64_t nheld = (cursor < hold_max) ? cursor : hold_max;
+	double lag = feed.last_arrival - started;
+	fprintf(stderr, "overlapped audit: %zu tiles of %zu columns, the last in %f s after the first; "
+			"%"PRIu64" of %"PRIu64" rows read meanwhile\n",
+			ntiles, tile_cols, (lag > 0) ? lag : 0.0, nheld, range_pos[nranges]);
+	if (selfcheck) {
+		fprintf(stderr, "self-check: %zu of %"PRIu64" row products differ from the scalar loop\n", mismatches, nheld);
+	}
+	audit_chal_clear(&ch);
+	sparse_map_close(&extents);
+	pthread_cond_destroy(&feed.cond);
+	pthread_mutex_destroy(&feed.lock);
+	free(held);
+	free(held_row);
+	free(held_tiles);
+
+	// the rows not taken yet, now that the challenge is all in
+	for (uint32_t r = 0; r < nranges && !client_gone; ++r) {
+		if (range_pos[r + 1] <= nheld) continue;
+		uint64_t skip = (nheld > range_pos[r]) ? nheld - range_pos[r] : 0;
+		audit_matrix(path, n, ranges[r].start + skip, ranges[r].start + ranges[r].count,
+				challenge, 1, results, NULL);
+	}
+}
+
+/* Runs the shared scan, chunk by chunk, until this process's own slots are
+ * done. Called and returns with the lock held; the lock is dropped while
+ * each chunk is computed so that new audits can join in between.
+ */
+static void shared_scan_lead(scan_share_t *sh, const char* path,
+		const uint32_t *mine, uint32_t nmine)
+{
+	uint64_t n = sh->n, m = sh->m;
+	uint64_t bytes_per_row = BYTES_UNDER_P * n;
+	int nthreads = omp_get_max_threads();
+	uint64_t chunk_rows = nthreads * SCAN_CHUNK_ROWS_PER_THREAD;
+	uint32_t order[sh->nslots];
+	uint64_t rows[sh->nslots];
+	audit_chal_t chals[sh->nslots];
+	uint64_t rows_scanned = 0;
+
+	row_source_t src;
+	if (!audit_source(&src, path, bytes_per_row)) {
+		fprintf(stderr, "ERROR: could not open <%s> for reading rows\n", path);
+		exit(5);
+	}
+	row_reader_t readers[nthreads];
+	for (int t = 0; t < nthreads; ++t) {
+		row_reader_init(&readers[t], &src);
+	}
+
+	fprintf(stderr, "process %d leading shared scan from row %"PRIu64"\n", (int)getpid(), sh->cursor);
+	while (!slots_done(sh, mine, nmine)) {
+		// between chunks nothing holds on to the slots, so those whose
+		// process died waiting can go
+		scan_reclaim_slots(sh);
+
+		uint64_t start, len;
+		uint32_t nactive = scan_plan_chunk(sh, chunk_rows, order, rows, &start, &len);
+		for (uint32_t a = 0; a < nactive; ++a) {
+			audit_chal_init(&chals[a], slot_challenge(sh, order[a]), n);
+		}
+		pthread_mutex_unlock(&sh->lock);
+
+#pragma omp parallel
+		{
+			row_reader_t *rr = &readers[omp_get_thread_num()];
+			uint64_t res[nactive ? nactive : 1];
+
+#pragma omp for schedule(static)
+			for (uint64_t t = 0; t < len; ++t) {
+				uint64_t i = start + t;
+				uint32_t count = scan_chunk_wanting(rows, nactive, t);
+				if (!count) continue;
+
+				const uint64_t *raw_row = row_reader_get(rr, i);
+				row_dot_multi(kernel->fn, raw_row, chals, count, n, res);
+				for (uint32_t a = 0; a < count; ++a) {
+					slot_response(sh, order[a])[i] = res[a];
+				}
+			}
+		}
+
+		scan_lock(sh);
+		rows_scanned += len;
+		scan_finish_chunk(sh, order, rows, nactive, start, len);
+		pthread_cond_broadcast(&sh->cond);
+	}
+
+	fprintf(stderr, "process %d handing off shared scan at row %"PRIu64" after %"PRIu64" rows\n",
+			(int)getpid(), sh->cursor, rows_scanned);
+	sh->leader = 0;
+	pthread_cond_broadcast(&sh->cond);
+	for (int t = 0; t < nthreads; ++t) {
+		row_reader_clear(&readers[t]);
+	}
+}
+
+/* Computes the audit through the shared scan. Returns false, without doing
+ * anything, if there are not enough free slots for all the challenges.
+ */
+bool shared_audit(const char* path, const uint64_t* challenges, uint32_t nchal, uint64_t* results) {
+	scan_share_t *sh = scan_share;
+	uint64_t n = sh->n, m = sh->m;
+	uint32_t mine[nchal];
+	uint32_t nmine = nchal;
+	uint32_t others = 0;
+
+	scan_lock(sh);
+	// with no scan in flight, slots left behind by dead processes can go now
+	scan_check_leader(sh);
+	if (!sh->leader) scan_reclaim_slots(sh);
+	if (!scan_claim_slots(sh, nchal, mine, &others)) {
+		pthread_mutex_unlock(&sh->lock);
+		fprintf(stderr, "not enough free slots to share a scan, scanning privately\n");
+		return false;
+	}
+	for (uint32_t j = 0; j < nchal; ++j) {
+		memcpy(slot_challenge(sh, mine[j]), challenges + j * n, n * sizeof *challenges);
+	}
+	fprintf(stderr, "joined shared scan at row %"PRIu64" with %"PRIu32" other challenges in flight\n",
+			sh->cursor, others);
+
+	while (!slots_done(sh, mine, nmine)) {
+		scan_check_leader(sh);
+		if (!sh->leader) {
+			sh->leader = getpid();
+			shared_scan_lead(sh, path, mine, nmine);
+		}
+		else {
+			struct timespec deadline;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += 1;
+			if (pthread_cond_timedwait(&sh->cond, &sh->lock, &deadline) == EOWNERDEAD) {
+				pthread_mutex_consistent(&sh->lock);
+			}
+		}
+	}
+
+	for (uint32_t j = 0; j < nchal; ++j) {
+		const uint64_t *resp = slot_response(sh, mine[j]);
+		for (uint64_t i = 0; i < m; ++i) {
+			results[i * nchal + j] = resp[i];
+		}
+		sh->slots[mine[j]].state = SLOT_FREE;
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return true;
+}
@@ -0,0 +1,141 @@
+// Tests for the framed wire format of frame.h
+// frames sent back to back come back in order with their ids, ops,
+// statuses and payloads, a stream that stops part way through a header
+// is told apart from one that ends cleanly, payloads decode field by
+// field to exactly the sizes the senders work out, and the entries an
+// update touches are counted right at every alignment
+// run by ctest; exits nonzero if anything is off
+
+#include "integrity.h"
+#include "frame.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+		++failures; \
+	} \
+} while (0)
+
+static void test_back_to_back(void) {
+	FILE *f = tmpfile();
+	const char *payloads[] = {"first", "", "a third, longer payload"};
+	const uint8_t ops[] = {FRAME_AUDIT, FRAME_READ, FRAME_UPDATE};
+	for (int k = 0; k < 3; ++k) {
+		CHECK(frame_send(f, 1000 + k, ops[k], (k == 1) ? FRAME_INVALID : FRAME_OK,
+				strlen(payloads[k]), payloads[k]));
+	}
+	// a payload the caller writes itself, after the header
+	uint64_t words[4] = {1, 2, 3, 4};
+	CHECK(frame_send(f, 7, FRAME_READ, FRAME_OK, sizeof words, NULL));
+	CHECK(fwrite(words, sizeof words, 1, f) == 1);
+	rewind(f);
+
+	frame_hdr_t hdr;
+	char buf[64];
+	for (int k = 0; k < 3; ++k) {
+		CHECK(frame_recv_hdr(f, &hdr) == 1);
+		CHECK(hdr.id == 1000 + (uint64_t)k);
+		CHECK(hdr.op == ops[k]);
+		CHECK(hdr.version == FRAME_VERSION);
+		CHECK(hdr.status == ((k == 1) ? FRAME_INVALID : FRAME_OK));
+		CHECK(hdr.reserved == 0);
+		CHECK(hdr.length == strlen(payloads[k]));
+		CHECK(fread(buf, 1, hdr.length, f) == hdr.length);
+		CHECK(memcmp(buf, payloads[k], hdr.length) == 0);
+	}
+	CHECK(frame_recv_hdr(f, &hdr) == 1);
+	CHECK(hdr.id == 7 && hdr.length == sizeof words);
+	uint64_t back[4];
+	CHECK(fread(back, sizeof back, 1, f) == 1);
+	CHECK(memcmp(back, words, sizeof words) == 0);
+	CHECK(frame_recv_hdr(f, &hdr) == 0);
+	fclose(f);
+
+	// a header cut short, in a stream of its own so that nothing buffered
+	// from the clean end above is read again
+	f = tmpfile();
+	CHECK(frame_send(f, 9, FRAME_AUDIT, FRAME_OK, 0, NULL));
+	fflush(f);
+	CHECK(ftruncate(fileno(f), sizeof hdr - 3) == 0);
+	rewind(f);
+	CHECK(frame_recv_hdr(f, &hdr) == -1);
+	fclose(f);
+}
+
+static void test_audit_payload(void) {
+	const uint64_t n = 5;
+	audit_range_t ranges[2] = {{.start = 3, .count = 4}, {.start = 20, .count = 1}};
+	for (int seeded = 0; seeded < 2; ++seeded) {
+		audit_req_t areq = {.nchal = 3, .flags = AUDIT_FLAG_RANGES | (seeded ? AUDIT_FLAG_SEEDED : 0)};
+		audit_ranges_t ar = {.nranges = 2, .reserved = 0};
+		audit_seeds_t as = {.prg = 1, .reserved = 0};
+		uint64_t chal[3 * 5];
+		for (int i = 0; i < 15; ++i) chal[i] = 100 + i;
+
+		// lay the payload out the way a client sends it
+		char payload[512];
+		char *end = payload;
+		memcpy(end, &areq, sizeof areq); end += sizeof areq;
+		memcpy(end, &ar, sizeof ar); end += sizeof ar;
+		memcpy(end, ranges, sizeof ranges); end += sizeof ranges;
+		if (seeded) {
+			memcpy(end, &as, sizeof as); end += sizeof as;
+			memcpy(end, chal, areq.nchal * sizeof *chal); end += areq.nchal * sizeof *chal;
+		}
+		else {
+			memcpy(end, chal, areq.nchal * n * sizeof *chal); end += areq.nchal * n * sizeof *chal;
+		}
+		uint64_t left = end - payload;
+		CHECK(frame_audit_bytes(&areq, ar.nranges, n) == left);
+
+		// and take it apart the way the server does
+		const char *pos = payload;
+		audit_req_t got_req;
+		audit_ranges_t got_ar;
+		audit_range_t got_ranges[2];
+		CHECK(frame_take(&pos, &left, &got_req, sizeof got_req));
+		CHECK(got_req.nchal == 3 && got_req.flags == areq.flags);
+		CHECK(frame_take(&pos, &left, &got_ar, sizeof got_ar));
+		CHECK(frame_take(&pos, &left, got_ranges, got_ar.nranges * sizeof *got_ranges));
+		CHECK(got_ranges[1].start == 20 && got_ranges[1].count == 1);
+		uint64_t got_chal[15];
+		if (seeded) {
+			audit_seeds_t got_as;
+			CHECK(frame_take(&pos, &left, &got_as, sizeof got_as));
+			CHECK(frame_take(&pos, &left, got_chal, 3 * sizeof *got_chal));
+		}
+		else {
+			CHECK(frame_take(&pos, &left, got_chal, 3 * n * sizeof *got_chal));
+		}
+		CHECK(got_chal[2] == 102);
+		CHECK(left == 0);
+
+		// taking more than is left fails and takes nothing
+		const char *before = pos;
+		CHECK(!frame_take(&pos, &left, got_chal, 1));
+		CHECK(pos == before && left == 0);
+	}
+}
+
+// the entries an update touches, against a walk over its bytes
+static void test_update_chunks(void) {
+	for (uint64_t first = 0; first < 3 * BYTES_UNDER_P; ++first) {
+		for (uint64_t count = 1; count < 4 * BYTES_UNDER_P; ++count) {
+			uint64_t chunks = 1;
+			for (uint64_t b = first + 1; b < first + count; ++b) {
+				if (b % BYTES_UNDER_P == 0) ++chunks;
+			}
+			CHECK(frame_update_chunks(first, count) == chunks);
+		}
+	}
+}
+
+int main(void) {
+	test_back_to_back();
+	test_audit_payload();
+	test_update_chunks();
+	if (!failures) printf("frame_test: ok\n");
+	return failures != 0;
+}
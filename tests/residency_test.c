@@ -0,0 +1,134 @@
+// Tests for the residency-ordered audits of residency.h
+// the rows whose pages are all in memory come first and the rest after,
+// each group in file order; positions map back to every row exactly once;
+// and concatenated orders keep each range's rows within its own share of
+// the positions, as the per-node orders of NUMA-aware audits need
+// run by ctest; exits nonzero if anything is off
+
+#include "integrity.h"
+#include "residency.h"
+
+#define ROW_BYTES (3000)
+#define NROWS (40)
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+static size_t page;
+static uint64_t file_size;
+static bool touched[NROWS * ROW_BYTES / 1024 + 1];
+
+// a row counts as cached if every page of it that is in the file was touched
+static bool row_cached(uint64_t i) {
+	uint64_t lo = i * ROW_BYTES, hi = lo + ROW_BYTES;
+	if (hi > file_size) hi = file_size;
+	for (uint64_t p = lo / page; lo < hi && p <= (hi - 1) / page; ++p) {
+		if (!touched[p]) return false;
+	}
+	return true;
+}
+
+/* Collects the rows of positions [0, total) of the order, a few positions
+ * at a time as a scheduler hands them out. */
+static void walk(const row_order_t *o, uint64_t total, uint64_t *rows) {
+	uint64_t pos = 0;
+	while (pos < total) {
+		uint64_t want = (total - pos < 7) ? total - pos : 7;
+		uint64_t lo, hi, run_stop;
+		uint64_t used = row_order_map(o, pos, pos + want, &lo, &hi, &run_stop);
+		check(used > 0 && used <= want && hi - lo == used && hi <= run_stop,
+				"a mapped piece is consecutive rows within one run");
+		if (!used) break;
+		for (uint64_t i = lo; i < hi; ++i) rows[pos++] = i;
+	}
+}
+
+/* The expected order of rows [first, stop): cached ones, then the others. */
+static uint64_t expected(uint64_t first, uint64_t stop, uint64_t *rows) {
+	uint64_t k = 0, cached = 0;
+	for (uint64_t i = first; i < stop; ++i) {
+		if (row_cached(i)) rows[k++] = i;
+	}
+	cached = k;
+	for (uint64_t i = first; i < stop; ++i) {
+		if (!row_cached(i)) rows[k++] = i;
+	}
+	return cached;
+}
+
+int main(void) {
+	page = sysconf(_SC_PAGESIZE);
+	file_size = NROWS * ROW_BYTES - 1000;  // the last row is short
+	size_t npages = (file_size + page - 1) / page;
+	if (npages > sizeof touched) {
+		fprintf(stderr, "pages of %zu bytes are too small for this test\n", page);
+		return 1;
+	}
+
+	// an anonymous mapping stands in for the file: its pages are in memory
+	// exactly when they have been touched
+	char *map = mmap(NULL, npages * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	uint64_t warm[][2] = {{5 * ROW_BYTES, 13 * ROW_BYTES}, {20 * ROW_BYTES, 20 * ROW_BYTES + 1},
+		{27 * ROW_BYTES, 29 * ROW_BYTES}, {38 * ROW_BYTES, file_size}};
+	for (size_t w = 0; w < sizeof warm / sizeof *warm; ++w) {
+		for (uint64_t p = warm[w][0] / page; p <= (warm[w][1] - 1) / page; ++p) {
+			map[p * page] = 1;
+			touched[p] = true;
+		}
+	}
+
+	// rows past the end of the file are all padding, and count as cached
+	uint64_t first = 3, stop = NROWS + 2, total = stop - first;
+	uint64_t want[NROWS + 2], got[NROWS + 2];
+	row_order_t o;
+	check(row_order_residency(&o, "(mapped)", map, file_size, ROW_BYTES, first, stop), "probing residency");
+	uint64_t cached = expected(first, stop, want);
+	check(o.resident_rows == cached, "the cached rows are counted");
+	check(cached > 0 && cached < total, "some rows are cached and some are not");
+	walk(&o, total, got);
+	check(memcmp(got, want, total * sizeof *got) == 0,
+			"cached rows come first and the rest after, each in file order");
+	for (size_t r = 0; r < o.nruns; ++r) {
+		check(o.runs[r].count > 0, "runs are not empty");
+		check(r == 0 || o.runs[r].pos == o.runs[r - 1].pos + o.runs[r - 1].count, "runs follow each other");
+		check(r == 0 || o.runs[r].start != o.runs[r - 1].start + o.runs[r - 1].count,
+				"runs of adjacent rows are merged");
+	}
+	row_order_clear(&o);
+
+	// file order when nothing is probed
+	row_order_identity(&o, first, stop);
+	walk(&o, total, got);
+	for (uint64_t k = 0; k < total; ++k) check(got[k] == first + k, "identity order is file order");
+	row_order_clear(&o);
+
+	// orders of two halves, as for two NUMA nodes: cached rows go first
+	// within each half, and the first half's positions are its own rows
+	uint64_t mid = 20;
+	row_order_t parts[2];
+	check(row_order_residency(&parts[0], "(mapped)", map, file_size, ROW_BYTES, first, mid)
+			&& row_order_residency(&parts[1], "(mapped)", map, file_size, ROW_BYTES, mid, stop),
+			"probing residency of each half");
+	row_order_concat(&o, parts, 2);
+	uint64_t cached_lo = expected(first, mid, want);
+	uint64_t cached_hi = expected(mid, stop, want + (mid - first));
+	check(o.resident_rows == cached_lo + cached_hi, "the cached rows of both halves are counted");
+	walk(&o, total, got);
+	check(memcmp(got, want, total * sizeof *got) == 0,
+			"each half's rows stay in its own positions, cached ones first");
+	row_order_clear(&o);
+
+	munmap(map, npages * page);
+	if (!failures) printf("residency_test: ok\n");
+	return failures != 0;
+}
@@ -0,0 +1,135 @@
+// Tests for the work-stealing row scheduler of row_sched.h
+// every row is handed out exactly once, static blocks stay exactly the
+// blocks of schedule(static), a worker's own chunks shrink as its block
+// runs out and follow on from each other, and idle workers take rows off
+// a slow one
+// run by ctest; exits nonzero if anything is off
+
+#include "integrity.h"
+#include "row_sched.h"
+#include <omp.h>
+
+#define FIRST (100)
+#define ROWS (10007)
+#define MIN_CHUNK (16)
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+		++failures; \
+	} \
+} while (0)
+
+/* Runs the rows through nworkers OpenMP threads, each counting the rows it
+ * is handed; worker 0 dawdles over its rows when slow is set. */
+static void run(row_sched_t *s, int nworkers, bool slow, uint8_t *taken) {
+#pragma omp parallel num_threads(nworkers)
+	{
+		int t = omp_get_thread_num();
+		row_chunk_t c;
+		while (row_sched_next(s, t, &c)) {
+			for (uint64_t i = c.lo; i < c.hi; ++i) {
+#pragma omp atomic
+				++taken[i - FIRST];
+			}
+			if (slow && t == 0) usleep(2000);
+		}
+	}
+}
+
+static bool each_once(const uint8_t *taken) {
+	for (uint64_t i = 0; i < ROWS; ++i) {
+		if (taken[i] != 1) return false;
+	}
+	return true;
+}
+
+static void test_static_blocks(void) {
+	for (int nworkers = 1; nworkers <= 8; ++nworkers) {
+		row_sched_t s;
+		row_sched_init(&s, FIRST, FIRST + ROWS, nworkers, MIN_CHUNK, false, NULL);
+		for (int t = 0; t < nworkers; ++t) {
+			row_chunk_t c = {0};
+			// a worker's static block, all at once, and then nothing
+			CHECK(row_sched_next(&s, t, &c));
+			CHECK(c.lo == FIRST + (uint64_t)ROWS * t / nworkers);
+			CHECK(c.hi == FIRST + (uint64_t)ROWS * (t + 1) / nworkers);
+			CHECK(!row_sched_next(&s, t, &c));
+		}
+		row_sched_clear(&s);
+	}
+}
+
+static void test_guided_chunks(void) {
+	row_sched_t s;
+	row_sched_init(&s, FIRST, FIRST + ROWS, 1, MIN_CHUNK, true, NULL);
+	row_chunk_t c;
+	uint64_t prev_size = UINT64_MAX, next_lo = FIRST;
+	size_t chunks = 0;
+	while (row_sched_next(&s, 0, &c)) {
+		uint64_t size = c.hi - c.lo;
+		CHECK(c.lo == next_lo);                  // reads stay sequential
+		CHECK(c.new_run == (chunks == 0));
+		CHECK(size <= prev_size);                // large first, then smaller
+		CHECK(size >= MIN_CHUNK || c.hi == FIRST + ROWS);
+		if (chunks == 0) CHECK(size == ROWS / ROW_SCHED_GUIDE);
+		prev_size = size;
+		next_lo = c.hi;
+		++chunks;
+	}
+	CHECK(next_lo == FIRST + ROWS);
+	CHECK(chunks > 4 && chunks < ROWS / MIN_CHUNK);
+	row_sched_clear(&s);
+}
+
+static void test_coverage(bool steal, bool slow) {
+	for (int nworkers = 1; nworkers <= 6; nworkers += (nworkers < 2) ? 1 : 2) {
+		uint8_t *taken = calloc(ROWS, 1);
+		if (!taken) exit(1);
+		row_sched_t s;
+		row_sched_init(&s, FIRST, FIRST + ROWS, nworkers, MIN_CHUNK, steal, NULL);
+		run(&s, nworkers, slow, taken);
+		CHECK(each_once(taken));
+
+		uint64_t rows = 0, steals = 0;
+		for (int t = 0; t < nworkers; ++t) {
+			rows += s.w[t].rows;
+			steals += s.w[t].steals;
+			CHECK(s.w[t].busy >= 0);
+		}
+		CHECK(rows == ROWS);
+		if (!steal) CHECK(steals == 0);
+		// the others finish their blocks long before the slow worker does
+		if (steal && slow && nworkers > 1) {
+			CHECK(steals > 0);
+			CHECK(s.w[0].rows < (uint64_t)ROWS / nworkers);
+		}
+
+		// the report has a line per worker and a summary
+		char *text = NULL;
+		size_t len = 0;
+		FILE *out = open_memstream(&text, &len);
+		row_sched_report(&s, out);
+		fclose(out);
+		int lines = 0;
+		for (size_t i = 0; i < len; ++i) lines += text[i] == '\n';
+		CHECK(lines == nworkers + 1);
+		CHECK(strstr(text, steal ? "work-stealing scheduling" : "static scheduling") != NULL);
+		free(text);
+
+		row_sched_clear(&s);
+		free(taken);
+	}
+}
+
+int main(void) {
+	test_static_blocks();
+	test_guided_chunks();
+	test_coverage(false, false);
+	test_coverage(true, false);
+	test_coverage(true, true);
+	if (!failures) printf("row_sched_test: ok\n");
+	return failures != 0;
+}
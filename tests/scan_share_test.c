@@ -0,0 +1,132 @@
+// Tests for the shared audit scans of scan_share.h
+// audits that arrive while a scan is in flight join it at its current row,
+// the scan wraps round for the rows they missed, every challenge gets its
+// own responses, and the rows read stay near one scan's worth
+// run by ctest; exits nonzero if anything is off
+
+#include "integrity.h"
+#include "scan_share.h"
+#include <sys/wait.h>
+
+#define N (3)
+#define M (37)
+#define NSLOTS (5)
+
+static int failures = 0;
+
+static void expect(bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+// stands in for the product of row i with a challenge
+static uint64_t product(const uint64_t *chal, uint64_t i) {
+	return chal[0] * 1000 + i;
+}
+
+static uint32_t join(scan_share_t *sh, uint32_t nchal, uint64_t first_chal, uint32_t *mine) {
+	uint32_t others;
+	if (!scan_claim_slots(sh, nchal, mine, &others)) return UINT32_MAX;
+	for (uint32_t j = 0; j < nchal; ++j) {
+		uint64_t *chal = slot_challenge(sh, mine[j]);
+		for (int k = 0; k < N; ++k) chal[k] = first_chal + j;
+	}
+	return others;
+}
+
+/* Runs one chunk the way the leader does, counting how often each slot
+ * sees each row. Returns the rows it had to read. The chunks vary in size,
+ * so that audits join and finish part way through them. */
+static uint64_t run_chunk(scan_share_t *sh, uint32_t seen[NSLOTS][M]) {
+	static const uint64_t sizes[] = {8, 5, 11};
+	static int next = 0;
+	uint32_t order[NSLOTS];
+	uint64_t rows[NSLOTS], start, len, read = 0;
+	uint64_t chunk_rows = sizes[next++ % 3];
+	uint32_t nactive = scan_plan_chunk(sh, chunk_rows, order, rows, &start, &len);
+	for (uint64_t t = 0; t < len; ++t) {
+		uint32_t count = scan_chunk_wanting(rows, nactive, t);
+		if (count) ++read;
+		for (uint32_t a = 0; a < count; ++a) {
+			slot_response(sh, order[a])[start + t] = product(slot_challenge(sh, order[a]), start + t);
+			++seen[order[a]][start + t];
+		}
+	}
+	scan_finish_chunk(sh, order, rows, nactive, start, len);
+	return read;
+}
+
+static bool any_active(const scan_share_t *sh) {
+	for (uint32_t k = 0; k < sh->nslots; ++k) {
+		if (sh->slots[k].state == SLOT_ACTIVE) return true;
+	}
+	return false;
+}
+
+static void test_late_joiners(void) {
+	scan_share_t *sh = scan_share_create(NSLOTS, N, M);
+	uint32_t seen[NSLOTS][M] = {{0}};
+	uint32_t a[1], b[2], c[1];
+	uint64_t read = 0;
+
+	expect(join(sh, 1, 10, a) == 0, "the first audit finds nothing in flight");
+	read += run_chunk(sh, seen);
+	read += run_chunk(sh, seen);
+	expect(sh->cursor == 8 + 5, "the scan moves on a chunk at a time");
+	expect(join(sh, 2, 20, b) == 1, "a second audit joins the one in flight");
+	read += run_chunk(sh, seen);
+	uint64_t last_join = sh->cursor;
+	expect(join(sh, 1, 30, c) == 3, "a third audit joins both");
+	// a scan that never finishes shows up as missing rows, not a hang
+	for (int chunks = 0; chunks < 4 * M && any_active(sh); ++chunks) read += run_chunk(sh, seen);
+
+	uint32_t all[] = {a[0], b[0], b[1], c[0]};
+	uint64_t first_chal[] = {10, 20, 21, 30};
+	for (int s = 0; s < 4; ++s) {
+		bool once = true, right = true;
+		const uint64_t *resp = slot_response(sh, all[s]);
+		for (uint64_t i = 0; i < M; ++i) {
+			once = once && seen[all[s]][i] == 1;
+			right = right && resp[i] == first_chal[s] * 1000 + i;
+		}
+		expect(once, "every audit sees every row exactly once");
+		expect(right, "every audit gets the products with its own challenge");
+		expect(sh->slots[all[s]].state == SLOT_DONE, "finished audits are done");
+	}
+	// one pass, plus wrapping round to where the last audit came in
+	expect(read == M + last_join, "overlapping audits read the rows about once");
+	expect(sh->cursor == last_join, "the scan stops where the last audit joined");
+
+	for (int s = 0; s < 4; ++s) sh->slots[all[s]].state = SLOT_FREE;
+	uint32_t again[NSLOTS];
+	expect(join(sh, NSLOTS, 40, again) == 0, "slots handed back can be claimed again");
+	scan_share_destroy(sh);
+}
+
+static void test_full_and_dead(void) {
+	scan_share_t *sh = scan_share_create(3, N, M);
+	uint32_t mine[3], slot;
+	expect(join(sh, 2, 10, mine) == 0, "claiming two of three slots");
+	expect(join(sh, 2, 20, mine) == UINT32_MAX, "a claim that does not fit takes nothing");
+	expect(scan_reclaim_slots(sh) == 0, "slots of a live process are kept");
+
+	// a child takes the last slot and dies holding it
+	pid_t child = fork();
+	if (child == 0) _exit(join(sh, 1, 30, &slot) == 2 ? 0 : 1);
+	int status;
+	waitpid(child, &status, 0);
+	expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the child claims the last slot");
+	expect(join(sh, 1, 40, &slot) == UINT32_MAX, "the table is full");
+	expect(scan_reclaim_slots(sh) == 1, "the dead child's slot is freed");
+	expect(join(sh, 1, 40, &slot) == 2, "and can be claimed again");
+	scan_share_destroy(sh);
+}
+
+int main(void) {
+	test_late_joiners();
+	test_full_and_dead();
+	if (!failures) printf("scan_share_test: ok\n");
+	return failures != 0;
+}
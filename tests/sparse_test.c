@@ -0,0 +1,132 @@
+// Tests for the sparse-file audits of sparse.h
+// on a real sparse file: the extents cover every byte written, rows inside
+// holes have no data and are all zeros, and multiplying only the column
+// ranges of a partly allocated row gives the same products as the whole
+// row, while touching about as many columns as there are allocated bytes
+// run by ctest; exits nonzero if anything is off
+
+#define _GNU_SOURCE // for SEEK_DATA
+#include "integrity.h"
+#include "audit_kernel.h"
+#include "sparse.h"
+#include "tinymt64.h"
+
+#define NCOLS (1024)
+#define NROWS (64)
+#define NCHAL (3)
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+static const size_t row_bytes = NCOLS * BYTES_UNDER_P;
+
+// byte ranges written, whole 4 KiB blocks so that the extents end where
+// the data does, leaving the rest of the file as holes: across rows 2 and
+// 3, rows 10 to 14 whole with parts of 9 and 15, and rows 39 to 41
+static const uint64_t written[][2] = {
+	{5 * 4096, 6 * 4096},
+	{17 * 4096, 27 * 4096},
+	{69 * 4096, 73 * 4096},
+};
+
+static bool in_extents(const extent_map_t *em, uint64_t lo, uint64_t hi) {
+	for (size_t e = 0; e < em->nextents; ++e) {
+		if (em->ext[e].start <= lo && hi <= em->ext[e].stop) return true;
+	}
+	return false;
+}
+
+int main(void) {
+	char path[] = "/tmp/sparse_testXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	unlink(path);
+	tinymt64_t state = {0};
+	tinymt64_init(&state, 17);
+
+	uint64_t file_size = NROWS * row_bytes;
+	if (ftruncate(fd, file_size) != 0) {
+		perror("ftruncate");
+		return 1;
+	}
+	for (size_t w = 0; w < sizeof written / sizeof *written; ++w) {
+		size_t len = written[w][1] - written[w][0];
+		uint8_t *bytes = malloc(len);
+		for (size_t b = 0; b < len; ++b) bytes[b] = tinymt64_generate_uint64(&state) | 1;
+		my_pwrite(fd, bytes, len, written[w][0]);
+		free(bytes);
+	}
+	fsync(fd);
+
+	extent_map_t em;
+	char fd_path[64];
+	snprintf(fd_path, sizeof fd_path, "/proc/self/fd/%d", fd);
+	check(extent_map_load(&em, fd_path), "loading the extents");
+	if (!extent_map_sparse(&em)) {
+		printf("sparse_test: this file system reports no holes; skipped\n");
+		return 0;
+	}
+	check(em.file_size == file_size && em.data_bytes < file_size / 2, "most of the file is holes");
+	for (size_t w = 0; w < sizeof written / sizeof *written; ++w) {
+		check(in_extents(&em, written[w][0], written[w][1]), "every written byte is in an extent");
+	}
+	for (size_t e = 1; e < em.nextents; ++e) {
+		check(em.ext[e].start > em.ext[e - 1].stop, "extents are sorted and apart");
+	}
+	check(extent_map_dense(&em, 11 * row_bytes, 14 * row_bytes), "whole written rows are dense");
+	check(!extent_map_dense(&em, 3 * row_bytes, 4 * row_bytes), "a partly written row is not");
+
+	uint64_t chal_words[NCHAL][NCOLS];
+	audit_chal_t chals[NCHAL];
+	for (int j = 0; j < NCHAL; ++j) {
+		for (int c = 0; c < NCOLS; ++c) chal_words[j][c] = tinymt64_generate_uint64(&state) % P57;
+		audit_chal_init(&chals[j], chal_words[j], NCOLS);
+	}
+	const audit_kernel_t *kernel = select_audit_kernel(NULL);
+	uint64_t *row = calloc(1, row_bytes + 64);
+	size_t hole_rows = 0, cols_used = 0;
+	for (uint64_t i = 0; i < NROWS; ++i) {
+		uint64_t off = i * row_bytes;
+		my_pread(fd, row, row_bytes, off);
+		uint64_t whole[NCHAL], ranged[NCHAL] = {0};
+		row_dot_multi(kernel->fn, row, chals, NCHAL, NCOLS, whole);
+
+		col_range_t cols[SPARSE_MAX_COL_RANGES];
+		size_t nr = extent_map_row_cols(&em, off, NCOLS, cols);
+		for (size_t r = 0; r < nr; ++r) {
+			check(cols[r].col % 8 == 0 && cols[r].col + cols[r].ncols <= NCOLS,
+					"column ranges are whole groups within the row");
+			row_dot_multi_add(kernel->fn, row, chals, NCHAL, cols[r].col, cols[r].ncols, ranged);
+			cols_used += cols[r].ncols;
+		}
+		check(memcmp(whole, ranged, sizeof whole) == 0,
+				"the allocated columns alone give the row's products");
+
+		if (!extent_map_has_data(&em, off, off + row_bytes)) {
+			++hole_rows;
+			bool zero = true;
+			for (size_t b = 0; b < row_bytes; ++b) zero = zero && ((uint8_t*)row)[b] == 0;
+			check(zero && nr == 0, "a row with no data reads as zeros and has no columns");
+			for (int j = 0; j < NCHAL; ++j) check(whole[j] == 0, "and its products are zero");
+		}
+	}
+	check(hole_rows >= NROWS - 14, "rows inside holes are found");
+	// each extent end widens by at most one group of 8 columns per row
+	check(cols_used * BYTES_UNDER_P <= em.data_bytes + 2 * (em.nextents + NROWS) * 8 * BYTES_UNDER_P,
+			"the columns used scale with the allocated bytes");
+
+	free(row);
+	extent_map_clear(&em);
+	close(fd);
+	if (!failures) printf("sparse_test: ok\n");
+	return failures != 0;
+}
@@ -0,0 +1,150 @@
+// Tests for the compressed stores of zframes.h
+// a store written from a data file gives back the same logical bytes,
+// frame by frame and through its stdio stream, with the last frame short;
+// a store whose header or frame index does not hold up is not opened
+// run by ctest; exits nonzero if anything is off
+
+#define _GNU_SOURCE // for fopencookie
+#include "integrity.h"
+#include "zframes.h"
+#include "tinymt64.h"
+
+#define ROW_BYTES (BYTES_UNDER_P * 256)
+#define NROWS (1400)
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+// opens the store on path again, after its bytes at offset were changed
+static bool opens_with(int fd, const char *path, const void *bytes, size_t len, uint64_t offset) {
+	uint8_t saved[len];
+	my_pread(fd, saved, len, offset);
+	my_pwrite(fd, bytes, len, offset);
+	int rfd = open(path, O_RDONLY);
+	zframes_t z;
+	bool ok = zframes_open(&z, rfd);
+	if (ok) zframes_close(&z);
+	close(rfd);
+	my_pwrite(fd, saved, len, offset);
+	return ok;
+}
+
+int main(void) {
+	char raw_path[] = "/tmp/zframes_rawXXXXXX";
+	char store_path[] = "/tmp/zframes_storeXXXXXX";
+	int raw_fd = mkstemp(raw_path);
+	int store_fd = mkstemp(store_path);
+	if (raw_fd < 0 || store_fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+
+	// small values in a row-dependent pattern, so the frames compress
+	uint64_t size = (uint64_t)NROWS * ROW_BYTES;
+	uint8_t *data = malloc(size);
+	tinymt64_t state = {0};
+	tinymt64_init(&state, 19);
+	for (uint64_t b = 0; b < size; ++b) {
+		data[b] = (b / ROW_BYTES + (tinymt64_generate_uint64(&state) & 3)) & 0x7f;
+	}
+	my_pwrite(raw_fd, data, size, 0);
+
+	check(zframes_write(raw_path, store_path, ROW_BYTES, 6), "writing the store");
+	check(zframes_probe(store_fd), "recognising the store");
+	check(!zframes_probe(raw_fd), "not taking the plain file for a store");
+
+	zframes_t z;
+	if (!zframes_open(&z, store_fd)) {
+		fprintf(stderr, "FAILED: opening the store\n");
+		return 1;
+	}
+	uint64_t frame_bytes = zframes_frame_bytes(&z);
+	check(z.hdr.logical_size == size, "the logical size");
+	check(frame_bytes <= ZFRAMES_FRAME_BYTES && frame_bytes % ROW_BYTES == 0, "frames of whole rows");
+	check(z.hdr.nframes == (size + frame_bytes - 1) / frame_bytes && size % frame_bytes != 0,
+			"a short last frame");
+	struct stat s;
+	fstat(store_fd, &s);
+	check(z.index[z.hdr.nframes] == (uint64_t)s.st_size, "the index ends at the end of the file");
+	check(z.index[z.hdr.nframes] - z.index[0] < size / 2, "compressing the data");
+
+	// every frame decompresses to its rows, the short one padded with zeros
+	uint8_t *out = malloc(frame_bytes);
+	uint8_t *packed = malloc(z.max_packed);
+	for (uint64_t f = 0; f < z.hdr.nframes; ++f) {
+		uint64_t len = zframes_frame_len(&z, f);
+		memset(out, 0xff, frame_bytes);
+		check(zframes_read_frame(&z, store_fd, f, packed, out), "reading a frame");
+		check(memcmp(out, data + f * frame_bytes, len) == 0, "the bytes of a frame");
+		bool padded = true;
+		for (uint64_t b = len; b < frame_bytes; ++b) padded = padded && out[b] == 0;
+		check(padded, "zero padding after a short frame");
+	}
+
+	// the stream reads any span, across frames and up to the end
+	FILE *stream = zframes_fopen(store_path);
+	check(stream != NULL, "opening the stream");
+	if (stream) {
+		uint64_t spans[][2] = {
+			{0, ROW_BYTES},
+			{frame_bytes - 100, 300},
+			{frame_bytes - 5, frame_bytes + 10},
+			{size - 50, 50},
+			{123457, 7},
+		};
+		uint8_t *buf = malloc(frame_bytes + 10);
+		for (size_t i = 0; i < sizeof spans / sizeof *spans; ++i) {
+			fseek(stream, spans[i][0], SEEK_SET);
+			size_t got = fread(buf, 1, spans[i][1], stream);
+			check(got == spans[i][1] && memcmp(buf, data + spans[i][0], got) == 0, "reading a span of the stream");
+		}
+		fseek(stream, size - 10, SEEK_SET);
+		check(fread(buf, 1, 100, stream) == 10, "a short read at the end of the stream");
+		fseek(stream, 0, SEEK_END);
+		check((uint64_t)ftell(stream) == size, "seeking to the end of the stream");
+		free(buf);
+		fclose(stream);
+	}
+
+	// a frame index that falls back, starts inside itself or runs past the
+	// end of the file, or a header that does not match the data, is refused
+	uint64_t index_at = sizeof z.hdr;
+	uint64_t back = z.index[0];
+	check(!opens_with(store_fd, store_path, &back, sizeof back, index_at + 2 * sizeof back),
+			"refusing an index that falls back");
+	uint64_t early = sizeof z.hdr;
+	check(!opens_with(store_fd, store_path, &early, sizeof early, index_at),
+			"refusing a first frame inside the index");
+	uint64_t past = s.st_size + 1;
+	check(!opens_with(store_fd, store_path, &past, sizeof past, index_at + z.hdr.nframes * sizeof past),
+			"refusing an index past the end of the file");
+	uint64_t many = UINT64_MAX / 8;
+	check(!opens_with(store_fd, store_path, &many, sizeof many, offsetof(zframes_header_t, nframes)),
+			"refusing a frame count the file cannot hold");
+	uint64_t bigger = size + frame_bytes;
+	check(!opens_with(store_fd, store_path, &bigger, sizeof bigger, offsetof(zframes_header_t, logical_size)),
+			"refusing a logical size the frames do not hold");
+	int rfd = open(store_path, O_RDONLY);
+	zframes_t again;
+	check(zframes_open(&again, rfd), "opening the store once put back");
+	zframes_close(&again);
+	close(rfd);
+
+	zframes_close(&z);
+	free(out);
+	free(packed);
+	free(data);
+	close(raw_fd);
+	close(store_fd);
+	unlink(raw_path);
+	unlink(store_path);
+
+	if (!failures) printf("zframes_test: ok\n");
+	return failures != 0;
+}